@@ -8,8 +8,8 @@ echo ==========================================
 echo.
 
 REM Check if we're in the right directory
-if not exist "server_iocp.c" (
-    echo ERROR: server_iocp.c not found!
+if not exist "codes\iocp_server.c" (
+    echo ERROR: codes\iocp_server.c not found!
     echo Make sure you're running this script from the project root directory.
     pause
     exit /b 1
@@ -51,14 +51,14 @@ if "%COMPILER%" == "gcc" goto :build_gcc
 
 :build_msvc
 echo Building with Visual Studio...
-cl /Fe:build\server_iocp.exe server_iocp.c /link ws2_32.lib mswsock.lib
+cl /Fe:build\server_iocp.exe codes\iocp_server.c codes\docs_server.c codes\io_pool.c codes\log.c codes\name_index.c codes\arena.c codes\epoch.c codes\commit_queue.c codes\line_scan.c codes\metrics.c codes\wal.c codes\snapshot.c codes\timer_wheel.c /link ws2_32.lib mswsock.lib
 if %ERRORLEVEL% neq 0 (
     echo ERROR: Server build failed!
     pause
     exit /b 1
 )
 
-cl /Fe:build\client_iocp.exe client_iocp.c /link ws2_32.lib
+cl /Fe:build\client_iocp.exe codes\iocp_client.c /link ws2_32.lib
 if %ERRORLEVEL% neq 0 (
     echo ERROR: Client build failed!
     pause
@@ -67,21 +67,21 @@ if %ERRORLEVEL% neq 0 (
 
 REM Build debug versions
 echo Building debug versions...
-cl /Zi /DEBUG /Fe:build\server_iocp_debug.exe server_iocp.c /link ws2_32.lib mswsock.lib
-cl /Zi /DEBUG /Fe:build\client_iocp_debug.exe client_iocp.c /link ws2_32.lib
+cl /Zi /DEBUG /Fe:build\server_iocp_debug.exe codes\iocp_server.c codes\docs_server.c codes\io_pool.c codes\log.c codes\name_index.c codes\arena.c codes\epoch.c codes\commit_queue.c codes\line_scan.c codes\metrics.c codes\wal.c codes\snapshot.c codes\timer_wheel.c /link ws2_32.lib mswsock.lib
+cl /Zi /DEBUG /Fe:build\client_iocp_debug.exe codes\iocp_client.c /link ws2_32.lib
 
 goto :build_complete
 
 :build_gcc
 echo Building with MinGW-w64...
-gcc -Wall -Wextra -O2 -o build\server_iocp.exe server_iocp.c -lws2_32 -lmswsock
+gcc -Wall -Wextra -O2 -o build\server_iocp.exe codes\iocp_server.c codes\docs_server.c codes\io_pool.c codes\log.c codes\name_index.c codes\arena.c codes\epoch.c codes\commit_queue.c codes\line_scan.c codes\metrics.c codes\wal.c codes\snapshot.c codes\timer_wheel.c -lws2_32 -lmswsock
 if %ERRORLEVEL% neq 0 (
     echo ERROR: Server build failed!
     pause
     exit /b 1
 )
 
-gcc -Wall -Wextra -O2 -o build\client_iocp.exe client_iocp.c -lws2_32
+gcc -Wall -Wextra -O2 -o build\client_iocp.exe codes\iocp_client.c -lws2_32
 if %ERRORLEVEL% neq 0 (
     echo ERROR: Client build failed!
     pause
@@ -90,8 +90,8 @@ if %ERRORLEVEL% neq 0 (
 
 REM Build debug versions
 echo Building debug versions...
-gcc -Wall -Wextra -g -O0 -o build\server_iocp_debug.exe server_iocp.c -lws2_32 -lmswsock
-gcc -Wall -Wextra -g -O0 -o build\client_iocp_debug.exe client_iocp.c -lws2_32
+gcc -Wall -Wextra -g -O0 -o build\server_iocp_debug.exe codes\iocp_server.c codes\docs_server.c codes\io_pool.c codes\log.c codes\name_index.c codes\arena.c codes\epoch.c codes\commit_queue.c codes\line_scan.c codes\metrics.c codes\wal.c codes\snapshot.c codes\timer_wheel.c -lws2_32 -lmswsock
+gcc -Wall -Wextra -g -O0 -o build\client_iocp_debug.exe codes\iocp_client.c -lws2_32
 
 goto :build_complete
 
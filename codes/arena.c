@@ -0,0 +1,100 @@
+/// arena.c
+#include "arena.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+struct ArenaBlock {
+    ArenaBlock* prev;
+    size_t size;                // usable bytes after the header
+};
+
+#define ARENA_ALIGN(n) (((n) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+#define ARENA_HEADER ARENA_ALIGN(sizeof(ArenaBlock))
+
+void ArenaInit(Arena* arena) {
+    arena->current = NULL;
+    arena->used = 0;
+    arena->reserved = 0;
+}
+
+void* ArenaAlloc(Arena* arena, size_t size) {
+    size = ARENA_ALIGN(size);
+
+    if (size > ARENA_BLOCK_SIZE / 4) {
+        // Oversized requests get a block of their own, linked behind the
+        // current one so its free space is not abandoned
+        ArenaBlock* block = (ArenaBlock*)malloc(ARENA_HEADER + size);
+        if (!block) return NULL;
+
+        block->size = size;
+        if (arena->current) {
+            block->prev = arena->current->prev;
+            arena->current->prev = block;
+        }
+        else {
+            block->prev = NULL;
+            arena->current = block;
+            arena->used = size;
+        }
+        arena->reserved += size;
+        memset((char*)block + ARENA_HEADER, 0, size);
+        return (char*)block + ARENA_HEADER;
+    }
+
+    if (!arena->current || arena->used + size > arena->current->size) {
+        ArenaBlock* block = (ArenaBlock*)malloc(ARENA_HEADER + ARENA_BLOCK_SIZE);
+        if (!block) return NULL;
+
+        block->size = ARENA_BLOCK_SIZE;
+        block->prev = arena->current;
+        arena->current = block;
+        arena->used = 0;
+        arena->reserved += ARENA_BLOCK_SIZE;
+    }
+
+    char* ptr = (char*)arena->current + ARENA_HEADER + arena->used;
+    arena->used += size;
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+char* ArenaStrdup(Arena* arena, const char* str) {
+    size_t len = strlen(str);
+    char* copy = (char*)ArenaAlloc(arena, len + 1);
+    if (copy) memcpy(copy, str, len + 1);
+    return copy;
+}
+
+ArenaMark ArenaGetMark(const Arena* arena) {
+    ArenaMark mark;
+    mark.current = arena->current;
+    mark.prev = arena->current ? arena->current->prev : NULL;
+    mark.used = arena->used;
+    mark.reserved = arena->reserved;
+    return mark;
+}
+
+void ArenaRewind(Arena* arena, const ArenaMark* mark) {
+    // Blocks made current since the mark, and oversized blocks linked
+    // behind them
+    ArenaBlock* block = arena->current;
+    while (block != mark->current) {
+        ArenaBlock* prev = block->prev;
+        free(block);
+        block = prev;
+    }
+
+    // Oversized blocks linked behind the marked block itself
+    if (block) {
+        while (block->prev != mark->prev) {
+            ArenaBlock* oversized = block->prev;
+            block->prev = oversized->prev;
+            free(oversized);
+        }
+    }
+
+    arena->current = mark->current;
+    arena->used = mark->used;
+    arena->reserved = mark->reserved;
+}
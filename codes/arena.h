@@ -0,0 +1,39 @@
+/// arena.h
+// Bump allocator for document metadata: Document structs, titles and section
+// tables. These are created once and live for the life of the process, so the
+// arena hands out memory in large blocks and never frees individual objects;
+// only the most recent allocations can be handed back, by rewinding to a mark.
+// Not thread-safe; the document store only allocates with docsLock held
+// exclusively.
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "platform.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+
+typedef struct {
+    ArenaBlock* current;
+    size_t used;                // bytes handed out from current
+    size_t reserved;            // total bytes in all blocks (for stats)
+} Arena;
+
+// Where the arena stood before an allocation that may have to be undone
+typedef struct {
+    ArenaBlock* current;
+    ArenaBlock* prev;           // current->prev, behind which oversized blocks go
+    size_t used;
+    size_t reserved;
+} ArenaMark;
+
+void ArenaInit(Arena* arena);
+void* ArenaAlloc(Arena* arena, size_t size);        // zeroed, pointer aligned
+char* ArenaStrdup(Arena* arena, const char* str);
+
+ArenaMark ArenaGetMark(const Arena* arena);
+// Give back everything allocated since mark, freeing the blocks added since
+void ArenaRewind(Arena* arena, const ArenaMark* mark);
+
+#endif // ARENA_H
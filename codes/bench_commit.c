@@ -0,0 +1,278 @@
+/// bench_commit.c
+// Stress benchmark for the per-section commit queue (codes/commit_queue.c).
+//
+// Usage: bench_commit [threads] [writers-per-section] [sections] [seconds] [fifo|shortest]
+//
+// Every thread plays its share of the writers of every section and submits
+// one write after another, round-robin over the sections, through the same
+// path the server uses: pooled WriteNode, flat-combining submit, batch
+// publish with the superseded bodies freed at once and the replaced one
+// retired through the epoch collector. Reader threads keep walking the
+// published bodies inside an epoch meanwhile. At the end every write must
+// have been completed exactly once and each section's version must equal the
+// number of writes submitted to it. Run it under -fsanitize=address to catch
+// any node or body that is reused too early.
+#include "commit_queue.h"
+#include "docs_server.h"
+#include "io_pool.h"
+#include "epoch.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_SECTIONS 64
+#define BENCH_READERS 2
+
+// Stands in for a client: the queue only carries it through to the apply
+// callback, which counts the completion
+typedef struct {
+    volatile LONG64 submitted;
+    volatile LONG64 completed;
+} BenchWriter;
+
+typedef struct {
+    SectionBody* volatile body;
+    CommitQueue commits;
+    volatile LONG64 submitted;
+    volatile LONG64 batches;
+    volatile LONG64 maxBatch;
+} BenchSection;
+
+static BenchSection g_sections[BENCH_MAX_SECTIONS];
+static BenchWriter* g_writers;      // sections * writers, section-major
+static int g_threadCount = 8;
+static int g_writersPerSection = 4096;
+static int g_sectionCount = 4;
+static int g_seconds = 3;
+static volatile LONG g_stop = 0;
+static volatile LONG64 g_reads = 0;
+static volatile LONG64 g_corrupt = 0;
+static volatile LONG64 g_deferred = 0;     // combining turns cut short at COMMIT_MAX_PASSES
+
+// Sections whose combining turn this writer deferred (bit per section), run
+// before its next round of submits
+static THREAD_LOCAL uint64_t t_deferred = 0;
+
+// Body and storage in one block, so the bench can free it with free()
+static SectionBody* MakeBody(int writer, LONG64 seq) {
+    char text[64];
+    int len = snprintf(text, sizeof(text), "writer %d seq %lld", writer, (long long)seq) + 1;
+
+    SectionBody* body = (SectionBody*)malloc(sizeof(SectionBody) + sizeof(BodyStorage) + sizeof(char*) + len);
+    if (!body) return NULL;
+    BodyStorage* storage = (BodyStorage*)(body + 1);
+    storage->refs = 1;
+    storage->lineCap = storage->lineCount = 1;
+    storage->textCap = storage->textLen = len;
+    storage->text = (char*)&storage->lines[1];
+    storage->lines[0] = storage->text;
+    memcpy(storage->text, text, len);
+    body->version = 0;
+    body->refs = 1;
+    body->storage = storage;
+    body->lineCount = 1;
+    body->textLen = len;
+    body->lines = storage->lines;
+    return body;
+}
+
+static BOOL BodyIntact(const SectionBody* body) {
+    return body->lineCount == 1 &&
+        body->lines == body->storage->lines &&
+        body->lines[0] == body->storage->text &&
+        strlen(body->lines[0]) + 1 == body->textLen &&
+        strncmp(body->lines[0], "writer ", 7) == 0;
+}
+
+// Same shape as ApplyBatch in docs_server.c
+static void ApplyBench(void* ctx, WriteNode* batch) {
+    BenchSection* section = (BenchSection*)ctx;
+    SectionBody* old = section->body;
+    LONG64 version = old ? old->version : 0;
+    SectionBody* last = NULL;
+    LONG64 size = 0;
+
+    for (WriteNode* node = batch; node; node = node->next) {
+        free(last);
+        last = node->body;
+        version++;
+        size++;
+    }
+    last->version = version;
+    WritePointerRelease((PVOID*)&section->body, last);
+    EpochRetire(old, free);
+
+    while (batch) {
+        WriteNode* node = batch;
+        batch = node->next;
+        InterlockedIncrement64(&((BenchWriter*)node->client)->completed);
+        FreeWriteNode(node);
+    }
+
+    section->batches++;
+    if (size > section->maxBatch) section->maxBatch = size;
+}
+
+static void DeferBench(void* ctx) {
+    InterlockedIncrement64(&g_deferred);
+    t_deferred |= 1ULL << ((BenchSection*)ctx - g_sections);
+}
+
+static void RunDeferred(void) {
+    while (t_deferred) {
+        int s = 0;
+        while (!(t_deferred & (1ULL << s))) s++;
+        t_deferred &= ~(1ULL << s);
+        CommitQueueDrain(&g_sections[s].commits, ApplyBench, DeferBench, &g_sections[s]);
+    }
+}
+
+static void WriterLoop(int index) {
+    int share = g_writersPerSection / g_threadCount;
+    int first = index * share;
+    if (index == g_threadCount - 1) share = g_writersPerSection - first;
+    LONG64 seq = 0;
+
+    while (!ReadAcquire(&g_stop)) {
+        RunDeferred();
+        for (int s = 0; s < g_sectionCount; s++) {
+            int w = first + (int)(seq % share);
+            BenchWriter* writer = &g_writers[s * g_writersPerSection + w];
+
+            SectionBody* body = MakeBody(w, seq);
+            WriteNode* node = body ? AllocWriteNode() : NULL;
+            if (!node) {
+                free(body);
+                fprintf(stderr, "[Bench] Out of memory\n");
+                abort();
+            }
+            node->client = (ClientContext*)writer;
+            node->body = body;
+            node->estimatedLines = (int)(seq % 16) + 1;
+
+            InterlockedIncrement64(&writer->submitted);
+            InterlockedIncrement64(&g_sections[s].submitted);
+            CommitQueueSubmit(&g_sections[s].commits, node, ApplyBench, DeferBench, &g_sections[s]);
+        }
+        seq++;
+    }
+    RunDeferred();
+}
+
+static void ReaderLoop(void) {
+    LONG64 reads = 0;
+
+    while (!ReadAcquire(&g_stop)) {
+        for (int s = 0; s < g_sectionCount; s++) {
+            EpochEnter();
+            const SectionBody* body = (const SectionBody*)ReadPointerAcquire((PVOID*)&g_sections[s].body);
+            if (body && !BodyIntact(body)) InterlockedIncrement64(&g_corrupt);
+            EpochExit();
+            reads++;
+        }
+    }
+    InterlockedExchangeAdd64(&g_reads, reads);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall BenchThread(void* param) {
+#else
+static void* BenchThread(void* param) {
+#endif
+    int index = (int)(intptr_t)param;
+    if (index < g_threadCount) WriterLoop(index);
+    else ReaderLoop();
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc > 1) g_threadCount = atoi(argv[1]);
+    if (argc > 2) g_writersPerSection = atoi(argv[2]);
+    if (argc > 3) g_sectionCount = atoi(argv[3]);
+    if (argc > 4) g_seconds = atoi(argv[4]);
+    if (argc > 5) {
+        CommitOrder order;
+        if (!CommitParseOrder(argv[5], &order)) {
+            fprintf(stderr, "Usage: %s [threads] [writers-per-section] [sections] [seconds] [fifo|shortest]\n", argv[0]);
+            return 1;
+        }
+        CommitQueueSetOrder(order);
+    }
+
+    if (g_threadCount < 1 || g_threadCount > BENCH_MAX_THREADS ||
+        g_sectionCount < 1 || g_sectionCount > BENCH_MAX_SECTIONS ||
+        g_writersPerSection < g_threadCount || g_seconds < 1) {
+        fprintf(stderr, "[Bench] threads 1-%d, sections 1-%d, writers >= threads, seconds >= 1\n",
+            BENCH_MAX_THREADS, BENCH_MAX_SECTIONS);
+        return 1;
+    }
+
+    g_writers = (BenchWriter*)calloc((size_t)g_sectionCount * g_writersPerSection, sizeof(BenchWriter));
+    if (!g_writers) return 1;
+    for (int s = 0; s < g_sectionCount; s++) CommitQueueInit(&g_sections[s].commits);
+
+    printf("[Bench] %d threads, %d writers x %d sections, %d readers, %ds\n",
+        g_threadCount, g_writersPerSection, g_sectionCount, BENCH_READERS, g_seconds);
+
+    int total = g_threadCount + BENCH_READERS;
+#ifdef _WIN32
+    HANDLE threads[BENCH_MAX_THREADS + BENCH_READERS];
+#else
+    pthread_t threads[BENCH_MAX_THREADS + BENCH_READERS];
+#endif
+    ULONGLONG start = GetTickCount64();
+    for (int i = 0; i < total; i++) {
+#ifdef _WIN32
+        threads[i] = (HANDLE)_beginthreadex(NULL, 0, BenchThread, (void*)(intptr_t)i, 0, NULL);
+        if (threads[i] == NULL) return 1;
+#else
+        if (pthread_create(&threads[i], NULL, BenchThread, (void*)(intptr_t)i) != 0) return 1;
+#endif
+    }
+
+    Sleep(g_seconds * 1000);
+    InterlockedExchange(&g_stop, 1);
+
+    for (int i = 0; i < total; i++) {
+#ifdef _WIN32
+        WaitForSingleObject(threads[i], INFINITE);
+        CloseHandle(threads[i]);
+#else
+        pthread_join(threads[i], NULL);
+#endif
+    }
+    double elapsed = (GetTickCount64() - start) / 1000.0;
+
+    // Every submit has returned and every deferred turn has run, so nothing
+    // can still be pending
+    LONG64 commits = 0, batches = 0, maxBatch = 0, lost = 0;
+    BOOL ok = TRUE;
+    for (int s = 0; s < g_sectionCount; s++) {
+        BenchSection* section = &g_sections[s];
+        LONG64 version = section->body ? section->body->version : 0;
+        if (section->commits.pending || version != section->submitted) {
+            printf("[Bench] section %d: version %lld, submitted %lld\n",
+                s, (long long)version, (long long)section->submitted);
+            ok = FALSE;
+        }
+        commits += section->submitted;
+        batches += section->batches;
+        if (section->maxBatch > maxBatch) maxBatch = section->maxBatch;
+    }
+    for (int i = 0; i < g_sectionCount * g_writersPerSection; i++) {
+        lost += g_writers[i].submitted - g_writers[i].completed;
+    }
+    if (lost != 0 || g_corrupt != 0) ok = FALSE;
+
+    printf("[Bench] commits: %lld (%.0f/s)\n", (long long)commits, commits / elapsed);
+    printf("[Bench] batches: %lld, avg %.2f writes, max %lld\n",
+        (long long)batches, batches ? (double)commits / batches : 0.0, (long long)maxBatch);
+    printf("[Bench] deferred turns: %lld\n", (long long)g_deferred);
+    printf("[Bench] reads: %lld, corrupt: %lld, lost completions: %lld\n",
+        (long long)g_reads, (long long)g_corrupt, (long long)lost);
+    printf("[Bench] %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,408 @@
+/// bench_core.c
+// Regression benchmark for the server's hot paths, run against the docs_core
+// library both servers link. This file is the I/O backend: SendVector only
+// counts the bytes it is handed, PostWriteCompletion flags the client so its
+// thread runs CompleteWrite the way a worker handles OP_WRITE_WAIT, and
+// PostCommitDrain leaves the section to its thread's next turn (OP_COMMIT_DRAIN).
+//
+// Usage: bench_core [threads] [milliseconds] [case...]
+//
+// Cases (all by default):
+//   parse   ParseCommand on a copied command line
+//   find    FindDoc + FindSection among 1024 documents, inside an epoch
+//   queue   CommitQueueSubmit of empty writes to one queue
+//   read    "read doc section" through ProcessRecvData, rendered and flushed
+//   write   a 10-line write block through ProcessRecvData up to [Write_Completed]
+//   append  a one-line append to a section that keeps growing, up to [Write_Completed]
+//
+// Every case runs once on one thread and once on [threads] threads (default:
+// one per CPU) that all hit the same document, section and queue, and prints
+// ops/s, ns per op per thread and the scaling between the two. The write and
+// append cases check that their section's version counts every write that
+// completed, and append that every line arrived.
+#include "docs_server.h"
+#include "commit_queue.h"
+#include "io_pool.h"
+#include "epoch.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_MAX_THREADS 64
+#define BENCH_DOCS 1024
+#define BENCH_SECTIONS 4
+#define BENCH_READ_LINES 20
+#define BENCH_WRITE_LINES 10
+
+// The backend hooks get the ClientContext back; the rest is the bench's
+typedef struct {
+    ClientContext client;
+    volatile LONG committed;        // set by PostWriteCompletion
+    ULONGLONG bytesSent;
+} BenchClient;
+
+typedef struct {
+    const char* name;
+    void (*op)(BenchClient* bc, int thread, ULONGLONG i);
+} BenchCase;
+
+static int g_threadCount;
+static int g_millis = 500;
+static volatile LONG g_go = 0;
+static volatile LONG g_stop = 0;
+static const BenchCase* g_case;
+static volatile LONG64 g_ops = 0;
+static BOOL g_ok = TRUE;
+
+static char g_docTitles[BENCH_DOCS][32];
+static char g_writeBlock[2048];
+static size_t g_writeBlockLen;
+static CommitQueue g_queue;
+static volatile LONG64 g_queueApplied = 0;
+
+// A combining turn this thread deferred (at most one: a thread combines one
+// queue at a time)
+static THREAD_LOCAL Section* t_drain = NULL;
+static THREAD_LOCAL BOOL t_queueDrain = FALSE;
+
+// I/O backend
+
+BOOL SendVector(ClientContext* client, Response* response) {
+    BenchClient* bc = (BenchClient*)client;
+    for (Response* r = response; r; r = r->next) {
+        for (int i = 0; i < r->count; i++) bc->bytesSent += SEGMENT_LEN(&r->segs[i]);
+    }
+    FreeResponse(response);
+    return TRUE;
+}
+
+void RetainClient(ClientContext* client) {
+    (void)client;       // bench clients live until the end
+}
+
+void PostWriteCompletion(ClientContext* client) {
+    InterlockedExchange(&((BenchClient*)client)->committed, 1);
+}
+
+void PostCommitDrain(Section* section) {
+    t_drain = section;
+}
+
+// The thread's next turn round its "event loop"
+static void RunDeferred(void) {
+    Section* section;
+    while ((section = t_drain) != NULL) {
+        t_drain = NULL;
+        DrainCommits(section);
+    }
+}
+
+static BenchClient* NewBenchClient(void) {
+    BenchClient* bc = (BenchClient*)calloc(1, sizeof(BenchClient));
+    if (!bc) abort();
+    bc->client.socket = INVALID_SOCKET;
+    InitializeCriticalSection(&bc->client.cs);
+    return bc;
+}
+
+static void FreeBenchClient(BenchClient* bc) {
+    FreeClientState(&bc->client);
+    DeleteCriticalSection(&bc->client.cs);
+    free(bc);
+}
+
+// One receive and the send after it, then the commit if one was queued
+static void Deliver(BenchClient* bc, const char* data, size_t len) {
+    ProcessRecvData(&bc->client, data, (DWORD)len);
+    FlushOutput(&bc->client);
+    SendCompleted(&bc->client);
+    RunDeferred();
+
+    if (bc->client.commitPending) {
+        // Another thread may be combining this section; it posts us when done
+        while (!ReadAcquire(&bc->committed)) {
+            RunDeferred();
+            Sleep(0);
+        }
+        bc->committed = 0;
+
+        EnterCriticalSection(&bc->client.cs);
+        CompleteWrite(&bc->client);
+        FlushOutput(&bc->client);
+        LeaveCriticalSection(&bc->client.cs);
+        SendCompleted(&bc->client);
+    }
+}
+
+static void DeliverText(BenchClient* bc, const char* text) {
+    Deliver(bc, text, strlen(text));
+}
+
+static LONG64 SectionVersion(const char* docTitle, int section, int* lineCount) {
+    EpochEnter();
+    Document* doc = FindDoc(docTitle);
+    const SectionBody* body = doc ? (const SectionBody*)ReadPointerAcquire((PVOID*)&doc->sections[section].body) : NULL;
+    LONG64 version = body ? body->version : 0;
+    if (lineCount) *lineCount = body ? body->lineCount : 0;
+    EpochExit();
+    return version;
+}
+
+// Cases
+
+static void OpParse(BenchClient* bc, int thread, ULONGLONG i) {
+    static const char line[] = "write \"Document 12\" \"Section 3\"";
+    char* args[64];
+    int argc;
+    (void)thread;
+    (void)i;
+
+    memcpy(bc->client.recvBuffer, line, sizeof(line));
+    ParseCommand(bc->client.recvBuffer, args, &argc);
+    if (argc != 3) g_ok = FALSE;
+}
+
+static void OpFind(BenchClient* bc, int thread, ULONGLONG i) {
+    static const char* sections[BENCH_SECTIONS] = { "Section 0", "Section 1", "Section 2", "Section 3" };
+    ULONGLONG n = i * 2654435761u + (ULONGLONG)thread;
+    (void)bc;
+
+    EpochEnter();
+    Document* doc = FindDoc(g_docTitles[n % BENCH_DOCS]);
+    if (!doc || FindSection(doc, sections[(n >> 10) % BENCH_SECTIONS]) < 0) g_ok = FALSE;
+    EpochExit();
+}
+
+static void ApplyNothing(void* ctx, WriteNode* batch) {
+    (void)ctx;
+    while (batch) {
+        WriteNode* node = batch;
+        batch = node->next;
+        FreeWriteNode(node);
+        g_queueApplied++;       // only the combiner is here
+    }
+}
+
+static void DeferQueue(void* ctx) {
+    (void)ctx;
+    t_queueDrain = TRUE;
+}
+
+static void OpQueue(BenchClient* bc, int thread, ULONGLONG i) {
+    (void)thread;
+    WriteNode* node = AllocWriteNode();
+    if (!node) abort();
+    node->client = &bc->client;
+    node->body = NULL;
+    node->estimatedLines = (int)(i % 16) + 1;
+    CommitQueueSubmit(&g_queue, node, ApplyNothing, DeferQueue, NULL);
+    while (t_queueDrain) {
+        t_queueDrain = FALSE;
+        CommitQueueDrain(&g_queue, ApplyNothing, DeferQueue, NULL);
+    }
+}
+
+static void OpRead(BenchClient* bc, int thread, ULONGLONG i) {
+    (void)thread;
+    (void)i;
+    DeliverText(bc, "read \"Document 0\" \"Section 0\"\n");
+}
+
+static void OpWrite(BenchClient* bc, int thread, ULONGLONG i) {
+    (void)thread;
+    (void)i;
+    Deliver(bc, g_writeBlock, g_writeBlockLen);
+}
+
+static void OpAppend(BenchClient* bc, int thread, ULONGLONG i) {
+    (void)thread;
+    (void)i;
+    DeliverText(bc, "append \"Document 2\" \"Section 0\" \"2026-01-01 12:00:00 worker ready\"\n");
+}
+
+static const BenchCase g_cases[] = {
+    { "parse", OpParse },
+    { "find", OpFind },
+    { "queue", OpQueue },
+    { "read", OpRead },
+    { "write", OpWrite },
+    { "append", OpAppend },
+};
+
+#ifdef _WIN32
+static unsigned __stdcall BenchThread(void* param) {
+#else
+static void* BenchThread(void* param) {
+#endif
+    int thread = (int)(intptr_t)param;
+    BenchClient* bc = NewBenchClient();
+    ULONGLONG ops = 0;
+
+    while (!ReadAcquire(&g_go)) Sleep(0);
+    while (!ReadAcquire(&g_stop)) g_case->op(bc, thread, ops++);
+
+    InterlockedExchangeAdd64(&g_ops, (LONG64)ops);
+    FreeBenchClient(bc);
+    return 0;
+}
+
+// Operations per second over threads threads
+static double RunCase(const BenchCase* c, int threads) {
+#ifdef _WIN32
+    HANDLE handles[BENCH_MAX_THREADS];
+#else
+    pthread_t handles[BENCH_MAX_THREADS];
+#endif
+    g_case = c;
+    g_ops = 0;
+    g_go = 0;
+    g_stop = 0;
+
+    for (int t = 0; t < threads; t++) {
+#ifdef _WIN32
+        handles[t] = (HANDLE)_beginthreadex(NULL, 0, BenchThread, (void*)(intptr_t)t, 0, NULL);
+        if (handles[t] == NULL) abort();
+#else
+        if (pthread_create(&handles[t], NULL, BenchThread, (void*)(intptr_t)t) != 0) abort();
+#endif
+    }
+
+    ULONGLONG start = GetTickCount64();
+    InterlockedExchange(&g_go, 1);
+    Sleep(g_millis);
+    InterlockedExchange(&g_stop, 1);
+    ULONGLONG elapsed = GetTickCount64() - start;
+
+    for (int t = 0; t < threads; t++) {
+#ifdef _WIN32
+        WaitForSingleObject(handles[t], INFINITE);
+        CloseHandle(handles[t]);
+#else
+        pthread_join(handles[t], NULL);
+#endif
+    }
+    return (double)g_ops * 1000.0 / (double)(elapsed ? elapsed : 1);
+}
+
+// Documents for find, a filled section for read, the write block for write
+static void Setup(void) {
+    BenchClient* bc = NewBenchClient();
+    char line[256];
+
+    for (int d = 0; d < BENCH_DOCS; d++) {
+        snprintf(g_docTitles[d], sizeof(g_docTitles[d]), "Document %d", d);
+        int len = snprintf(line, sizeof(line), "create \"%s\" %d", g_docTitles[d], BENCH_SECTIONS);
+        for (int s = 0; s < BENCH_SECTIONS; s++) len += snprintf(line + len, sizeof(line) - len, " \"Section %d\"", s);
+        snprintf(line + len, sizeof(line) - len, "\n");
+        DeliverText(bc, line);
+    }
+
+    static const char text[] = "the server publishes a new section body with one pointer store";
+    DeliverText(bc, "write \"Document 0\" \"Section 0\"\n");
+    for (int i = 0; i < BENCH_READ_LINES; i++) {
+        snprintf(line, sizeof(line), "%d %s\n", i, text);
+        DeliverText(bc, line);
+    }
+    DeliverText(bc, "<END>\n");
+
+    size_t len = (size_t)snprintf(g_writeBlock, sizeof(g_writeBlock), "write \"Document 1\" \"Section 0\"\n");
+    for (int i = 0; i < BENCH_WRITE_LINES; i++) {
+        len += (size_t)snprintf(g_writeBlock + len, sizeof(g_writeBlock) - len, "%d %s\n", i, text);
+    }
+    len += (size_t)snprintf(g_writeBlock + len, sizeof(g_writeBlock) - len, "<END>\n");
+    g_writeBlockLen = len;
+
+    if (SectionVersion("Document 0", 0, NULL) != 1 || SectionVersion(g_docTitles[BENCH_DOCS - 1], 0, NULL) != 0) {
+        printf("[Bench] Setup failed\n");
+        exit(1);
+    }
+    FreeBenchClient(bc);
+    CommitQueueInit(&g_queue);
+}
+
+static int CpuCount(void) {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+int main(int argc, char* argv[]) {
+    g_threadCount = CpuCount();
+    if (g_threadCount < 2) g_threadCount = 2;
+    if (g_threadCount > BENCH_MAX_THREADS) g_threadCount = BENCH_MAX_THREADS;
+    if (argc > 1) g_threadCount = atoi(argv[1]);
+    if (argc > 2) g_millis = atoi(argv[2]);
+
+    BOOL selected[sizeof(g_cases) / sizeof(g_cases[0])];
+    for (size_t c = 0; c < sizeof(g_cases) / sizeof(g_cases[0]); c++) selected[c] = argc <= 3;
+    for (int i = 3; i < argc; i++) {
+        size_t c = 0;
+        while (c < sizeof(g_cases) / sizeof(g_cases[0]) && strcmp(argv[i], g_cases[c].name) != 0) c++;
+        if (c == sizeof(g_cases) / sizeof(g_cases[0])) {
+            g_threadCount = 0;
+            break;
+        }
+        selected[c] = TRUE;
+    }
+    if (g_threadCount < 1 || g_threadCount > BENCH_MAX_THREADS || g_millis < 100) {
+        fprintf(stderr, "Usage: %s [threads 1-%d] [milliseconds >= 100] [parse|find|queue|read|write|append...]\n",
+            argv[0], BENCH_MAX_THREADS);
+        return 1;
+    }
+
+    LogInit();
+    LogSetLevel(LOG_LEVEL_WARN);
+    InitializeDocStore();
+    Setup();
+
+    printf("[Bench] %d ms per run, 1 thread vs %d threads on the same document and section\n",
+        g_millis, g_threadCount);
+    printf("[Bench] %-6s %14s %9s %14s %9s %8s\n", "case", "1 thr op/s", "ns/op",
+        "contended op/s", "ns/op", "scaling");
+
+    LONG64 writes = 0, appends = 0;
+    for (size_t c = 0; c < sizeof(g_cases) / sizeof(g_cases[0]); c++) {
+        if (!selected[c]) continue;
+        LONG64 queued = g_queueApplied;
+
+        double single = RunCase(&g_cases[c], 1);
+        LONG64 ops = g_ops;
+        double contended = RunCase(&g_cases[c], g_threadCount);
+        ops += g_ops;
+
+        printf("[Bench] %-6s %14.0f %9.1f %14.0f %9.1f %7.2fx\n", g_cases[c].name,
+            single, 1e9 / single, contended, 1e9 * g_threadCount / contended, contended / single);
+
+        if (g_cases[c].op == OpWrite) writes = ops;
+        if (g_cases[c].op == OpAppend) appends = ops;
+        if (g_cases[c].op == OpQueue && g_queueApplied - queued != ops) {
+            printf("[Bench] queue applied %lld of %lld writes\n", (long long)(g_queueApplied - queued), (long long)ops);
+            g_ok = FALSE;
+        }
+    }
+
+    LONG64 version = SectionVersion("Document 1", 0, NULL);
+    if (version != writes) {
+        printf("[Bench] Document 1 / Section 0 is at version %lld after %lld writes\n",
+            (long long)version, (long long)writes);
+        g_ok = FALSE;
+    }
+    int lines;
+    version = SectionVersion("Document 2", 0, &lines);
+    if (version != appends || lines != appends) {
+        printf("[Bench] Document 2 / Section 0 is at version %lld with %d lines after %lld appends\n",
+            (long long)version, lines, (long long)appends);
+        g_ok = FALSE;
+    }
+
+    printf("[Bench] %s\n", g_ok ? "OK" : "FAILED");
+    LogFlush();
+    return g_ok ? 0 : 1;
+}
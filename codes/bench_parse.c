@@ -0,0 +1,262 @@
+/// bench_parse.c
+// Microbenchmark for the text protocol front end (codes/line_scan.c).
+//
+// Usage: bench_parse [commands|writes|mixed] [megabytes] [recv-size]
+//
+// A stream of protocol lines is generated for the chosen mix and fed in
+// recv-sized pieces through two copies of the receive loop: the previous one
+// (byte-at-a-time copy into recvBuffer, ParseCommand allocating every
+// argument) and the current one (ScanLineEnd + memcpy, TokenizeCommand
+// slicing in place), the latter once per scan path this CPU supports. Both
+// switch to write mode after "write" and back at <END>, like the server.
+// Every run must see the same lines and arguments.
+#include "line_scan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCH_BUF_SIZE 2048         // BUF_SIZE in docs_server.h
+#define BENCH_MAX_ARGS 64
+
+typedef enum { MIX_COMMANDS, MIX_WRITES, MIX_MIXED } BenchMix;
+
+typedef struct {
+    char recvBuffer[BENCH_BUF_SIZE];
+    int recvPos;
+    char* args[BENCH_MAX_ARGS];
+    int argc;
+    BOOL isWriteMode;
+    // What was seen, to check the variants agree
+    ULONGLONG lines;
+    ULONGLONG commands;
+    ULONGLONG argBytes;
+} BenchState;
+
+static const char* g_words[] = {
+    "the", "server", "section", "document", "completion", "port", "socket",
+    "buffer", "worker", "thread", "commit", "snapshot", "version", "queue",
+};
+
+static void AppendWords(char** out, int count) {
+    for (int i = 0; i < count; i++) {
+        if (i > 0) *(*out)++ = ' ';
+        const char* w = g_words[rand() % (sizeof(g_words) / sizeof(g_words[0]))];
+        size_t n = strlen(w);
+        memcpy(*out, w, n);
+        *out += n;
+    }
+}
+
+// One request of the mix: a command line, or a whole write block
+static void AppendRequest(char** out, BenchMix mix) {
+    int r = rand() % 100;
+    int doc = rand() % 1000;
+
+    if (mix == MIX_WRITES || (mix == MIX_MIXED && r < 30)) {
+        *out += sprintf(*out, "write \"Document %d\" \"Section %d\"\n", doc, rand() % 8);
+        int lines = mix == MIX_WRITES ? 20 + rand() % 40 : 1 + rand() % 10;
+        for (int i = 0; i < lines; i++) {
+            AppendWords(out, 4 + rand() % 24);
+            *(*out)++ = '\n';
+        }
+        *out += sprintf(*out, "<END>\n");
+    }
+    else if (r < 60) {
+        *out += sprintf(*out, "read \"Document %d\" \"Section %d\"\n", doc, rand() % 8);
+    }
+    else if (r < 80) {
+        *out += sprintf(*out, "read\n");
+    }
+    else {
+        int sections = 1 + rand() % 6;
+        *out += sprintf(*out, "create \"Document %d\" %d", doc, sections);
+        for (int i = 0; i < sections; i++) *out += sprintf(*out, " \"Section %d\"", i);
+        *(*out)++ = '\n';
+    }
+}
+
+static void RecordLine(BenchState* state) {
+    state->lines++;
+    if (state->isWriteMode) {
+        if (strcmp(state->recvBuffer, "<END>") == 0) state->isWriteMode = FALSE;
+        return;
+    }
+    state->commands++;
+    for (int i = 0; i < state->argc; i++) state->argBytes += strlen(state->args[i]);
+    if (state->argc > 0 && strcmp(state->args[0], "write") == 0) state->isWriteMode = TRUE;
+}
+
+// ParseCommand before line_scan.c
+static void LegacyParseCommand(const char* input, char* args[], int* argc) {
+    *argc = 0;
+    const char* p = input;
+
+    // Free previous args
+    for (int i = 0; i < BENCH_MAX_ARGS && args[i]; i++) {
+        free(args[i]);
+        args[i] = NULL;
+    }
+
+    while (*p && *argc < BENCH_MAX_ARGS) {
+        while (*p == ' ' || *p == '\t') p++;
+        if (!*p) break;
+
+        if (*p == '"') {
+            p++;
+            const char* start = p;
+            while (*p && *p != '"') p++;
+            int len = (int)(p - start);
+            args[*argc] = (char*)malloc(len + 1);
+            strncpy(args[*argc], start, len);
+            args[*argc][len] = '\0';
+            (*argc)++;
+            if (*p == '"') p++;
+        }
+        else {
+            const char* start = p;
+            while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
+            int len = (int)(p - start);
+            args[*argc] = (char*)malloc(len + 1);
+            strncpy(args[*argc], start, len);
+            args[*argc][len] = '\0';
+            (*argc)++;
+        }
+    }
+}
+
+static void LegacyRecv(BenchState* state, const char* data, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        char ch = data[i];
+        if (ch == '\n' || ch == '\r') {
+            if (state->recvPos > 0) {
+                state->recvBuffer[state->recvPos] = '\0';
+                state->recvPos = 0;
+                if (!state->isWriteMode) LegacyParseCommand(state->recvBuffer, state->args, &state->argc);
+                RecordLine(state);
+            }
+        }
+        else if (state->recvPos < BENCH_BUF_SIZE - 1) {
+            state->recvBuffer[state->recvPos++] = ch;
+        }
+    }
+}
+
+// Same loop as ParseText in docs_server.c
+static void ScanRecv(BenchState* state, const char* data, size_t len) {
+    size_t i = 0;
+    while (i < len) {
+        size_t end = i + ScanLineEnd(data + i, len - i);
+        size_t n = end - i;
+        if (n > (size_t)(BENCH_BUF_SIZE - 1 - state->recvPos)) n = BENCH_BUF_SIZE - 1 - state->recvPos;
+        memcpy(state->recvBuffer + state->recvPos, data + i, n);
+        state->recvPos += (int)n;
+        if (end == len) break;
+        i = end + 1;
+
+        if (state->recvPos > 0) {
+            size_t lineLen = (size_t)state->recvPos;
+            state->recvBuffer[lineLen] = '\0';
+            state->recvPos = 0;
+            if (!state->isWriteMode) {
+                state->argc = TokenizeCommand(state->recvBuffer, lineLen, state->args, BENCH_MAX_ARGS);
+            }
+            RecordLine(state);
+        }
+    }
+}
+
+typedef void (*RecvFn)(BenchState* state, const char* data, size_t len);
+
+// Throughput in MB/s; base is the byte loop's, for the speedup column
+static double RunVariant(const char* name, RecvFn recv, const char* stream, size_t size,
+    size_t recvSize, double base, BenchState* result) {
+    int passes = 0;
+    ULONGLONG start = GetTickCount64();
+    ULONGLONG elapsed;
+
+    // At least half a second so the millisecond clock is good enough
+    do {
+        BenchState* state = (BenchState*)calloc(1, sizeof(BenchState));
+        if (!state) abort();
+        for (size_t off = 0; off < size; off += recvSize) {
+            recv(state, stream + off, size - off < recvSize ? size - off : recvSize);
+        }
+        if (recv == LegacyRecv) {
+            for (int i = 0; i < BENCH_MAX_ARGS && state->args[i]; i++) free(state->args[i]);
+        }
+        *result = *state;
+        free(state);
+        passes++;
+        elapsed = GetTickCount64() - start;
+    } while (elapsed < 500);
+
+    double seconds = elapsed / 1000.0;
+    double rate = (double)size * passes / (1024.0 * 1024.0) / seconds;
+    printf("[Bench] %-12s %8.1f MB/s %8.1f ns/line %6.2fx\n", name, rate,
+        seconds * 1e9 / ((double)result->lines * passes), base > 0 ? rate / base : 1.0);
+    return rate;
+}
+
+int main(int argc, char* argv[]) {
+    BenchMix mix = MIX_MIXED;
+    int megabytes = 16;
+    size_t recvSize = BENCH_BUF_SIZE;
+
+    if (argc > 1) {
+        if (strcmp(argv[1], "commands") == 0) mix = MIX_COMMANDS;
+        else if (strcmp(argv[1], "writes") == 0) mix = MIX_WRITES;
+        else if (strcmp(argv[1], "mixed") == 0) mix = MIX_MIXED;
+        else {
+            fprintf(stderr, "Usage: %s [commands|writes|mixed] [megabytes] [recv-size]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (argc > 2) megabytes = atoi(argv[2]);
+    if (argc > 3) recvSize = (size_t)atoi(argv[3]);
+    if (megabytes < 1 || recvSize < 1) {
+        fprintf(stderr, "[Bench] megabytes and recv-size must be positive\n");
+        return 1;
+    }
+
+    // Generate the stream; a request never exceeds a few KB
+    size_t capacity = (size_t)megabytes * 1024 * 1024;
+    char* stream = (char*)malloc(capacity + 16384);
+    if (!stream) return 1;
+    char* out = stream;
+    srand(12345);
+    while ((size_t)(out - stream) < capacity) AppendRequest(&out, mix);
+    size_t size = (size_t)(out - stream);
+
+    printf("[Bench] %s mix, %.1f MB, %zu-byte receives\n",
+        argc > 1 ? argv[1] : "mixed", size / (1024.0 * 1024.0), recvSize);
+
+    BenchState legacy, current;
+    double base = RunVariant("byte loop", LegacyRecv, stream, size, recvSize, 0, &legacy);
+    printf("[Bench] %llu lines, %llu commands\n",
+        (unsigned long long)legacy.lines, (unsigned long long)legacy.commands);
+
+    BOOL ok = TRUE;
+    static const LineScanPath paths[] = { LINE_SCAN_SCALAR, LINE_SCAN_SSE2, LINE_SCAN_AVX2 };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+        if (!LineScanUse(paths[i])) {
+            printf("[Bench] scan %-7s not available\n", LineScanName(paths[i]));
+            continue;
+        }
+        char name[32];
+        snprintf(name, sizeof(name), "scan %s", LineScanName(paths[i]));
+        RunVariant(name, ScanRecv, stream, size, recvSize, base, &current);
+
+        if (current.lines != legacy.lines || current.commands != legacy.commands ||
+            current.argBytes != legacy.argBytes) {
+            printf("[Bench] %s disagrees: %llu lines, %llu commands, %llu arg bytes\n", name,
+                (unsigned long long)current.lines, (unsigned long long)current.commands,
+                (unsigned long long)current.argBytes);
+            ok = FALSE;
+        }
+    }
+
+    free(stream);
+    printf("[Bench] %s\n", ok ? "OK" : "FAILED");
+    return ok ? 0 : 1;
+}
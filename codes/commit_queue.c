@@ -0,0 +1,110 @@
+/// commit_queue.c
+#include "commit_queue.h"
+
+static volatile LONG g_commitOrder = COMMIT_ORDER_FIFO;
+
+void CommitQueueInit(CommitQueue* queue) {
+    queue->pending = NULL;
+    queue->combining = 0;
+    queue->nextTicket = 0;
+}
+
+void CommitQueueSetOrder(CommitOrder order) {
+    InterlockedExchange(&g_commitOrder, (LONG)order);
+}
+
+BOOL CommitParseOrder(const char* name, CommitOrder* order) {
+    if (_stricmp(name, "fifo") == 0) *order = COMMIT_ORDER_FIFO;
+    else if (_stricmp(name, "shortest") == 0) *order = COMMIT_ORDER_SHORTEST_FIRST;
+    else return FALSE;
+    return TRUE;
+}
+
+static BOOL Precedes(const WriteNode* a, const WriteNode* b, CommitOrder order) {
+    if (order == COMMIT_ORDER_SHORTEST_FIRST && a->estimatedLines != b->estimatedLines) {
+        return a->estimatedLines < b->estimatedLines;
+    }
+    return a->ticket < b->ticket;
+}
+
+static WriteNode* MergeRuns(WriteNode* a, WriteNode* b, CommitOrder order) {
+    WriteNode* head = NULL;
+    WriteNode** tail = &head;
+
+    while (a && b) {
+        // Take from b only when it strictly precedes a, so equal keys stay stable
+        if (Precedes(b, a, order)) { *tail = b; b = b->next; }
+        else { *tail = a; a = a->next; }
+        tail = (WriteNode**)&(*tail)->next;
+    }
+    *tail = a ? a : b;
+    return head;
+}
+
+static WriteNode* SortRun(WriteNode* list, CommitOrder order) {
+    if (!list || !list->next) return list;
+
+    WriteNode* slow = list;
+    for (WriteNode* fast = list->next; fast && fast->next; fast = fast->next->next) {
+        slow = slow->next;
+    }
+    WriteNode* second = slow->next;
+    slow->next = NULL;
+    return MergeRuns(SortRun(list, order), SortRun(second, order), order);
+}
+
+// Put a detached batch in policy order. The stack holds the newest write
+// first; reversing it gives arrival order, which FIFO only has to patch up
+// where two pushes overtook each other's ticket. Batches can grow large
+// while a combiner is busy, so the sort is a merge sort.
+static WriteNode* OrderBatch(WriteNode* stack, CommitOrder order) {
+    WriteNode* list = NULL;
+    BOOL sorted = TRUE;
+
+    while (stack) {
+        WriteNode* node = stack;
+        stack = node->next;
+        if (list && Precedes(list, node, order)) sorted = FALSE;
+        node->next = list;
+        list = node;
+    }
+    return sorted ? list : SortRun(list, order);
+}
+
+void CommitQueueSubmit(CommitQueue* queue, WriteNode* node, CommitApplyFn apply, CommitDeferFn defer,
+    void* ctx) {
+    node->ticket = InterlockedIncrement64(&queue->nextTicket) - 1;
+
+    WriteNode* head;
+    do {
+        head = queue->pending;
+        node->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&queue->pending, node, head) != head);
+
+    CommitQueueDrain(queue, apply, defer, ctx);
+}
+
+void CommitQueueDrain(CommitQueue* queue, CommitApplyFn apply, CommitDeferFn defer, void* ctx) {
+    int passes = 0;
+    while (InterlockedCompareExchange(&queue->combining, 1, 0) == 0) {
+        CommitOrder order = (CommitOrder)ReadAcquire(&g_commitOrder);
+        WriteNode* batch;
+        while (passes < COMMIT_MAX_PASSES &&
+            (batch = (WriteNode*)InterlockedExchangePointer((PVOID*)&queue->pending, NULL)) != NULL) {
+            apply(ctx, OrderBatch(batch, order));
+            passes++;
+        }
+        InterlockedExchange(&queue->combining, 0);
+
+        // A write pushed between our last detach and the release saw the
+        // queue busy and left it to us. Take the queue back for it while
+        // passes remain; after that the next turn is deferred, and runs
+        // even if another writer has taken the queue meanwhile (it then
+        // finds the queue busy or empty and returns).
+        if (ReadPointerAcquire((PVOID*)&queue->pending) == NULL) break;
+        if (passes == COMMIT_MAX_PASSES) {
+            defer(ctx);
+            break;
+        }
+    }
+}
@@ -0,0 +1,85 @@
+/// commit_queue.h
+// Per-section commit engine built on flat combining.
+//
+// Writers push their finished write onto the section's pending stack with one
+// CAS and then try to become the combiner. Exactly one thread combines a
+// section at a time: it detaches everything pending, puts the batch in policy
+// order and hands it to the apply callback in one go, repeating until nothing
+// is left or it has made COMMIT_MAX_PASSES passes. A writer that finds a
+// combiner already running simply returns; its write is picked up by that
+// combiner's next pass. Nobody waits for a turn, and a hot section is
+// published once per batch instead of once per write.
+//
+// The passes are bounded because the combiner is some client's I/O thread:
+// under a steady stream of writes it would otherwise never get back to its
+// other connections. A combiner that runs out of passes with writes still
+// pending hands them to the defer callback, which runs CommitQueueDrain
+// later, behind whatever else that thread has to do.
+//
+// Nodes need no deferred reclamation. A pusher only ever dereferences its own
+// node, and the combiner takes the whole stack with one exchange rather than
+// popping, so no thread can be left holding a pointer into a node that the
+// combiner frees or that the pool hands out again. The compare in the push is
+// against the head value the node was linked to, so a recycled address at the
+// head is still a correct push (no ABA). Bodies are the only shared data that
+// readers walk, and those go through the epoch collector.
+//
+// bench_commit (codes/bench_commit.c) stresses this path with thousands of
+// writers per section and concurrent readers.
+#ifndef COMMIT_QUEUE_H
+#define COMMIT_QUEUE_H
+
+#include "platform.h"
+
+struct ClientContext;
+struct SectionBody;
+
+// Order in which the writes of one batch are applied
+#define COMMIT_MAX_PASSES 4         // batches applied per combining turn
+
+typedef enum {
+    COMMIT_ORDER_FIFO,              // arrival (ticket) order
+    COMMIT_ORDER_SHORTEST_FIRST     // fewest lines first, ties by arrival
+} CommitOrder;
+
+// One pending write
+typedef struct WriteNode {
+    struct WriteNode* volatile next;
+    LONG64 ticket;
+    struct ClientContext* client;
+    struct SectionBody* body;   // the lines written
+    int line;                   // body's lines replace remove lines from line:
+    int remove;                 // line -1 is the end, remove -1 the whole section
+    int status;                 // DocsStatus, set when the write is applied
+    int estimatedLines;
+    ULONGLONG queuedAt;         // MetricsNow() at submit, for the commit wait
+} WriteNode;
+
+typedef struct {
+    WriteNode* volatile pending;    // pushed writes, newest first
+    volatile LONG combining;        // 1 while a thread is applying batches
+    volatile LONG64 nextTicket;
+} CommitQueue;
+
+// Receives one batch as a list linked through next, already in policy order,
+// and takes ownership of its nodes
+typedef void (*CommitApplyFn)(void* ctx, WriteNode* batch);
+// Arrange for CommitQueueDrain to be called again for the queue, later and
+// not from inside this call
+typedef void (*CommitDeferFn)(void* ctx);
+
+void CommitQueueInit(CommitQueue* queue);
+
+// Process-wide ordering policy; FIFO unless changed before the first commit
+void CommitQueueSetOrder(CommitOrder order);
+BOOL CommitParseOrder(const char* name, CommitOrder* order);
+
+// Queue node (ticket is assigned here) and, if no other thread is combining
+// this queue, apply what is pending before returning: everything, or as much
+// as COMMIT_MAX_PASSES passes take, with the rest left to defer
+void CommitQueueSubmit(CommitQueue* queue, WriteNode* node, CommitApplyFn apply, CommitDeferFn defer,
+    void* ctx);
+// One combining turn without a write of its own (the deferred rest of a turn)
+void CommitQueueDrain(CommitQueue* queue, CommitApplyFn apply, CommitDeferFn defer, void* ctx);
+
+#endif // COMMIT_QUEUE_H
@@ -0,0 +1,108 @@
+/// docs_protocol.h
+// Binary framing for the document protocol, an alternative to the text
+// commands for clients that want to pipeline without parsing text.
+//
+// A connection is binary if its first four bytes are DOCS_BINARY_MAGIC; the
+// server answers with the same four bytes and from then on both directions
+// carry frames only. The first magic byte is never the start of a text
+// command, so text clients are unaffected.
+//
+// Frame: a DOCS_FRAME_HEADER_SIZE header followed by fieldCount fields, each
+// a u32 length and that many raw bytes (newlines and NULs included, except in
+// titles, which end at their first NUL). All integers are little-endian.
+//
+//   offset  size  request                  response
+//   0       1     opcode                   opcode of the request
+//   1       1     0                        status (DocsStatus)
+//   2       2     0                        0
+//   4       4     field count              field count
+//   8       4     payload length           payload length
+//   12      4     request id               request id of the request
+//
+// Requests and their successful responses:
+//   CREATE  title, section titles...   ->  no fields
+//   WRITE   doc, section, lines...     ->  no fields, once the write is committed
+//   APPEND  doc, section, lines...     ->  the same; lines added at the end
+//   INSERT  doc, section, n, lines...  ->  the same; lines added before line n
+//   REPLACE doc, section, n, lines...  ->  the same; line n replaced by lines
+//   DELETE  doc, section, n            ->  the same; line n removed
+//   READ    (nothing)                  ->  one field per document: its title and
+//                                          its section titles, each NUL-terminated
+//   READ    doc, section               ->  one field per line
+//   BYE     (nothing)                  ->  no fields; the server then shuts down
+//   STATS   (nothing)                  ->  one field: the "stats" command's text
+// Line numbers n are a 4-byte u32 field, counting from 1; INSERT also takes
+// the line count + 1. A line that does not exist when the edit is applied
+// fails it with DOCS_STATUS_NO_LINE.
+// A failed request gets a non-zero status and one field with the message.
+// Responses come back in request order.
+#ifndef DOCS_PROTOCOL_H
+#define DOCS_PROTOCOL_H
+
+#include <stdint.h>
+
+#define DOCS_BINARY_MAGIC "\xD0" "DOC"
+#define DOCS_BINARY_MAGIC_SIZE 4
+#define DOCS_FRAME_HEADER_SIZE 16
+#define DOCS_MAX_FRAME_SIZE (16 * 1024 * 1024)     // payload bytes
+
+typedef enum {
+    DOCS_OP_CREATE = 1,
+    DOCS_OP_WRITE = 2,
+    DOCS_OP_READ = 3,
+    DOCS_OP_BYE = 4,
+    DOCS_OP_STATS = 5,
+    DOCS_OP_APPEND = 6,
+    DOCS_OP_INSERT = 7,
+    DOCS_OP_REPLACE = 8,
+    DOCS_OP_DELETE = 9
+} DocsOpcode;
+
+typedef enum {
+    DOCS_STATUS_OK = 0,
+    DOCS_STATUS_INVALID = 1,        // malformed frame or wrong field count
+    DOCS_STATUS_EXISTS = 2,
+    DOCS_STATUS_NO_DOCUMENT = 3,
+    DOCS_STATUS_NO_SECTION = 4,
+    DOCS_STATUS_NO_MEMORY = 5,
+    DOCS_STATUS_UNKNOWN_OP = 6,
+    DOCS_STATUS_NO_LINE = 7
+} DocsStatus;
+
+typedef struct {
+    uint8_t opcode;
+    uint8_t status;
+    uint32_t fieldCount;
+    uint32_t length;
+    uint32_t requestId;
+} DocsFrameHeader;
+
+static inline uint32_t DocsGetU32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static inline void DocsPutU32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static inline void DocsDecodeHeader(const unsigned char* p, DocsFrameHeader* header) {
+    header->opcode = p[0];
+    header->status = p[1];
+    header->fieldCount = DocsGetU32(p + 4);
+    header->length = DocsGetU32(p + 8);
+    header->requestId = DocsGetU32(p + 12);
+}
+
+static inline void DocsEncodeHeader(unsigned char* p, const DocsFrameHeader* header) {
+    p[0] = header->opcode;
+    p[1] = header->status;
+    p[2] = p[3] = 0;
+    DocsPutU32(p + 4, header->fieldCount);
+    DocsPutU32(p + 8, header->length);
+    DocsPutU32(p + 12, header->requestId);
+}
+
+#endif // DOCS_PROTOCOL_H
@@ -0,0 +1,2484 @@
+/// docs_server.c
+#include "docs_server.h"
+#include "io_pool.h"
+#include "log.h"
+#include "arena.h"
+#include "epoch.h"
+#include "docs_protocol.h"
+#include "line_scan.h"
+#include "metrics.h"
+#include "wal.h"
+#include "snapshot.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <limits.h>
+
+// Documents in creation order. Entries below doc_count are immutable; a full
+// table is copied into a bigger one, published, and the old one retired.
+typedef struct {
+    LONG capacity;
+    Document* items[];
+} DocTable;
+
+// Global variables
+volatile LONG doc_count = 0;
+SRWLOCK docsLock;
+
+// Written under docsLock held exclusively, read lock-free inside an epoch
+static DocTable* volatile docTable = NULL;
+static Arena docArena;              // Document structs, titles, section tables
+static NameIndex docIndex;          // title -> index into docTable
+
+// Write-ahead log records (wal.h). Integers are little-endian u32; a title
+// is its length then its bytes; a line is its length, its bytes and a NUL
+// (the staging format, so replay builds the body with BuildSectionBody).
+#define WAL_RECORD_CREATE 1     // section count, document title, section titles
+#define WAL_RECORD_WRITE 2      // document title, section index, version (low, high), line count, lines
+#define WAL_RECORD_EDIT 3       // document title, section index, version (low, high), edit count, and
+                                // per edit: line (-1 = end), lines removed, line count, lines
+
+// Room a body gets for appends when it is copied for one
+#define BODY_MIN_LINES 16
+#define BODY_MIN_TEXT 1024
+
+// Per-connection flow control defaults, overridden from the environment
+#define FLOW_DEFAULT_MAX_OUTPUT (4 * 1024 * 1024)   // DOCS_MAX_OUTPUT, bytes
+#define FLOW_DEFAULT_MAX_QUEUED 1024                // DOCS_MAX_QUEUED, responses
+#define FLOW_DEFAULT_MAX_HELD (1024 * 1024)         // DOCS_MAX_HELD_INPUT, bytes
+#define FLOW_DEFAULT_STALL_TIMEOUT 30               // DOCS_STALL_TIMEOUT, seconds (0 = never)
+
+static size_t flowMaxOutput = FLOW_DEFAULT_MAX_OUTPUT;
+static int flowMaxQueued = FLOW_DEFAULT_MAX_QUEUED;
+static size_t flowMaxHeld = FLOW_DEFAULT_MAX_HELD;
+static ULONGLONG flowStallMicros = FLOW_DEFAULT_STALL_TIMEOUT * 1000000ULL;
+
+// Client deadlines, in seconds (0 = never), overridden from the environment
+#define TIMEOUT_DEFAULT_IDLE 300        // DOCS_IDLE_TIMEOUT: no traffic either way
+#define TIMEOUT_DEFAULT_WRITE 120       // DOCS_WRITE_TIMEOUT: write mode entered, no <END> yet
+#define TIMEOUT_DEFAULT_COMMIT 30       // DOCS_COMMIT_TIMEOUT: commit queued, not yet answered
+
+static ULONGLONG idleMicros = TIMEOUT_DEFAULT_IDLE * 1000000ULL;
+static ULONGLONG writeMicros = TIMEOUT_DEFAULT_WRITE * 1000000ULL;
+static ULONGLONG commitMicros = TIMEOUT_DEFAULT_COMMIT * 1000000ULL;
+
+static char* snapshotPath = NULL;   // DOCS_WAL + ".snap"
+static ULONGLONG snapshotLsn = 0;   // log position the last snapshot started at
+
+static void ReportSections(MetricsText* out, BOOL prometheus);
+static void ReplayRecord(const unsigned char* payload, size_t len);
+static void LoadSnapshot(void);
+static void TakeSnapshot(void);
+static void ResumeInput(ClientContext* client);
+
+// A non-negative number from the environment; FALSE (with a warning) if the
+// variable is set to anything else
+static BOOL EnvNumber(const char* name, long long* value) {
+    const char* env = getenv(name);
+    if (!env || !*env) return FALSE;
+    char* end;
+    long long n = strtoll(env, &end, 10);
+    if (*end || n < 0) {
+        LOG_WARN("[Server] Ignoring %s='%s'\n", name, env);
+        return FALSE;
+    }
+    *value = n;
+    return TRUE;
+}
+
+static void LoadFlowLimits(void) {
+    long long n;
+    if (EnvNumber("DOCS_MAX_OUTPUT", &n) && n > 0) flowMaxOutput = (size_t)n;
+    if (EnvNumber("DOCS_MAX_QUEUED", &n) && n > 0 && n <= INT_MAX) flowMaxQueued = (int)n;
+    if (EnvNumber("DOCS_MAX_HELD_INPUT", &n) && n > 0) flowMaxHeld = (size_t)n;
+    if (EnvNumber("DOCS_STALL_TIMEOUT", &n)) flowStallMicros = (ULONGLONG)n * 1000000ULL;
+    LOG_INFO("[Server] Flow control: %zu bytes / %d responses queued, %zu bytes held, stall timeout %llu s\n",
+        flowMaxOutput, flowMaxQueued, flowMaxHeld, flowStallMicros / 1000000ULL);
+}
+
+static void LoadTimeouts(void) {
+    long long n;
+    if (EnvNumber("DOCS_IDLE_TIMEOUT", &n)) idleMicros = (ULONGLONG)n * 1000000ULL;
+    if (EnvNumber("DOCS_WRITE_TIMEOUT", &n)) writeMicros = (ULONGLONG)n * 1000000ULL;
+    if (EnvNumber("DOCS_COMMIT_TIMEOUT", &n)) commitMicros = (ULONGLONG)n * 1000000ULL;
+    LOG_INFO("[Server] Timeouts: idle %llu s, write %llu s, commit %llu s\n",
+        idleMicros / 1000000ULL, writeMicros / 1000000ULL, commitMicros / 1000000ULL);
+}
+
+void InitializeDocStore(void) {
+    // Initialize SRW lock
+    InitializeSRWLock(&docsLock);
+    ArenaInit(&docArena);
+    NameIndexInit(&docIndex, DOC_TABLE_MIN_CAPACITY);
+
+    const char* env = getenv("DOCS_COMMIT_ORDER");
+    if (env) {
+        CommitOrder order;
+        if (CommitParseOrder(env, &order)) CommitQueueSetOrder(order);
+        else LOG_WARN("[Server] Unknown DOCS_COMMIT_ORDER '%s', using fifo\n", env);
+    }
+
+    LineScanInit();
+    LOG_INFO("[Server] Line scanner: %s\n", LineScanName(LineScanCurrent()));
+    LoadFlowLimits();
+    LoadTimeouts();
+
+    MetricsSetSectionReporter(ReportSections);
+    MetricsInit();
+
+    // Durable only when asked for; without a log the store lives in memory.
+    // The snapshot is loaded first and the log replayed on top of it.
+    env = getenv("DOCS_WAL");
+    if (!env || !*env) return;
+    snapshotPath = (char*)malloc(strlen(env) + 6);
+    if (snapshotPath) {
+        sprintf(snapshotPath, "%s.snap", env);
+        LoadSnapshot();
+    }
+    if (!WalOpen(env, ReplayRecord)) {
+        LOG_ERROR("[ERROR] Write-ahead log %s unavailable, not starting\n", env);
+        LogFlush();
+        exit(EXIT_FAILURE);
+    }
+
+    int interval = SNAPSHOT_DEFAULT_INTERVAL;
+    const char* intervalEnv = getenv("DOCS_SNAPSHOT_INTERVAL");
+    if (intervalEnv) interval = atoi(intervalEnv);
+    if (snapshotPath && interval > 0) {
+        SnapshotStartThread((DWORD)interval, TakeSnapshot);
+        LOG_INFO("[Server] Snapshot %s every %d s\n", snapshotPath, interval);
+    }
+}
+
+static void ReleaseRendered(void* ptr) {
+    RenderedRead* rendered = (RenderedRead*)ptr;
+    if (InterlockedDecrement(&rendered->refs) == 0) free(rendered);
+}
+
+// A new body (refs 1) over storage, seeing everything written to it so far
+static SectionBody* ShareStorage(BodyStorage* storage) {
+    SectionBody* body = (SectionBody*)malloc(sizeof(SectionBody));
+    if (!body) return NULL;
+    InterlockedIncrement(&storage->refs);
+    body->version = 0;
+    body->refs = 1;
+    for (int f = 0; f < READ_FORMAT_COUNT; f++) body->rendered[f] = NULL;
+    body->storage = storage;
+    body->lineCount = storage->lineCount;
+    body->textLen = storage->textLen;
+    body->lines = storage->lines;
+    return body;
+}
+
+SectionBody* AllocSectionBody(int lineCap, size_t textCap, char* text) {
+    size_t size = sizeof(BodyStorage) + sizeof(char*) * lineCap + (text ? 0 : textCap);
+    BodyStorage* storage = (BodyStorage*)malloc(size);
+    if (!storage) return NULL;
+    storage->refs = 0;
+    storage->lineCap = lineCap;
+    storage->lineCount = 0;
+    storage->textCap = textCap;
+    storage->textLen = 0;
+    storage->text = text ? text : (char*)&storage->lines[lineCap];
+
+    SectionBody* body = ShareStorage(storage);
+    if (!body) free(storage);
+    return body;
+}
+
+// Drop one reference; the last one frees the body, its renderings and, if no
+// other body shares it, its storage
+static void ReleaseSectionBody(void* ptr) {
+    SectionBody* body = (SectionBody*)ptr;
+    if (InterlockedDecrement(&body->refs) != 0) return;
+    for (int f = 0; f < READ_FORMAT_COUNT; f++) {
+        if (body->rendered[f]) ReleaseRendered(body->rendered[f]);
+    }
+    if (InterlockedDecrement(&body->storage->refs) == 0) free(body->storage);
+    free(body);
+}
+
+// The section's published body, inside an epoch. Contents still only in the
+// snapshot get their line table built on first use and published with a
+// CAS, so a reader and the combiner racing to load them agree on one body.
+static SectionBody* CurrentBody(Section* section) {
+    SectionBody* body = (SectionBody*)ReadPointerAcquire((PVOID*)&section->body);
+    if (body || !section->stored) return body;
+
+    SectionBody* loaded = SnapshotLoadBody(section->stored);
+    if (!loaded) return NULL;
+    body = (SectionBody*)InterlockedCompareExchangePointer((PVOID*)&section->body, loaded, NULL);
+    if (body) {
+        ReleaseSectionBody(loaded);
+        return body;
+    }
+    return loaded;
+}
+
+// Bytes of text, NULs included, taken by count lines from first. Lines are
+// stored back to back, so a run ends where the line after it starts.
+static size_t RangeLength(const SectionBody* body, int first, int count) {
+    if (count == 0) return 0;
+    const char* end = first + count < body->lineCount ? body->lines[first + count] : body->lines[0] + body->textLen;
+    return (size_t)(end - body->lines[first]);
+}
+
+static size_t LineLength(const SectionBody* body, int i) {
+    return RangeLength(body, i, 1) - 1;
+}
+
+// Copy count lines of from, starting at first, to the end of storage, which
+// has room for them: the text in one piece, then the line table rebased
+static void CopyLines(BodyStorage* to, const SectionBody* from, int first, int count) {
+    if (count == 0) return;
+    const char* start = from->lines[first];
+    size_t len = RangeLength(from, first, count);
+    char* out = to->text + to->textLen;
+    memcpy(out, start, len);
+    for (int i = 0; i < count; i++) to->lines[to->lineCount++] = out + (from->lines[first + i] - start);
+    to->textLen += len;
+}
+
+// base (NULL if the section was never written) with remove lines from line
+// replaced by the lines of edit; the caller has checked the range. An append
+// to the newest body of a storage with room left is written in place and
+// shares it. Anything else is copied once into new storage, which gets room
+// to spare when appending so the appends after it go in place.
+static SectionBody* SpliceBody(const SectionBody* base, int line, int remove, const SectionBody* edit) {
+    int baseLines = base ? base->lineCount : 0;
+    size_t baseText = base ? base->textLen : 0;
+    BOOL append = line == baseLines && remove == 0;
+
+    BodyStorage* storage = base ? base->storage : NULL;
+    if (append && storage && storage->lineCount == baseLines && storage->textLen == baseText &&
+        storage->lineCap - storage->lineCount >= edit->lineCount &&
+        storage->textCap - storage->textLen >= edit->textLen) {
+        CopyLines(storage, edit, 0, edit->lineCount);
+        return ShareStorage(storage);
+    }
+
+    int lineCount = baseLines - remove + edit->lineCount;
+    size_t textLen = baseText - (remove ? RangeLength(base, line, remove) : 0) + edit->textLen;
+    int lineCap = lineCount;
+    size_t textCap = textLen;
+    if (append) {
+        lineCap = lineCount < BODY_MIN_LINES / 2 ? BODY_MIN_LINES : lineCount * 2;
+        textCap = textLen < BODY_MIN_TEXT / 2 ? BODY_MIN_TEXT : textLen * 2;
+    }
+    SectionBody* body = AllocSectionBody(lineCap, textCap, NULL);
+    if (!body) return NULL;
+
+    if (base) CopyLines(body->storage, base, 0, line);
+    CopyLines(body->storage, edit, 0, edit->lineCount);
+    if (base) CopyLines(body->storage, base, line + remove, baseLines - line - remove);
+    body->lineCount = body->storage->lineCount;
+    body->textLen = body->storage->textLen;
+    return body;
+}
+
+// One write on top of current (NULL if the section was never written): the
+// new body, or NULL with node->status set if the write cannot be applied.
+// Line numbers are checked here, against the version the edit lands on.
+static SectionBody* ApplyWrite(const SectionBody* current, WriteNode* node) {
+    if (node->remove < 0) {
+        // A full write was built before queueing, so it is a pointer swap
+        SectionBody* body = node->body;
+        node->body = NULL;
+        return body;
+    }
+
+    int count = current ? current->lineCount : 0;
+    int line = node->line < 0 ? count : node->line;
+    if (line > count || node->remove > count - line) {
+        node->status = DOCS_STATUS_NO_LINE;
+        return NULL;
+    }
+    SectionBody* body = SpliceBody(current, line, node->remove, node->body);
+    if (!body) node->status = DOCS_STATUS_NO_MEMORY;
+    return body;
+}
+
+// Answer every writer of a batch
+static void CompleteBatch(WriteNode* batch) {
+    while (batch) {
+        WriteNode* node = batch;
+        batch = node->next;
+        if (node->body) ReleaseSectionBody(node->body);
+        node->client->writeStatus = node->status;
+        PostWriteCompletion(node->client);
+        FreeWriteNode(node);
+    }
+}
+
+// The batch's log record is durable (log thread)
+static void BatchDurable(void* arg) {
+    MetricsRecord* metrics = Metrics();
+    ULONGLONG now = MetricsNow();
+    for (WriteNode* node = (WriteNode*)arg; node; node = node->next) {
+        MetricsObserve(&metrics->walWait, now - node->queuedAt);
+    }
+    CompleteBatch((WriteNode*)arg);
+}
+
+// A batch's log record: the published body if the batch had a full write,
+// otherwise just the edits it applied
+typedef struct {
+    const Section* section;
+    const SectionBody* body;        // published
+    const WriteNode* batch;
+    int edits;                      // applied, if no full write
+} WriteRecord;
+
+static size_t LinesSize(const SectionBody* body) {
+    return 4 * (size_t)body->lineCount + body->textLen;
+}
+
+// Lines as they are logged (and staged): u32 length, the bytes, a NUL
+static unsigned char* PutLines(unsigned char* out, const SectionBody* body) {
+    for (int i = 0; i < body->lineCount; i++) {
+        size_t n = LineLength(body, i);
+        DocsPutU32(out, (uint32_t)n);
+        memcpy(out + 4, body->lines[i], n + 1);
+        out += 4 + n + 1;
+    }
+    return out;
+}
+
+static size_t WriteRecordSize(const WriteRecord* rec) {
+    size_t size = 1 + 4 + strlen(rec->section->doc->title) + 4 * 4;
+    if (rec->edits == 0) return size + LinesSize(rec->body);
+    for (const WriteNode* node = rec->batch; node; node = node->next) {
+        if (node->status == DOCS_STATUS_OK) size += 4 * 3 + LinesSize(node->body);
+    }
+    return size;
+}
+
+static void FillWriteRecord(const void* ctx, unsigned char* out) {
+    const WriteRecord* rec = (const WriteRecord*)ctx;
+    const Document* doc = rec->section->doc;
+    const SectionBody* body = rec->body;
+    size_t titleLen = strlen(doc->title);
+
+    *out++ = rec->edits ? WAL_RECORD_EDIT : WAL_RECORD_WRITE;
+    DocsPutU32(out, (uint32_t)titleLen);
+    memcpy(out + 4, doc->title, titleLen);
+    out += 4 + titleLen;
+    DocsPutU32(out, (uint32_t)(rec->section - doc->sections));
+    DocsPutU32(out + 4, (uint32_t)body->version);
+    DocsPutU32(out + 8, (uint32_t)((ULONGLONG)body->version >> 32));
+    if (rec->edits == 0) {
+        DocsPutU32(out + 12, (uint32_t)body->lineCount);
+        PutLines(out + 16, body);
+        return;
+    }
+
+    DocsPutU32(out + 12, (uint32_t)rec->edits);
+    out += 16;
+    for (const WriteNode* node = rec->batch; node; node = node->next) {
+        if (node->status != DOCS_STATUS_OK) continue;
+        DocsPutU32(out, (uint32_t)node->line);
+        DocsPutU32(out + 4, (uint32_t)node->remove);
+        DocsPutU32(out + 8, (uint32_t)node->body->lineCount);
+        out = PutLines(out + 12, node->body);
+    }
+}
+
+// Apply one batch of writes to a section; called by the section's combiner,
+// so this is the only writer. The writes are applied in order on top of each
+// other and only the result is published (one release store, the old version
+// retired for readers still holding it); the bodies in between were never
+// visible and are freed at once. Each write that applied counts a version;
+// an edit whose line no longer exists fails on its own.
+//
+// With a write-ahead log the batch is also one record, and the writers are
+// answered from the log thread once that record is durable. Readers may see
+// the new version a little earlier than that.
+static void ApplyBatch(void* ctx, WriteNode* batch) {
+    Section* section = (Section*)ctx;
+    SectionBody* old = CurrentBody(section);
+    SectionBody* current = old;
+    LONG64 version = old ? old->version : 0;
+    int edits = 0;
+    BOOL replaced = FALSE;
+    ULONGLONG start = MetricsNow();
+
+    for (WriteNode* node = batch; node; node = node->next) {
+        SectionBody* next = ApplyWrite(current, node);
+        if (!next) continue;
+        if (current != old) ReleaseSectionBody(current);
+        current = next;
+        version++;
+        if (node->remove < 0) replaced = TRUE;
+        else edits++;
+    }
+    if (current != old) {
+        current->version = version;
+        WritePointerRelease((PVOID*)&section->body, current);
+        if (old) EpochRetire(old, ReleaseSectionBody);
+    }
+
+    MetricsRecord* metrics = Metrics();
+    ULONGLONG now = MetricsNow();
+    for (WriteNode* node = batch; node; node = node->next) {
+        ULONGLONG wait = now - node->queuedAt;
+        MetricsObserve(&metrics->commitWait, wait);
+        section->waitMicros += (LONG64)wait;
+        if ((LONG64)wait > section->maxWaitMicros) section->maxWaitMicros = (LONG64)wait;
+        section->committed++;
+        metrics->commitWrites++;
+    }
+    metrics->commitBatches++;
+
+    // Completions only after publishing, so [Write_Completed] is never
+    // followed by a read of the previous version. The log thread may free
+    // the nodes as soon as the record is appended.
+    BOOL logged = FALSE;
+    if (current != old && WalEnabled()) {
+        WriteRecord rec = { section, current, batch, replaced ? 0 : edits };
+        logged = WalAppend(WriteRecordSize(&rec), FillWriteRecord, &rec, BatchDurable, batch) != 0;
+        if (!logged) {
+            LOG_ERROR("[ERROR] Out of memory logging a commit to %s; it is not durable\n", section->title);
+        }
+    }
+    if (!logged) CompleteBatch(batch);
+    MetricsObserve(&metrics->lockHold[METRIC_LOCK_COMMIT], MetricsNow() - start);
+}
+
+// Make room for one more entry in docTable. Called with docsLock held exclusively.
+static BOOL ReserveDocSlot(void) {
+    DocTable* old = docTable;
+    if (old && doc_count < old->capacity) return TRUE;
+
+    LONG capacity = old ? old->capacity * 2 : DOC_TABLE_MIN_CAPACITY;
+    DocTable* table = (DocTable*)malloc(sizeof(DocTable) + sizeof(Document*) * capacity);
+    if (!table) return FALSE;
+    table->capacity = capacity;
+    if (old) memcpy(table->items, old->items, sizeof(Document*) * doc_count);
+
+    WritePointerRelease((PVOID*)&docTable, table);
+    EpochRetire(old, free);
+    return TRUE;
+}
+
+// Allocate a document and reserve its slot in docTable and in the title index,
+// so publishing it cannot fail. Called with docsLock held exclusively; on
+// failure the store is left unchanged apart from arena space.
+static Document* CreateDocument(const char* title, int sectionCount, char* sectionTitles[]) {
+    if (!ReserveDocSlot() || !NameIndexReserve(&docIndex, 1)) return NULL;
+
+    Document* doc = (Document*)ArenaAlloc(&docArena, sizeof(Document));
+    if (!doc) return NULL;
+    doc->title = ArenaStrdup(&docArena, title);
+    doc->sections = (Section*)ArenaAlloc(&docArena, sizeof(Section) * sectionCount);
+    if (!doc->title || !doc->sections || !NameIndexInit(&doc->sectionIndex, sectionCount)) {
+        return NULL;
+    }
+    doc->section_count = sectionCount;
+
+    for (int i = 0; i < sectionCount; i++) {
+        Section* section = &doc->sections[i];
+        section->title = ArenaStrdup(&docArena, sectionTitles[i]);
+        section->doc = doc;
+        if (!section->title) {
+            NameIndexFree(&doc->sectionIndex);
+            return NULL;
+        }
+        CommitQueueInit(&section->commits);
+        // A repeated title keeps resolving to its first section
+        NameIndexInsert(&doc->sectionIndex, section->title, i);
+    }
+    return doc;
+}
+
+// Must be called inside an epoch; the returned document itself never moves
+Document* FindDoc(const char* title) {
+    int idx = NameIndexFind(&docIndex, title);
+    if (idx < 0) return NULL;
+    DocTable* table = (DocTable*)ReadPointerAcquire((PVOID*)&docTable);
+    return table->items[idx];
+}
+
+int FindSection(const Document* doc, const char* title) {
+    return NameIndexFind(&doc->sectionIndex, title);
+}
+
+// Arguments are slices of input, which is modified in place
+void ParseCommand(char* input, char* args[], int* argc) {
+    *argc = TokenizeCommand(input, strlen(input), args, 64);
+}
+
+void FreeClientState(ClientContext* client) {
+    free(client->stagedText);
+    client->stagedText = NULL;
+    client->stagedLen = client->stagedCap = 0;
+    FreeResponse(client->outHead);
+    client->outHead = client->outTail = NULL;
+    MetricsRecord* metrics = Metrics();
+    metrics->outputQueued -= (LONG64)client->outBytes;
+    client->outBytes = client->sendBytes = 0;
+    client->outCount = 0;
+    if (client->inputPaused) metrics->pausedClients--;
+    client->inputPaused = FALSE;
+    free(client->heldInput);
+    client->heldInput = NULL;
+    client->heldLen = client->heldPos = client->heldCap = 0;
+    free(client->frame);
+    client->frame = NULL;
+    client->frameLen = client->frameCap = 0;
+}
+
+// Staged lines are length-prefixed, so a line may hold any byte (the binary
+// protocol can send NULs and newlines)
+static BOOL StageLine(ClientContext* client, const char* line, size_t len) {
+    size_t need = sizeof(DWORD) + len + 1;
+    if (client->stagedLen + need > client->stagedCap) {
+        size_t cap = client->stagedCap ? client->stagedCap : BUF_SIZE;
+        while (cap < client->stagedLen + need) cap *= 2;
+        char* text = (char*)realloc(client->stagedText, cap);
+        if (!text) return FALSE;
+        client->stagedText = text;
+        client->stagedCap = cap;
+    }
+    char* out = client->stagedText + client->stagedLen;
+    DocsPutU32((unsigned char*)out, (uint32_t)len);
+    memcpy(out + sizeof(DWORD), line, len);
+    out[sizeof(DWORD) + len] = '\0';
+    client->stagedLen += need;
+    client->lineCount++;
+    return TRUE;
+}
+
+// Pack staged lines into new storage of exactly their size (also for an
+// empty write, so every commit gets its own version)
+static SectionBody* BuildSectionBody(const char* staged, size_t stagedLen, int lineCount) {
+    SectionBody* body = AllocSectionBody(lineCount, stagedLen - sizeof(DWORD) * lineCount, NULL);
+    if (!body) return NULL;
+
+    BodyStorage* storage = body->storage;
+    const char* in = staged;
+    for (int i = 0; i < lineCount; i++) {
+        DWORD n = DocsGetU32((const unsigned char*)in);
+        in += sizeof(n);
+        storage->lines[i] = storage->text + storage->textLen;
+        memcpy(storage->lines[i], in, n + 1);
+        storage->textLen += n + 1;
+        in += n + 1;
+    }
+    storage->lineCount = lineCount;
+    body->lineCount = lineCount;
+    body->textLen = storage->textLen;
+    return body;
+}
+
+#define RESPONSE_CHUNK_SIZE 1024
+
+// Replies larger than this are streamed, in sends of about READ_CHUNK_SIZE
+// bytes and at most READ_CHUNK_SEGMENTS segments (one sendmsg's IOV_MAX)
+#define READ_STREAM_THRESHOLD (256 * 1024)
+#define READ_CHUNK_SIZE (64 * 1024)
+#define READ_CHUNK_SEGMENTS 1024
+
+struct ResponseChunk {
+    ResponseChunk* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+// Where a streamed reply is up to: lines of a section body, or documents of
+// the catalog (which never move, so only the count is fixed at the start)
+typedef struct ReadStream {
+    ReadFormat format;
+    SectionBody* body;          // referenced; NULL for the catalog
+    int next;                   // next line or document
+    int end;
+} ReadStream;
+
+static Response* NewResponse(void) {
+    return (Response*)calloc(1, sizeof(Response));
+}
+
+void FreeResponse(Response* response) {
+    while (response) {
+        Response* next = response->next;
+        while (response->chunks) {
+            ResponseChunk* chunk = response->chunks;
+            response->chunks = chunk->next;
+            free(chunk);
+        }
+        if (response->hold) ReleaseRendered(response->hold);
+        if (response->holdBody) ReleaseSectionBody(response->holdBody);
+        if (response->stream) {
+            if (response->stream->body) ReleaseSectionBody(response->stream->body);
+            free(response->stream);
+        }
+        free(response->segs);
+        free(response);
+        response = next;
+    }
+}
+
+// Append a segment pointing at data, which must stay put until the response
+// is freed. Runs that are contiguous in memory collapse into one segment.
+static void AddSegment(Response* response, const char* data, size_t len) {
+    if (len == 0 || response->failed) return;
+    response->bytes += len;
+
+    if (response->count > 0) {
+        SendSegment* last = &response->segs[response->count - 1];
+        if (SEGMENT_DATA(last) + SEGMENT_LEN(last) == data) {
+            SEGMENT_SET(last, SEGMENT_DATA(last), SEGMENT_LEN(last) + len);
+            return;
+        }
+    }
+
+    if (response->count == response->capacity) {
+        int capacity = response->capacity ? response->capacity * 2 : 16;
+        SendSegment* segs = (SendSegment*)realloc(response->segs, sizeof(SendSegment) * capacity);
+        if (!segs) {
+            response->bytes -= len;
+            response->failed = TRUE;
+            return;
+        }
+        response->segs = segs;
+        response->capacity = capacity;
+    }
+    SEGMENT_SET(&response->segs[response->count], data, len);
+    response->count++;
+}
+
+static void AddText(Response* response, const char* text) {
+    AddSegment(response, text, strlen(text));
+}
+
+// Room for len bytes (plus a NUL) in the response's own storage
+static char* ReserveFragment(Response* response, size_t len) {
+    if (response->failed) return NULL;
+
+    ResponseChunk* chunk = response->chunks;
+    if (!chunk || chunk->capacity - chunk->used < len + 1) {
+        size_t capacity = len + 1 > RESPONSE_CHUNK_SIZE ? len + 1 : RESPONSE_CHUNK_SIZE;
+        chunk = (ResponseChunk*)malloc(sizeof(ResponseChunk) + capacity);
+        if (!chunk) {
+            response->failed = TRUE;
+            return NULL;
+        }
+        chunk->next = response->chunks;
+        chunk->used = 0;
+        chunk->capacity = capacity;
+        response->chunks = chunk;
+    }
+
+    char* out = chunk->data + chunk->used;
+    chunk->used += len;     // the NUL is overwritten by the next fragment
+    return out;
+}
+
+// Copy bytes whose storage will not outlive the call
+static void AddCopy(Response* response, const char* data, size_t len) {
+    char* out = ReserveFragment(response, len);
+    if (!out) return;
+    memcpy(out, data, len);
+    AddSegment(response, out, len);
+}
+
+// Render a small fragment into the response's own storage
+static void AddFormat(Response* response, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (n < 0) return;
+
+    char* out = ReserveFragment(response, (size_t)n);
+    if (!out) return;
+    va_start(args, fmt);
+    vsnprintf(out, (size_t)n + 1, fmt, args);
+    va_end(args);
+    AddSegment(response, out, n);
+}
+
+// Streamed reads
+
+// A streamed reply for the lines of body (taken inside the caller's epoch)
+// or, if body is NULL, the first count documents of the catalog
+static Response* NewStream(ReadFormat format, SectionBody* body, int count) {
+    Response* response = NewResponse();
+    ReadStream* stream = response ? (ReadStream*)malloc(sizeof(ReadStream)) : NULL;
+    if (!stream) {
+        free(response);
+        return NULL;
+    }
+    stream->format = format;
+    stream->body = body;
+    if (body) InterlockedIncrement(&body->refs);
+    stream->next = 0;
+    stream->end = body ? body->lineCount : count;
+    response->stream = stream;
+    Metrics()->readStreams++;
+    return response;
+}
+
+// Length prefix of a binary field, in the response's own storage
+static void AddFieldLength(Response* response, size_t len) {
+    unsigned char* out = (unsigned char*)ReserveFragment(response, 4);
+    if (!out) return;
+    DocsPutU32(out, (uint32_t)len);
+    AddSegment(response, (const char*)out, 4);
+}
+
+static void FillCatalogChunk(ReadStream* stream, Response* chunk);
+
+// Fill chunk with the stream's next lines or documents, laid out as the
+// rendered replies are (RenderSection, RenderCatalog)
+static void FillChunk(ReadStream* stream, Response* chunk) {
+    static const char lineBreak[] = "\n       ";
+    size_t bytes = 0;
+
+    if (stream->body) {
+        SectionBody* body = stream->body;
+        InterlockedIncrement(&body->refs);
+        chunk->holdBody = body;
+        while (stream->next < stream->end && bytes < READ_CHUNK_SIZE && chunk->count < READ_CHUNK_SEGMENTS - 3) {
+            int j = stream->next++;
+            size_t len = LineLength(body, j);
+            if (stream->format == READ_BINARY) {
+                AddFieldLength(chunk, len);
+            }
+            else if (j == 0) {
+                AddSegment(chunk, lineBreak + 1, sizeof(lineBreak) - 2);
+            }
+            else {
+                AddSegment(chunk, lineBreak, sizeof(lineBreak) - 1);
+            }
+            AddSegment(chunk, body->lines[j], len);
+            if (stream->format == READ_TEXT && stream->next == stream->end) AddSegment(chunk, lineBreak, 1);
+            bytes += len + 8;
+        }
+        return;
+    }
+
+    FillCatalogChunk(stream, chunk);
+}
+
+// The next send of the streamed reply at the head of the queue, which leaves
+// the queue with its last chunk. NULL if memory ran out, in which case the
+// rest of the reply is dropped.
+static Response* NextChunk(ClientContext* client) {
+    Response* head = client->outHead;
+    ReadStream* stream = head->stream;
+    Response* chunk = NewResponse();
+    if (chunk) FillChunk(stream, chunk);
+    if (!chunk || chunk->failed) {
+        LOG_ERROR("[Worker-%d] Out of memory streaming a read; the reply is cut short\n", GetCurrentThreadId());
+        FreeResponse(chunk);
+        chunk = NULL;
+        stream->next = stream->end;
+    }
+
+    if (stream->next == stream->end) {
+        client->outHead = head->next;
+        if (!client->outHead) client->outTail = NULL;
+        head->next = NULL;
+        FreeResponse(head);
+        client->outCount--;
+    }
+    if (chunk) Metrics()->readChunks++;
+    return chunk;
+}
+
+// Output joins (or, negative, leaves) the client's outstanding bytes
+static void CountOutput(ClientContext* client, LONG64 bytes) {
+    client->outBytes += (size_t)bytes;
+    Metrics()->outputQueued += bytes;
+}
+
+static void QueueResponse(ClientContext* client, Response* response) {
+    if (client->outTail) client->outTail->next = response;
+    else client->outHead = response;
+    client->outTail = response;
+    client->outCount++;
+    CountOutput(client, (LONG64)response->bytes);
+}
+
+BOOL SendData(ClientContext* client, const char* data, int len) {
+    if (len < 0) len = (int)strlen(data);
+
+    // Consecutive replies share the queued response and, being copied back
+    // to back, usually a single segment
+    Response* response = client->outTail;
+    if (!response || response->stream) {
+        response = NewResponse();
+        if (!response) return FALSE;
+        QueueResponse(client, response);
+    }
+    size_t before = response->bytes;
+    AddCopy(response, data, (size_t)len);
+    CountOutput(client, (LONG64)(response->bytes - before));
+    return !response->failed;
+}
+
+// Everything queued up to the next stream, merged into one send
+static Response* TakeMerged(ClientContext* client) {
+    Response* first = client->outHead;
+    int total = 0;
+    for (Response* r = first; r && !r->stream; r = r->next) total += r->count;
+
+    // One segment array for the whole send; the responses behind the first
+    // stay linked to it so their storage lives until the send completes
+    if (first->next && total > first->capacity) {
+        SendSegment* segs = (SendSegment*)realloc(first->segs, sizeof(SendSegment) * total);
+        if (segs) {
+            first->segs = segs;
+            first->capacity = total;
+        }
+    }
+    client->outCount--;
+    Response* r = first->next;
+    while (r && !r->stream && first->count + r->count <= first->capacity) {
+        client->outCount--;
+        memcpy(first->segs + first->count, r->segs, sizeof(SendSegment) * r->count);
+        first->count += r->count;
+        free(r->segs);
+        r->segs = NULL;
+        r->count = r->capacity = 0;
+        r = r->next;
+    }
+
+    if (r) {
+        // A stream, or out of memory for the merged array: the rest goes in
+        // a later send
+        Response* last = first;
+        while (last->next != r) last = last->next;
+        last->next = NULL;
+        client->outHead = r;
+    }
+    else {
+        client->outHead = client->outTail = NULL;
+    }
+    return first;
+}
+
+Response* TakeOutput(ClientContext* client) {
+    if (client->sendInFlight) return NULL;
+
+    Response* first = NULL;
+    BOOL chunk = FALSE;
+    while (!first && client->outHead) {
+        chunk = client->outHead->stream != NULL;
+        first = chunk ? NextChunk(client) : TakeMerged(client);
+    }
+    if (!first) return NULL;
+
+    size_t bytes = 0;
+    for (int i = 0; i < first->count; i++) bytes += SEGMENT_LEN(&first->segs[i]);
+    // A stream's bytes are outstanding only once a chunk has been built
+    if (chunk) CountOutput(client, (LONG64)bytes);
+    client->sendBytes = bytes;
+
+    MetricsRecord* metrics = Metrics();
+    metrics->sendCalls++;
+    metrics->sendBytes += (LONG64)bytes;
+
+    client->sendInFlight = TRUE;
+    return first;
+}
+
+void FlushOutput(ClientContext* client) {
+    Response* response = TakeOutput(client);
+    if (response && !SendVector(client, response)) {
+        // Dead connection; the queue is freed with the client
+        client->sendInFlight = FALSE;
+    }
+}
+
+BOOL SendCompleted(ClientContext* client) {
+    client->sendInFlight = FALSE;
+    CountOutput(client, -(LONG64)client->sendBytes);
+    client->sendBytes = 0;
+    client->activeAt = MetricsNow();
+    if (client->inputPaused) {
+        client->progressAt = client->activeAt;
+        ResumeInput(client);
+    }
+    return client->disconnectAfterSend && !client->outHead;
+}
+
+// Timeouts, in the order ClientTimedOut reports them
+typedef enum {
+    TIMEOUT_STALL,
+    TIMEOUT_COMMIT,
+    TIMEOUT_WRITE,
+    TIMEOUT_IDLE,
+    TIMEOUT_KIND_COUNT
+} TimeoutKind;
+
+// When the client's deadline of one kind runs out, or 0 if it does not apply
+static ULONGLONG KindDeadline(const ClientContext* client, TimeoutKind kind) {
+    switch (kind) {
+    case TIMEOUT_STALL:
+        return client->inputPaused && flowStallMicros ? client->progressAt + flowStallMicros : 0;
+    case TIMEOUT_COMMIT:
+        return client->commitPending && commitMicros ? client->commitAt + commitMicros : 0;
+    case TIMEOUT_WRITE:
+        return client->isWriteMode && writeMicros ? client->writeAt + writeMicros : 0;
+    default:
+        // A client waiting on the server, or that the server waits on, is not idle
+        if (client->inputPaused || client->commitPending || client->isWriteMode || !idleMicros) return 0;
+        return client->activeAt + idleMicros;
+    }
+}
+
+ULONGLONG ClientDeadline(const ClientContext* client) {
+    ULONGLONG due = 0;
+    for (int kind = 0; kind < TIMEOUT_KIND_COUNT; kind++) {
+        ULONGLONG deadline = KindDeadline(client, (TimeoutKind)kind);
+        if (deadline && (!due || deadline < due)) due = deadline;
+    }
+    return due;
+}
+
+BOOL ClientTimedOut(ClientContext* client, ULONGLONG now) {
+    MetricsRecord* metrics = Metrics();
+    for (int kind = 0; kind < TIMEOUT_KIND_COUNT; kind++) {
+        ULONGLONG deadline = KindDeadline(client, (TimeoutKind)kind);
+        if (!deadline || deadline > now) continue;
+
+        switch ((TimeoutKind)kind) {
+        case TIMEOUT_STALL:
+            LOG_WARN("[Worker-%d] Client %p stalled with %zu bytes unsent, disconnecting\n",
+                GetCurrentThreadId(), (void*)client, client->outBytes);
+            metrics->stallDrops++;
+            break;
+        case TIMEOUT_COMMIT:
+            LOG_WARN("[Worker-%d] Client %p: commit unanswered after %llu s, disconnecting\n",
+                GetCurrentThreadId(), (void*)client, commitMicros / 1000000ULL);
+            metrics->commitTimeouts++;
+            break;
+        case TIMEOUT_WRITE:
+            LOG_WARN("[Worker-%d] Client %p: no <END> after %llu s (%d lines staged), disconnecting\n",
+                GetCurrentThreadId(), (void*)client, writeMicros / 1000000ULL, client->lineCount);
+            metrics->writeTimeouts++;
+            break;
+        default:
+            LOG_DEBUG("[Worker-%d] Client %p idle for %llu s, disconnecting\n",
+                GetCurrentThreadId(), (void*)client, idleMicros / 1000000ULL);
+            metrics->idleDrops++;
+            break;
+        }
+        return TRUE;
+    }
+    return FALSE;
+}
+
+// Read cache. A reply is rendered in two passes over the same code: one that
+// only measures (out == NULL) and one into the allocation it sized.
+
+static RenderedRead* volatile catalogReplies[READ_FORMAT_COUNT];
+
+typedef struct {
+    char* out;
+    size_t len;
+} RenderBuffer;
+
+static void Put(RenderBuffer* b, const void* data, size_t len) {
+    if (b->out) memcpy(b->out + b->len, data, len);
+    b->len += len;
+}
+
+static void PutFieldHeader(RenderBuffer* b, size_t len) {
+    unsigned char header[4];
+    DocsPutU32(header, (uint32_t)len);
+    Put(b, header, sizeof(header));
+}
+
+static void PutSectionTitle(RenderBuffer* b, const Document* doc, int i) {
+    char number[16];
+    int n = snprintf(number, sizeof(number), "    %d. ", i + 1);
+    Put(b, number, (size_t)n);
+    Put(b, doc->sections[i].title, strlen(doc->sections[i].title));
+    Put(b, "\n", 1);
+}
+
+static void RenderSection(RenderBuffer* b, const Document* doc, int i, const SectionBody* body,
+    ReadFormat format) {
+    if (format == READ_TEXT) {
+        Put(b, doc->title, strlen(doc->title));
+        Put(b, "\n", 1);
+        PutSectionTitle(b, doc, i);
+    }
+    for (int j = 0; j < body->lineCount; j++) {
+        size_t len = LineLength(body, j);
+        if (format == READ_BINARY) {
+            PutFieldHeader(b, len);
+            Put(b, body->lines[j], len);
+        }
+        else {
+            Put(b, "       ", 7);
+            Put(b, body->lines[j], len);
+            Put(b, "\n", 1);
+        }
+    }
+}
+
+// Documents first up to end
+static void RenderCatalog(RenderBuffer* b, const DocTable* table, LONG first, LONG end, ReadFormat format) {
+    for (LONG i = first; i < end; i++) {
+        const Document* doc = table->items[i];
+        if (format == READ_BINARY) {
+            // One field per document: its title and the section titles, NUL-terminated
+            size_t len = strlen(doc->title) + 1;
+            for (int j = 0; j < doc->section_count; j++) len += strlen(doc->sections[j].title) + 1;
+            PutFieldHeader(b, len);
+            Put(b, doc->title, strlen(doc->title) + 1);
+            for (int j = 0; j < doc->section_count; j++) {
+                Put(b, doc->sections[j].title, strlen(doc->sections[j].title) + 1);
+            }
+        }
+        else {
+            Put(b, doc->title, strlen(doc->title));
+            Put(b, "\n", 1);
+            for (int j = 0; j < doc->section_count; j++) PutSectionTitle(b, doc, j);
+        }
+    }
+}
+
+// The streamed catalog's next documents, about READ_CHUNK_SIZE bytes of them,
+// rendered into one fragment of the chunk
+static void FillCatalogChunk(ReadStream* stream, Response* chunk) {
+    EpochEnter();
+    const DocTable* table = (const DocTable*)ReadPointerAcquire((PVOID*)&docTable);
+    LONG first = stream->next;
+    RenderBuffer b = { NULL, 0 };
+    while (stream->next < stream->end && b.len < READ_CHUNK_SIZE) {
+        RenderCatalog(&b, table, stream->next, stream->next + 1, stream->format);
+        stream->next++;
+    }
+
+    size_t len = b.len;
+    b.out = ReserveFragment(chunk, len);
+    if (b.out) {
+        b.len = 0;
+        RenderCatalog(&b, table, first, stream->next, stream->format);
+        AddSegment(chunk, b.out, len);
+    }
+    EpochExit();
+}
+
+static RenderedRead* NewRendered(size_t len, LONG64 version, uint32_t fieldCount) {
+    RenderedRead* rendered = (RenderedRead*)malloc(sizeof(RenderedRead) + len);
+    if (!rendered) return NULL;
+    rendered->refs = 1;
+    rendered->version = version;
+    rendered->fieldCount = fieldCount;
+    rendered->len = len;
+    Metrics()->readCacheBuilds++;
+    return rendered;
+}
+
+// The section's reply in the given format, with a reference for the caller.
+// Inside an epoch, which keeps body (and so its renderings) alive; NULL if
+// memory ran out. Readers racing to render the same body agree on one copy.
+static RenderedRead* SectionReply(const Document* doc, int i, SectionBody* body, ReadFormat format) {
+    RenderedRead* rendered = (RenderedRead*)ReadPointerAcquire((PVOID*)&body->rendered[format]);
+    if (rendered) {
+        Metrics()->readCacheHits++;
+        InterlockedIncrement(&rendered->refs);
+        return rendered;
+    }
+
+    RenderBuffer b = { NULL, 0 };
+    RenderSection(&b, doc, i, body, format);
+    RenderedRead* built = NewRendered(b.len, body->version, (uint32_t)body->lineCount);
+    if (!built) return NULL;
+    b.out = built->data;
+    b.len = 0;
+    RenderSection(&b, doc, i, body, format);
+
+    rendered = (RenderedRead*)InterlockedCompareExchangePointer((PVOID*)&body->rendered[format], built, NULL);
+    if (rendered) free(built);
+    else rendered = built;
+    InterlockedIncrement(&rendered->refs);
+    return rendered;
+}
+
+// The catalog's reply, with a reference for the caller, rebuilt once a create
+// has made the cached one stale. Inside an epoch: a replaced rendering is
+// retired, so one just read stays valid until the reference is taken. A
+// catalog too large to copy is not built: NULL, with the documents and bytes
+// to stream in *streamCount and *streamLen.
+static RenderedRead* CatalogReply(ReadFormat format, LONG* streamCount, size_t* streamLen) {
+    // Cache first: the count read after it is at least its version, so a
+    // rebuild never replaces a newer catalog with an older one
+    RenderedRead* cached = (RenderedRead*)ReadPointerAcquire((PVOID*)&catalogReplies[format]);
+    LONG count = ReadAcquire(&doc_count);
+    *streamLen = 0;
+    if (cached && cached->version == count) {
+        Metrics()->readCacheHits++;
+        InterlockedIncrement(&cached->refs);
+        return cached;
+    }
+
+    const DocTable* table = (const DocTable*)ReadPointerAcquire((PVOID*)&docTable);
+    RenderBuffer b = { NULL, 0 };
+    RenderCatalog(&b, table, 0, count, format);
+    if (b.len > READ_STREAM_THRESHOLD) {
+        *streamCount = count;
+        *streamLen = b.len;
+        return NULL;
+    }
+    RenderedRead* built = NewRendered(b.len, count, (uint32_t)count);
+    if (!built) return NULL;
+    b.out = built->data;
+    b.len = 0;
+    RenderCatalog(&b, table, 0, count, format);
+
+    // A reader that lost the race sends its own copy
+    if (InterlockedCompareExchangePointer((PVOID*)&catalogReplies[format], built, cached) == cached) {
+        InterlockedIncrement(&built->refs);
+        if (cached) EpochRetire(cached, ReleaseRendered);
+    }
+    return built;
+}
+
+// Bytes of a section's lines in a reply, as RenderSection lays them out
+static size_t SectionReplySize(const SectionBody* body, ReadFormat format) {
+    size_t text = body->textLen - (size_t)body->lineCount;
+    return text + (size_t)body->lineCount * (format == READ_BINARY ? 4 : 8);
+}
+
+// Send a rendering from where it is; the response keeps the reference
+static void AddRendered(Response* response, RenderedRead* rendered) {
+    response->hold = rendered;
+    AddSegment(response, rendered->data, rendered->len);
+}
+
+static const char* StatusMessage(DocsStatus status) {
+    switch (status) {
+    case DOCS_STATUS_EXISTS: return "Document already exists.";
+    case DOCS_STATUS_NO_DOCUMENT: return "Document not found.";
+    case DOCS_STATUS_NO_SECTION: return "Section not found.";
+    case DOCS_STATUS_NO_MEMORY: return "Out of memory.";
+    case DOCS_STATUS_UNKNOWN_OP: return "Unknown command.";
+    case DOCS_STATUS_NO_LINE: return "Line not found.";
+    default: return "Invalid request.";
+    }
+}
+
+// The operations below are shared by the text and binary protocols; the
+// callers check argument counts and render the result.
+
+typedef struct {
+    const char* title;
+    int sectionCount;
+    char** sectionTitles;
+} CreateRecord;
+
+static size_t CreateRecordSize(const CreateRecord* rec) {
+    size_t len = 1 + 4 + 4 + strlen(rec->title);
+    for (int i = 0; i < rec->sectionCount; i++) len += 4 + strlen(rec->sectionTitles[i]);
+    return len;
+}
+
+static unsigned char* PutTitle(unsigned char* out, const char* title) {
+    size_t len = strlen(title);
+    DocsPutU32(out, (uint32_t)len);
+    memcpy(out + 4, title, len);
+    return out + 4 + len;
+}
+
+static void FillCreateRecord(const void* ctx, unsigned char* out) {
+    const CreateRecord* rec = (const CreateRecord*)ctx;
+    *out++ = WAL_RECORD_CREATE;
+    DocsPutU32(out, (uint32_t)rec->sectionCount);
+    out = PutTitle(out + 4, rec->title);
+    for (int i = 0; i < rec->sectionCount; i++) out = PutTitle(out, rec->sectionTitles[i]);
+}
+
+// The create's record is durable (log thread)
+static void CreateDurable(void* arg) {
+    ClientContext* client = (ClientContext*)arg;
+    MetricsObserve(&Metrics()->walWait, MetricsNow() - client->commitAt);
+    PostWriteCompletion(client);
+}
+
+// With a write-ahead log the create is logged before the document becomes
+// visible, so no write to it can reach the log ahead of it. The client is
+// answered like a commit, by CompleteWrite once the record is durable: the
+// worker does not wait, and client->commitPending tells the caller the reply
+// is taken care of. Without a client (snapshot load, replay) nothing is
+// logged and the caller answers.
+static DocsStatus AddDocument(const char* title, int sectionCount, char* sectionTitles[],
+    ClientContext* client) {
+    DocsStatus status = DOCS_STATUS_OK;
+    AcquireSRWLockExclusive(&docsLock);
+    ULONGLONG start = MetricsNow();
+
+    if (FindDoc(title)) {
+        status = DOCS_STATUS_EXISTS;
+    }
+    else {
+        // Publication order matters to lock-free readers: the table slot
+        // first, then the title index, then the count the catalog walks
+        int idx = (int)doc_count;
+        ArenaMark mark = ArenaGetMark(&docArena);
+        Document* doc = CreateDocument(title, sectionCount, sectionTitles);
+        if (doc && WalEnabled() && client) {
+            // Retained first: the record can be durable before WalAppend returns
+            client->commitPending = TRUE;
+            client->createPending = TRUE;
+            client->writeStatus = DOCS_STATUS_OK;
+            client->commitAt = MetricsNow();
+            RetainClient(client);
+            CreateRecord rec = { title, sectionCount, sectionTitles };
+            if (WalAppend(CreateRecordSize(&rec), FillCreateRecord, &rec, CreateDurable, client) == 0) {
+                client->writeStatus = DOCS_STATUS_NO_MEMORY;
+                PostWriteCompletion(client);
+                NameIndexFree(&doc->sectionIndex);
+                doc = NULL;
+            }
+        }
+        if (doc) WritePointerRelease((PVOID*)&docTable->items[idx], doc);
+        if (!doc) {
+            // Never visible to anyone: its arena space goes back
+            ArenaRewind(&docArena, &mark);
+            status = DOCS_STATUS_NO_MEMORY;
+        }
+        else if (!NameIndexInsert(&docIndex, doc->title, idx)) {
+            // Reserved by CreateDocument, so not expected; the completion
+            // the client is waiting for must not report success either way.
+            // It runs under client->cs, which the caller holds.
+            status = DOCS_STATUS_NO_MEMORY;
+            if (client && client->createPending) client->writeStatus = DOCS_STATUS_NO_MEMORY;
+        }
+        else {
+            InterlockedIncrement(&doc_count);
+        }
+    }
+
+    MetricsObserve(&Metrics()->lockHold[METRIC_LOCK_DOCS], MetricsNow() - start);
+    ReleaseSRWLockExclusive(&docsLock);
+    return status;
+}
+
+// A combiner out of passes leaves the rest of the section to its worker's
+// next turn round the event loop
+static void DeferCommits(void* ctx) {
+    PostCommitDrain((Section*)ctx);
+}
+
+void DrainCommits(Section* section) {
+    CommitQueueDrain(&section->commits, ApplyBatch, DeferCommits, section);
+}
+
+// Resolve the target section and start staging lines for it. The lines will
+// replace remove lines from line (WriteNode); a full write is 0, -1.
+static DocsStatus BeginWrite(ClientContext* client, const char* docTitle, const char* sectionTitle,
+    int line, int remove) {
+    EpochEnter();
+    Document* doc = FindDoc(docTitle);
+    EpochExit();
+    if (!doc) return DOCS_STATUS_NO_DOCUMENT;
+
+    int section_idx = FindSection(doc, sectionTitle);
+    if (section_idx == -1) return DOCS_STATUS_NO_SECTION;
+
+    client->writeDoc = doc;
+    client->sectionIdx = section_idx;
+    client->writeLine = line;
+    client->writeRemove = remove;
+    client->lineCount = 0;
+    client->stagedLen = 0;
+    client->isWriteMode = TRUE;
+    client->writeAt = MetricsNow();
+    return DOCS_STATUS_OK;
+}
+
+// Queue the staged lines as one commit. It completes asynchronously: until
+// OP_WRITE_WAIT comes back (CompleteWrite) the client keeps a reference so it
+// cannot be freed under the queued node, and its input is held.
+static DocsStatus SubmitWrite(ClientContext* client) {
+    // Built before queueing so a full write's commit is a pointer swap
+    SectionBody* body = BuildSectionBody(client->stagedText, client->stagedLen, client->lineCount);
+    WriteNode* node = body ? AllocWriteNode() : NULL;
+    client->isWriteMode = FALSE;
+    client->stagedLen = 0;
+    if (!node) {
+        if (body) ReleaseSectionBody(body);
+        client->lineCount = 0;
+        return DOCS_STATUS_NO_MEMORY;
+    }
+
+    Section* section = &client->writeDoc->sections[client->sectionIdx];
+    client->commitPending = TRUE;
+    RetainClient(client);
+
+    node->client = client;
+    node->body = body;
+    node->line = client->writeLine;
+    node->remove = client->writeRemove;
+    node->status = DOCS_STATUS_OK;
+    node->estimatedLines = client->lineCount;
+    node->queuedAt = MetricsNow();
+    client->commitAt = node->queuedAt;
+    client->lineCount = 0;
+    InterlockedIncrement64(&section->queued);
+    CommitQueueSubmit(&section->commits, node, ApplyBatch, DeferCommits, section);
+    return DOCS_STATUS_OK;
+}
+
+void ProcessWriteLine(ClientContext* client, const char* line) {
+    LOG_TRACE("[Worker-%d] Processing write line: '%s'\n", GetCurrentThreadId(), line);
+
+    if (strcmp(line, "<END>") == 0) {
+        LOG_DEBUG("[Worker-%d] Write mode: END signal received, saving %d lines\n",
+            GetCurrentThreadId(), client->lineCount);
+
+        // Write 모드 종료
+        if (SubmitWrite(client) != DOCS_STATUS_OK) {
+            SendData(client, "[Error] Out of memory.\n", -1);
+        }
+    }
+    else {
+        // Store line
+        if (!StageLine(client, line, strlen(line))) {
+            SendData(client, "[Error] Out of memory.\n>> ", -1);
+            return;
+        }
+        LOG_TRACE("[Worker-%d] Write mode: stored line %d: '%s'\n",
+            GetCurrentThreadId(), client->lineCount, line);
+        SendData(client, ">> ", -1);
+    }
+}
+
+static BOOL IsEditCommand(const char* name) {
+    return strcmp(name, "append") == 0 || strcmp(name, "insert") == 0 ||
+        strcmp(name, "replace") == 0 || strcmp(name, "delete") == 0;
+}
+
+// append <doc> <section> [line]        lines added at the end
+// insert <doc> <section> <n> [line]    lines added before line n (n may be count + 1)
+// replace <doc> <section> <n> [line]   line n replaced by the lines
+// delete <doc> <section> <n>           line n removed
+// Given the line, the edit is committed at once; otherwise the lines follow
+// as for write, up to <END>. Line numbers count from 1.
+static void ProcessEdit(ClientContext* client) {
+    const char* name = client->args[0];
+    BOOL numbered = strcmp(name, "append") != 0;
+    BOOL remove = strcmp(name, "replace") == 0 || strcmp(name, "delete") == 0;
+    int target = numbered ? 4 : 3;      // arguments before the line
+    if (client->argc < target || client->argc > target + 1 ||
+        (strcmp(name, "delete") == 0 && client->argc != target)) {
+        char message[64];
+        snprintf(message, sizeof(message), "[Error] Invalid %s command.\n", name);
+        SendData(client, message, -1);
+        return;
+    }
+
+    int line = -1;
+    if (numbered) {
+        char* end;
+        long n = strtol(client->args[3], &end, 10);
+        if (*end != '\0' || n < 1 || n > INT_MAX) {
+            SendData(client, "[Error] Invalid line number.\n", -1);
+            return;
+        }
+        line = (int)n - 1;
+    }
+
+    DocsStatus status = BeginWrite(client, client->args[1], client->args[2], line, remove ? 1 : 0);
+    if (status == DOCS_STATUS_OK && client->argc == target && strcmp(name, "delete") != 0) {
+        SendData(client, "[OK] You can start writing. Send <END> to finish.\n>> ", -1);
+        return;
+    }
+
+    // Answered by CompleteWrite once the commit is published
+    if (status == DOCS_STATUS_OK && client->argc > target) {
+        const char* text = client->args[target];
+        if (!StageLine(client, text, strlen(text))) {
+            client->isWriteMode = FALSE;
+            client->stagedLen = 0;
+            client->lineCount = 0;
+            status = DOCS_STATUS_NO_MEMORY;
+        }
+    }
+    if (status == DOCS_STATUS_OK) status = SubmitWrite(client);
+    if (status != DOCS_STATUS_OK) {
+        char message[64];
+        snprintf(message, sizeof(message), "[Error] %s\n", StatusMessage(status));
+        SendData(client, message, -1);
+    }
+}
+
+void ProcessCommand(ClientContext* client) {
+    if (client->argc == 0) return;
+
+    LOG_DEBUG("[Server] Processing command: %s\n", client->args[0]);
+
+    if (strcmp(client->args[0], "create") == 0) {
+        if (client->argc < 3) {
+            SendData(client, "[Error] Invalid create command.\n", -1);
+            return;
+        }
+
+        int section_count = atoi(client->args[2]);
+        if (section_count <= 0 || client->argc != 3 + section_count) {
+            SendData(client, "[Error] Invalid section count or titles.\n", -1);
+            return;
+        }
+
+        DocsStatus status = AddDocument(client->args[1], section_count, client->args + 3, client);
+        if (client->commitPending) return;      // answered by CompleteWrite
+        if (status != DOCS_STATUS_OK) {
+            char message[64];
+            snprintf(message, sizeof(message), "[Error] %s\n", StatusMessage(status));
+            SendData(client, message, -1);
+            return;
+        }
+
+        SendData(client, "[OK] Document created.\n", -1);
+    }
+    else if (strcmp(client->args[0], "write") == 0) {
+        if (client->argc < 3) {
+            SendData(client, "[Error] Invalid write command.\n", -1);
+            return;
+        }
+
+        DocsStatus status = BeginWrite(client, client->args[1], client->args[2], 0, -1);
+        if (status != DOCS_STATUS_OK) {
+            char message[64];
+            snprintf(message, sizeof(message), "[Error] %s\n", StatusMessage(status));
+            SendData(client, message, -1);
+            return;
+        }
+
+        LOG_DEBUG("[Server] Write mode enabled for client, doc=%s, section=%d\n",
+            client->writeDoc->title, client->sectionIdx);
+
+        SendData(client, "[OK] You can start writing. Send <END> to finish.\n>> ", -1);
+        // Don't post new WSARecv here - the existing OP_RECV will handle it
+    }
+    else if (IsEditCommand(client->args[0])) {
+        ProcessEdit(client);
+    }
+    else if (strcmp(client->args[0], "read") == 0) {
+        Response* response = NewResponse();
+        if (!response) {
+            SendData(client, "[Error] Out of memory.\n__END__\n", -1);
+            return;
+        }
+
+        // Everything read here is a published snapshot; writers are never waited on
+        EpochEnter();
+
+        Response* stream = NULL;
+        if (client->argc == 1) {
+            LONG count;
+            size_t len;
+            RenderedRead* rendered = CatalogReply(READ_TEXT, &count, &len);
+            if (rendered) AddRendered(response, rendered);
+            else if (len) stream = NewStream(READ_TEXT, NULL, count);
+            if (!rendered && !stream) response->failed = TRUE;
+        }
+        else if (client->argc >= 3) {
+            Document* doc = FindDoc(client->args[1]);
+            if (!doc) {
+                EpochExit();
+                FreeResponse(response);
+                SendData(client, "[Error] Document not found.\n__END__\n", -1);
+                return;
+            }
+
+            int i = FindSection(doc, client->args[2]);
+            if (i >= 0) {
+                Section* section = &doc->sections[i];
+                SectionBody* body = CurrentBody(section);
+                if (body && SectionReplySize(body, READ_TEXT) > READ_STREAM_THRESHOLD) {
+                    // Too large to copy: the heading now, the lines a send at a time
+                    AddFormat(response, "%s\n    %d. %s\n", doc->title, i + 1, section->title);
+                    stream = NewStream(READ_TEXT, body, 0);
+                    if (!stream) response->failed = TRUE;
+                }
+                else if (body) {
+                    RenderedRead* rendered = SectionReply(doc, i, body, READ_TEXT);
+                    if (rendered) AddRendered(response, rendered);
+                    else response->failed = TRUE;
+                }
+                else {
+                    AddFormat(response, "%s\n    %d. %s\n", doc->title, i + 1, section->title);
+                }
+            }
+            else {
+                AddText(response, "[Error] Section not found.\n");
+            }
+        }
+
+        EpochExit();
+
+        if (stream) {
+            if (response->failed) {
+                FreeResponse(stream);
+                FreeResponse(response);
+                SendData(client, "[Error] Out of memory.\n__END__\n", -1);
+                return;
+            }
+            // A streamed catalog has nothing ahead of it, and an empty
+            // response would go out as a send with no buffers
+            if (response->count > 0) QueueResponse(client, response);
+            else FreeResponse(response);
+            QueueResponse(client, stream);
+            SendData(client, "__END__\n", -1);
+            return;
+        }
+        AddText(response, "__END__\n");
+        if (response->failed) {
+            FreeResponse(response);
+            SendData(client, "[Error] Out of memory.\n__END__\n", -1);
+            return;
+        }
+        QueueResponse(client, response);
+    }
+    else if (strcmp(client->args[0], "stats") == 0) {
+        // Terminated like a read, so clients can reuse their read loop
+        MetricsText text = { 0 };
+        MetricsRenderSummary(&text);
+        MetricsAppend(&text, "__END__\n");
+        if (text.failed || !SendData(client, text.data, (int)text.len)) {
+            SendData(client, "[Error] Out of memory.\n__END__\n", -1);
+        }
+        MetricsTextFree(&text);
+    }
+    else if (strcmp(client->args[0], "bye") == 0) {
+        SendData(client, "[Disconnected]\n", -1);
+        // 소켓 종료는 SendData 완료 후 처리 (SendCompleted)
+        client->disconnectAfterSend = TRUE;
+    }
+    else {
+        SendData(client, "[Error] Unknown command.\n", -1);
+    }
+}
+
+// Write-ahead log replay, before any worker runs
+
+// Next title of a record, bounds-checked; NULL if it runs past the end
+static char* TakeTitle(const unsigned char** p, const unsigned char* end) {
+    if (end - *p < 4 || DocsGetU32(*p) > (size_t)(end - *p) - 4) return NULL;
+    size_t len = DocsGetU32(*p);
+    char* title = (char*)malloc(len + 1);
+    if (!title) return NULL;
+    memcpy(title, *p + 4, len);
+    title[len] = '\0';
+    *p += 4 + len;
+    return title;
+}
+
+static BOOL ReplayCreate(const unsigned char* p, const unsigned char* end) {
+    if (end - p < 4) return FALSE;
+    int sectionCount = (int)DocsGetU32(p);
+    p += 4;
+    if (sectionCount <= 0 || (size_t)sectionCount > (size_t)(end - p) / 4) return FALSE;
+
+    char* title = TakeTitle(&p, end);
+    char** sectionTitles = (char**)calloc(sectionCount, sizeof(char*));
+    BOOL ok = title && sectionTitles;
+    for (int i = 0; ok && i < sectionCount; i++) ok = (sectionTitles[i] = TakeTitle(&p, end)) != NULL;
+    if (ok && p == end && AddDocument(title, sectionCount, sectionTitles, NULL) == DOCS_STATUS_NO_MEMORY) {
+        LOG_ERROR("[ERROR] Out of memory replaying document %s\n", title);
+    }
+    ok = ok && p == end;
+
+    for (int i = 0; sectionTitles && i < sectionCount; i++) free(sectionTitles[i]);
+    free(sectionTitles);
+    free(title);
+    return ok;
+}
+
+// The section a write or edit record names and the version it produced;
+// NULL if the record is malformed
+static Section* TakeSection(const unsigned char** p, const unsigned char* end, LONG64* version) {
+    char* title = TakeTitle(p, end);
+    if (!title) return NULL;
+    EpochEnter();
+    Document* doc = FindDoc(title);
+    EpochExit();
+    free(title);
+    if (end - *p < 12) return NULL;
+
+    uint32_t sectionIdx = DocsGetU32(*p);
+    *version = (LONG64)((ULONGLONG)DocsGetU32(*p + 8) << 32 | DocsGetU32(*p + 4));
+    *p += 12;
+    if (!doc || sectionIdx >= (uint32_t)doc->section_count) return NULL;
+    return &doc->sections[sectionIdx];
+}
+
+// Check the framing of count logged lines and step past them
+static BOOL SkipLines(const unsigned char** p, const unsigned char* end, int count) {
+    if (count < 0) return FALSE;
+    for (int i = 0; i < count; i++) {
+        if (end - *p < 4 || DocsGetU32(*p) >= (size_t)(end - *p) - 4) return FALSE;
+        *p += 4 + DocsGetU32(*p) + 1;
+    }
+    return TRUE;
+}
+
+// Nothing reads the store yet, so the old body goes straight away
+static void ReplacePublished(Section* section, SectionBody* old, SectionBody* body, LONG64 version) {
+    body->version = version;
+    WritePointerRelease((PVOID*)&section->body, body);
+    if (old) ReleaseSectionBody(old);
+}
+
+static BOOL ReplayWrite(const unsigned char* p, const unsigned char* end) {
+    LONG64 version;
+    Section* section = TakeSection(&p, end, &version);
+    if (!section || end - p < 4) return FALSE;
+    int lineCount = (int)DocsGetU32(p);
+    p += 4;
+
+    // Check the lines' framing before building the body from them
+    const unsigned char* lines = p;
+    if (!SkipLines(&p, end, lineCount) || p != end) return FALSE;
+
+    // Records older than the snapshot may still be in the log (a crash
+    // between saving a snapshot and compacting the log); they are skipped
+    SectionBody* old = CurrentBody(section);
+    if (old && old->version >= version) return TRUE;
+
+    SectionBody* body = BuildSectionBody((const char*)lines, (size_t)(end - lines), lineCount);
+    if (!body) {
+        LOG_ERROR("[ERROR] Out of memory replaying a write to %s\n", section->doc->title);
+        return TRUE;
+    }
+    ReplacePublished(section, old, body, version);
+    return TRUE;
+}
+
+// The edits of one batch, applied as ApplyBatch did, on top of the version
+// they were applied to
+static BOOL ReplayEdit(const unsigned char* p, const unsigned char* end) {
+    LONG64 version;
+    Section* section = TakeSection(&p, end, &version);
+    if (!section || end - p < 4) return FALSE;
+    int count = (int)DocsGetU32(p);
+    p += 4;
+
+    SectionBody* old = CurrentBody(section);
+    LONG64 current = old ? old->version : 0;
+    if (current >= version) return TRUE;
+    if (count <= 0 || current != version - count) return FALSE;
+
+    SectionBody* body = old;
+    int applied = 0;
+    while (applied < count && end - p >= 12) {
+        WriteNode node;
+        ZeroMemory(&node, sizeof(node));
+        node.line = (int)DocsGetU32(p);
+        node.remove = (int)DocsGetU32(p + 4);
+        int lineCount = (int)DocsGetU32(p + 8);
+        const unsigned char* lines = p + 12;
+        p = lines;
+        if (node.remove < 0 || !SkipLines(&p, end, lineCount)) break;
+
+        node.body = BuildSectionBody((const char*)lines, (size_t)(p - lines), lineCount);
+        SectionBody* next = node.body ? ApplyWrite(body, &node) : NULL;
+        if (node.body) ReleaseSectionBody(node.body);
+        if (!next) break;
+        if (body != old) ReleaseSectionBody(body);
+        body = next;
+        applied++;
+    }
+    if (applied < count || p != end) {
+        if (body != old) ReleaseSectionBody(body);
+        return FALSE;
+    }
+    ReplacePublished(section, old, body, version);
+    return TRUE;
+}
+
+static void ReplayRecord(const unsigned char* payload, size_t len) {
+    const unsigned char* end = payload + len;
+    BOOL ok = FALSE;
+    if (len > 0 && payload[0] == WAL_RECORD_CREATE) ok = ReplayCreate(payload + 1, end);
+    else if (len > 0 && payload[0] == WAL_RECORD_WRITE) ok = ReplayWrite(payload + 1, end);
+    else if (len > 0 && payload[0] == WAL_RECORD_EDIT) ok = ReplayEdit(payload + 1, end);
+    if (!ok) LOG_WARN("[Server] Skipping malformed write-ahead log record (%u bytes)\n", (unsigned)len);
+}
+
+// Snapshots (snapshot.h)
+
+// Register every document in the snapshot; contents stay in the mapping
+static void LoadSnapshot(void) {
+    ULONGLONG start = MetricsNow();
+    if (!SnapshotOpen(snapshotPath)) return;
+
+    int count;
+    const SnapshotDocument* docs = SnapshotDocuments(&count);
+    char** titles = NULL;
+    uint32_t titlesCap = 0;
+    for (int i = 0; i < count; i++) {
+        const SnapshotDocument* entry = &docs[i];
+        const SnapshotSection* sections = SnapshotSections(entry);
+        if (entry->sectionCount > titlesCap) {
+            char** grown = (char**)realloc(titles, sizeof(char*) * entry->sectionCount);
+            if (!grown) break;
+            titles = grown;
+            titlesCap = entry->sectionCount;
+        }
+        for (uint32_t j = 0; j < entry->sectionCount; j++) {
+            titles[j] = (char*)SnapshotString(sections[j].titleOffset);
+        }
+
+        const char* title = SnapshotString(entry->titleOffset);
+        if (AddDocument(title, (int)entry->sectionCount, titles, NULL) != DOCS_STATUS_OK) {
+            LOG_ERROR("[ERROR] Cannot load document %s from the snapshot\n", title);
+            continue;
+        }
+        EpochEnter();
+        Document* doc = FindDoc(title);
+        EpochExit();
+        for (int j = 0; j < doc->section_count; j++) doc->sections[j].stored = &sections[j];
+    }
+    free(titles);
+
+    LOG_INFO("[Server] Snapshot %s: %d documents mapped in %llu ms\n", SnapshotMappedPath(), (int)doc_count,
+        (unsigned long long)(MetricsNow() - start) / 1000);
+}
+
+// Snapshot thread. Bodies are immutable, so the store is walked while
+// writers carry on; a section written meanwhile is saved at whichever
+// version was published when it was reached. Every commit not in the
+// snapshot is logged after lsn (a combiner publishes before it logs), and
+// replay skips the ones that are, so the log before lsn can go.
+static void TakeSnapshot(void) {
+    // Creates are logged under docsLock, so lsn and count agree
+    AcquireSRWLockShared(&docsLock);
+    ULONGLONG lsn = WalPosition();
+    LONG count = doc_count;
+    ReleaseSRWLockShared(&docsLock);
+    if (lsn == snapshotLsn) return;     // nothing logged since the last one
+
+    ULONGLONG start = MetricsNow();
+    SnapshotWriter* writer = SnapshotBegin(snapshotPath, lsn);
+    if (!writer) return;
+    for (LONG i = 0; i < count; i++) {
+        EpochEnter();
+        Document* doc = ((DocTable*)ReadPointerAcquire((PVOID*)&docTable))->items[i];
+        EpochExit();
+
+        SnapshotAddDocument(writer, doc->title, doc->section_count);
+        for (int j = 0; j < doc->section_count; j++) {
+            // Same reference rule as a read
+            EpochEnter();
+            SectionBody* body = CurrentBody(&doc->sections[j]);
+            if (body) InterlockedIncrement(&body->refs);
+            EpochExit();
+            SnapshotAddSection(writer, doc->sections[j].title, body);
+            if (body) ReleaseSectionBody(body);
+        }
+    }
+    ULONGLONG size = SnapshotCommit(writer);
+    if (size == 0) return;
+
+    snapshotLsn = lsn;
+    LOG_INFO("[Server] Snapshot: %d documents, %llu bytes in %llu ms\n", (int)count,
+        (unsigned long long)size, (unsigned long long)(MetricsNow() - start) / 1000);
+    WalWait(lsn);
+    WalCompact(lsn);
+}
+
+// Metrics
+
+static MetricCommand CommandKind(const ClientContext* client) {
+    if (client->argc == 0) return METRIC_CMD_OTHER;
+    if (strcmp(client->args[0], "create") == 0) return METRIC_CMD_CREATE;
+    if (strcmp(client->args[0], "write") == 0) return METRIC_CMD_WRITE;
+    if (strcmp(client->args[0], "read") == 0) return METRIC_CMD_READ;
+    if (strcmp(client->args[0], "bye") == 0) return METRIC_CMD_BYE;
+    if (strcmp(client->args[0], "stats") == 0) return METRIC_CMD_STATS;
+    if (IsEditCommand(client->args[0])) return METRIC_CMD_EDIT;
+    return METRIC_CMD_OTHER;
+}
+
+static MetricCommand FrameKind(uint8_t opcode) {
+    switch (opcode) {
+    case DOCS_OP_CREATE: return METRIC_CMD_CREATE;
+    case DOCS_OP_WRITE: return METRIC_CMD_WRITE;
+    case DOCS_OP_READ: return METRIC_CMD_READ;
+    case DOCS_OP_BYE: return METRIC_CMD_BYE;
+    case DOCS_OP_STATS: return METRIC_CMD_STATS;
+    case DOCS_OP_APPEND:
+    case DOCS_OP_INSERT:
+    case DOCS_OP_REPLACE:
+    case DOCS_OP_DELETE: return METRIC_CMD_EDIT;
+    default: return METRIC_CMD_OTHER;
+    }
+}
+
+static void RecordCommand(MetricCommand kind, ULONGLONG start) {
+    MetricsRecord* metrics = Metrics();
+    metrics->commands[kind]++;
+    MetricsObserve(&metrics->commandTime[kind], MetricsNow() - start);
+}
+
+typedef struct {
+    const Document* doc;
+    const Section* section;
+    LONG64 committed;
+    LONG64 depth;
+    LONG64 waitMicros;
+    LONG64 maxWaitMicros;
+} HotSection;
+
+// The sections with the most total commit wait, and the write queue depth
+// over all sections. Counters are read without locking, so a section may be
+// a write behind; titles live in the arena and stay valid after the epoch.
+static void ReportSections(MetricsText* out, BOOL prometheus) {
+    HotSection hot[METRICS_HOT_SECTIONS];
+    int hotCount = 0;
+    LONG64 depth = 0;
+
+    EpochEnter();
+    LONG count = ReadAcquire(&doc_count);
+    DocTable* table = (DocTable*)ReadPointerAcquire((PVOID*)&docTable);
+    for (int i = 0; i < count; i++) {
+        const Document* doc = table->items[i];
+        for (int j = 0; j < doc->section_count; j++) {
+            const Section* section = &doc->sections[j];
+            HotSection entry;
+            entry.doc = doc;
+            entry.section = section;
+            entry.committed = section->committed;       // before queued, so depth >= 0
+            entry.depth = ReadAcquire64(&section->queued) - entry.committed;
+            entry.waitMicros = section->waitMicros;
+            entry.maxWaitMicros = section->maxWaitMicros;
+            if (entry.depth < 0) entry.depth = 0;
+            depth += entry.depth;
+            if (entry.committed == 0 && entry.depth == 0) continue;
+
+            // Insert into the list, kept sorted by total wait
+            if (hotCount == METRICS_HOT_SECTIONS && entry.waitMicros <= hot[hotCount - 1].waitMicros) continue;
+            int k = hotCount < METRICS_HOT_SECTIONS ? hotCount++ : hotCount - 1;
+            while (k > 0 && hot[k - 1].waitMicros < entry.waitMicros) {
+                hot[k] = hot[k - 1];
+                k--;
+            }
+            hot[k] = entry;
+        }
+    }
+    EpochExit();
+
+    if (!prometheus) {
+        MetricsAppend(out, "documents: %d, writes queued: %lld\n", (int)count, (long long)depth);
+        MetricsAppend(out, "hot sections (by total commit wait):\n");
+        for (int i = 0; i < hotCount; i++) {
+            MetricsAppend(out, "  %s / %s: %lld commits, depth %lld, wait avg %.1f us, max %lld us\n",
+                hot[i].doc->title, hot[i].section->title, (long long)hot[i].committed,
+                (long long)hot[i].depth,
+                hot[i].committed ? (double)hot[i].waitMicros / hot[i].committed : 0.0,
+                (long long)hot[i].maxWaitMicros);
+        }
+        return;
+    }
+
+    MetricsAppend(out, "# HELP docs_documents Documents in the store.\n# TYPE docs_documents gauge\n");
+    MetricsAppend(out, "docs_documents %d\n", (int)count);
+    MetricsAppend(out, "# HELP docs_write_queue_depth Writes queued and not yet published, all sections.\n"
+        "# TYPE docs_write_queue_depth gauge\n");
+    MetricsAppend(out, "docs_write_queue_depth %lld\n", (long long)depth);
+
+    static const char* series[] = {
+        "docs_section_commits_total", "docs_section_queue_depth",
+        "docs_section_commit_wait_seconds_total", "docs_section_commit_wait_max_seconds"
+    };
+    static const char* types[] = { "counter", "gauge", "counter", "gauge" };
+    for (int s = 0; s < 4; s++) {
+        MetricsAppend(out, "# HELP %s Per section, for the %d sections with the most commit wait.\n"
+            "# TYPE %s %s\n", series[s], METRICS_HOT_SECTIONS, series[s], types[s]);
+        for (int i = 0; i < hotCount; i++) {
+            MetricsAppend(out, "%s{document=", series[s]);
+            MetricsAppendLabel(out, hot[i].doc->title);
+            MetricsAppend(out, ",section=");
+            MetricsAppendLabel(out, hot[i].section->title);
+            switch (s) {
+            case 0: MetricsAppend(out, "} %lld\n", (long long)hot[i].committed); break;
+            case 1: MetricsAppend(out, "} %lld\n", (long long)hot[i].depth); break;
+            case 2: MetricsAppend(out, "} %.6f\n", hot[i].waitMicros / 1e6); break;
+            default: MetricsAppend(out, "} %.6f\n", hot[i].maxWaitMicros / 1e6); break;
+            }
+        }
+    }
+}
+
+// Binary protocol (docs_protocol.h)
+
+typedef struct {
+    Response* response;
+    unsigned char* header;          // filled in by EndFrame
+    DocsFrameHeader info;
+} FrameWriter;
+
+static void BeginFrame(FrameWriter* frame, Response* response, DocsOpcode opcode,
+    DocsStatus status, DWORD requestId) {
+    frame->response = response;
+    frame->header = (unsigned char*)ReserveFragment(response, DOCS_FRAME_HEADER_SIZE);
+    if (frame->header) AddSegment(response, (const char*)frame->header, DOCS_FRAME_HEADER_SIZE);
+    frame->info.opcode = (uint8_t)opcode;
+    frame->info.status = (uint8_t)status;
+    frame->info.fieldCount = 0;
+    frame->info.length = 0;
+    frame->info.requestId = requestId;
+}
+
+// Length prefix of the next field; its bytes are added as segments after it
+static void AddFieldHeader(FrameWriter* frame, size_t len) {
+    unsigned char* out = (unsigned char*)ReserveFragment(frame->response, 4);
+    if (!out) return;
+    DocsPutU32(out, (uint32_t)len);
+    AddSegment(frame->response, (const char*)out, 4);
+    frame->info.fieldCount++;
+    frame->info.length += 4 + (uint32_t)len;
+}
+
+static void EndFrame(FrameWriter* frame) {
+    if (frame->header) DocsEncodeHeader(frame->header, &frame->info);
+}
+
+// A response without fields, or with the status message as its one field
+static BOOL SendStatusFrame(ClientContext* client, DocsOpcode opcode, DocsStatus status, DWORD requestId) {
+    Response* response = NewResponse();
+    if (!response) return FALSE;
+
+    FrameWriter frame;
+    BeginFrame(&frame, response, opcode, status, requestId);
+    if (status != DOCS_STATUS_OK) {
+        const char* message = StatusMessage(status);
+        AddFieldHeader(&frame, strlen(message));
+        AddText(response, message);
+    }
+    EndFrame(&frame);
+
+    if (response->failed) {
+        FreeResponse(response);
+        return FALSE;
+    }
+    QueueResponse(client, response);
+    return TRUE;
+}
+
+// Next field of a payload whose layout RunFrame has already checked
+static const char* NextField(const unsigned char** p, size_t* len) {
+    *len = DocsGetU32(*p);
+    const char* field = (const char*)*p + 4;
+    *p += 4 + *len;
+    return field;
+}
+
+// Titles are compared as C strings; copy one out with its terminator
+static BOOL CopyTitle(const unsigned char** p, char* out) {
+    size_t len;
+    const char* field = NextField(p, &len);
+    if (len >= BUF_SIZE) return FALSE;
+    memcpy(out, field, len);
+    out[len] = '\0';
+    return TRUE;
+}
+
+static DocsStatus FrameCreate(ClientContext* client, const DocsFrameHeader* header, const unsigned char* p) {
+    if (header->fieldCount < 2) return DOCS_STATUS_INVALID;
+
+    // The titles as C strings in one block, behind their pointer table
+    int sectionCount = (int)header->fieldCount - 1;
+    char** titles = (char**)malloc(sizeof(char*) * header->fieldCount + header->length);
+    if (!titles) return DOCS_STATUS_NO_MEMORY;
+
+    char* text = (char*)(titles + header->fieldCount);
+    for (uint32_t i = 0; i < header->fieldCount; i++) {
+        size_t len;
+        const char* field = NextField(&p, &len);
+        memcpy(text, field, len);
+        text[len] = '\0';
+        titles[i] = text;
+        text += len + 1;
+    }
+
+    // Answered by CompleteWrite once the create is durable, if it was logged
+    client->writeOpcode = header->opcode;
+    client->writeRequestId = header->requestId;
+    DocsStatus status = AddDocument(titles[0], sectionCount, titles + 1, client);
+    free(titles);
+    return status;
+}
+
+// WRITE and the edits: the target, the line number for the numbered edits,
+// then the lines
+static DocsStatus FrameWrite(ClientContext* client, const DocsFrameHeader* header, const unsigned char* p) {
+    char docTitle[BUF_SIZE], sectionTitle[BUF_SIZE];
+    BOOL numbered = header->opcode != DOCS_OP_WRITE && header->opcode != DOCS_OP_APPEND;
+    uint32_t first = numbered ? 3 : 2;      // fields before the lines
+    if (header->fieldCount < first || (header->opcode == DOCS_OP_DELETE && header->fieldCount != first) ||
+        !CopyTitle(&p, docTitle) || !CopyTitle(&p, sectionTitle)) {
+        return DOCS_STATUS_INVALID;
+    }
+
+    int line = 0, remove = -1;              // WRITE replaces the whole section
+    if (header->opcode == DOCS_OP_APPEND) {
+        line = -1;
+        remove = 0;
+    }
+    else if (numbered) {
+        size_t len;
+        const unsigned char* field = (const unsigned char*)NextField(&p, &len);
+        uint32_t n = len == 4 ? DocsGetU32(field) : 0;
+        if (n == 0 || n > INT_MAX) return DOCS_STATUS_INVALID;
+        line = (int)n - 1;
+        remove = header->opcode == DOCS_OP_INSERT ? 0 : 1;
+    }
+
+    DocsStatus status = BeginWrite(client, docTitle, sectionTitle, line, remove);
+    if (status != DOCS_STATUS_OK) return status;
+
+    for (uint32_t i = first; i < header->fieldCount; i++) {
+        size_t len;
+        const char* text = NextField(&p, &len);
+        if (!StageLine(client, text, len)) {
+            client->isWriteMode = FALSE;
+            client->stagedLen = 0;
+            client->lineCount = 0;
+            return DOCS_STATUS_NO_MEMORY;
+        }
+    }
+
+    // Answered by CompleteWrite once the commit is published
+    client->writeOpcode = header->opcode;
+    client->writeRequestId = header->requestId;
+    return SubmitWrite(client);
+}
+
+static DocsStatus FrameRead(ClientContext* client, const DocsFrameHeader* header, const unsigned char* p) {
+    char docTitle[BUF_SIZE], sectionTitle[BUF_SIZE];
+    if (header->fieldCount == 2) {
+        if (!CopyTitle(&p, docTitle) || !CopyTitle(&p, sectionTitle)) return DOCS_STATUS_INVALID;
+    }
+    else if (header->fieldCount != 0) {
+        return DOCS_STATUS_INVALID;
+    }
+
+    Response* response = NewResponse();
+    if (!response) return DOCS_STATUS_NO_MEMORY;
+
+    FrameWriter frame;
+    BeginFrame(&frame, response, DOCS_OP_READ, DOCS_STATUS_OK, header->requestId);
+    EpochEnter();
+
+    RenderedRead* rendered = NULL;
+    Response* stream = NULL;
+    if (header->fieldCount == 0) {
+        LONG count;
+        size_t len;
+        rendered = CatalogReply(READ_BINARY, &count, &len);
+        if (!rendered && len) {
+            stream = NewStream(READ_BINARY, NULL, count);
+            frame.info.fieldCount = (uint32_t)count;
+            frame.info.length = (uint32_t)len;
+        }
+        if (!rendered && !stream) response->failed = TRUE;
+    }
+    else {
+        Document* doc = FindDoc(docTitle);
+        int i = doc ? FindSection(doc, sectionTitle) : -1;
+        if (i < 0) {
+            EpochExit();
+            FreeResponse(response);
+            return doc ? DOCS_STATUS_NO_SECTION : DOCS_STATUS_NO_DOCUMENT;
+        }
+
+        SectionBody* body = CurrentBody(&doc->sections[i]);
+        if (body && SectionReplySize(body, READ_BINARY) > READ_STREAM_THRESHOLD) {
+            stream = NewStream(READ_BINARY, body, 0);
+            frame.info.fieldCount = (uint32_t)body->lineCount;
+            frame.info.length = (uint32_t)SectionReplySize(body, READ_BINARY);
+            if (!stream) response->failed = TRUE;
+        }
+        else if (body) {
+            rendered = SectionReply(doc, i, body, READ_BINARY);
+            if (!rendered) response->failed = TRUE;
+        }
+    }
+
+    EpochExit();
+    if (rendered) {
+        AddRendered(response, rendered);
+        frame.info.fieldCount = rendered->fieldCount;
+        frame.info.length = (uint32_t)rendered->len;
+    }
+    EndFrame(&frame);
+
+    if (response->failed) {
+        FreeResponse(stream);
+        FreeResponse(response);
+        return DOCS_STATUS_NO_MEMORY;
+    }
+    QueueResponse(client, response);
+    if (stream) QueueResponse(client, stream);
+    return DOCS_STATUS_OK;
+}
+
+static DocsStatus FrameStats(ClientContext* client, const DocsFrameHeader* header) {
+    if (header->fieldCount != 0) return DOCS_STATUS_INVALID;
+
+    MetricsText text = { 0 };
+    MetricsRenderSummary(&text);
+    Response* response = text.failed ? NULL : NewResponse();
+    if (!response) {
+        MetricsTextFree(&text);
+        return DOCS_STATUS_NO_MEMORY;
+    }
+
+    FrameWriter frame;
+    BeginFrame(&frame, response, DOCS_OP_STATS, DOCS_STATUS_OK, header->requestId);
+    AddFieldHeader(&frame, text.len);
+    AddCopy(response, text.data, text.len);
+    EndFrame(&frame);
+    MetricsTextFree(&text);
+
+    if (response->failed) {
+        FreeResponse(response);
+        return DOCS_STATUS_NO_MEMORY;
+    }
+    QueueResponse(client, response);
+    return DOCS_STATUS_OK;
+}
+
+// Run one complete frame. The payload is walked once up front, so the
+// handlers can take fields without bounds checks.
+static void RunFrame(ClientContext* client, const DocsFrameHeader* header, const unsigned char* payload) {
+    const unsigned char* p = payload;
+    const unsigned char* end = payload + header->length;
+    uint32_t fields = 0;
+    while (fields < header->fieldCount && end - p >= 4 && DocsGetU32(p) <= (size_t)(end - p) - 4) {
+        p += 4 + DocsGetU32(p);
+        fields++;
+    }
+
+    DocsStatus status;
+    if (fields != header->fieldCount || p != end) {
+        status = DOCS_STATUS_INVALID;
+    }
+    else {
+        switch (header->opcode) {
+        case DOCS_OP_CREATE:
+            status = FrameCreate(client, header, payload);
+            if (client->commitPending) return;
+            break;
+        case DOCS_OP_WRITE:
+        case DOCS_OP_APPEND:
+        case DOCS_OP_INSERT:
+        case DOCS_OP_REPLACE:
+        case DOCS_OP_DELETE:
+            status = FrameWrite(client, header, payload);
+            if (status == DOCS_STATUS_OK) return;
+            break;
+        case DOCS_OP_READ:
+            status = FrameRead(client, header, payload);
+            if (status == DOCS_STATUS_OK) return;
+            break;
+        case DOCS_OP_STATS:
+            status = FrameStats(client, header);
+            if (status == DOCS_STATUS_OK) return;
+            break;
+        case DOCS_OP_BYE:
+            status = DOCS_STATUS_OK;
+            client->disconnectAfterSend = TRUE;
+            break;
+        default:
+            status = DOCS_STATUS_UNKNOWN_OP;
+            break;
+        }
+    }
+
+    if (status != DOCS_STATUS_OK) {
+        LOG_DEBUG("[Worker-%d] Frame %u (opcode %d) failed: %s\n", GetCurrentThreadId(),
+            header->requestId, header->opcode, StatusMessage(status));
+    }
+    SendStatusFrame(client, (DocsOpcode)header->opcode, status, header->requestId);
+}
+
+// Flow control: stop running input (and have the backend stop reading) while
+// the client's output is over its limits
+static void PauseInput(ClientContext* client) {
+    if (client->inputPaused) return;
+    client->inputPaused = TRUE;
+    client->progressAt = MetricsNow();
+    MetricsRecord* metrics = Metrics();
+    metrics->inputPauses++;
+    metrics->pausedClients++;
+    LOG_DEBUG("[Worker-%d] Pausing client %p: %zu bytes in %d responses queued\n",
+        GetCurrentThreadId(), (void*)client, client->outBytes, client->outCount);
+}
+
+static BOOL PauseIfFull(ClientContext* client) {
+    if (client->outBytes < flowMaxOutput && client->outCount < flowMaxQueued) return FALSE;
+    PauseInput(client);
+    return TRUE;
+}
+
+// Run every complete frame in data in order, gathering a frame that spans
+// receives in client->frame. Same contract as ParseText.
+static DWORD ParseFrames(ClientContext* client, const char* data, DWORD len) {
+    DWORD used = 0;
+    for (;;) {
+        if (client->disconnectAfterSend) return len;
+        if (client->commitPending || PauseIfFull(client)) return used;
+
+        // Frames that arrived whole are run straight from the receive buffer
+        BOOL gathered = client->frameLen > 0;
+        const unsigned char* frame = gathered ? (const unsigned char*)client->frame
+            : (const unsigned char*)data + used;
+        size_t have = gathered ? client->frameLen : len - used;
+        size_t need = DOCS_FRAME_HEADER_SIZE;
+
+        DocsFrameHeader header;
+        if (have >= need) {
+            DocsDecodeHeader(frame, &header);
+            if (header.length > DOCS_MAX_FRAME_SIZE) {
+                LOG_WARN("[Worker-%d] Frame of %u bytes exceeds the limit, disconnecting\n",
+                    GetCurrentThreadId(), header.length);
+                SendStatusFrame(client, (DocsOpcode)header.opcode, DOCS_STATUS_INVALID, header.requestId);
+                client->disconnectAfterSend = TRUE;
+                return len;
+            }
+            need += header.length;
+        }
+
+        if (have >= need) {
+            ULONGLONG start = MetricsNow();
+            RunFrame(client, &header, frame + DOCS_FRAME_HEADER_SIZE);
+            RecordCommand(FrameKind(header.opcode), start);
+            if (!gathered) {
+                used += (DWORD)need;
+            }
+            else {
+                client->frameLen = 0;
+                if (client->frameCap > RESPONSE_CHUNK_SIZE * 64) {
+                    // Do not keep a large frame's buffer around
+                    free(client->frame);
+                    client->frame = NULL;
+                    client->frameCap = 0;
+                }
+            }
+            continue;
+        }
+        if (used == len) return len;
+
+        // Partial frame: take what belongs to it (the header first, so the
+        // payload size is known before it is copied)
+        size_t take = need - client->frameLen;
+        if (take > len - used) take = len - used;
+        if (client->frameLen + take > client->frameCap) {
+            size_t cap = client->frameCap ? client->frameCap : BUF_SIZE;
+            while (cap < client->frameLen + take) cap *= 2;
+            char* buf = (char*)realloc(client->frame, cap);
+            if (!buf) {
+                LOG_ERROR("[Worker-%d] Out of memory gathering a frame\n", GetCurrentThreadId());
+                client->disconnectAfterSend = TRUE;
+                return len;
+            }
+            client->frame = buf;
+            client->frameCap = cap;
+        }
+        memcpy(client->frame + client->frameLen, data + used, take);
+        client->frameLen += take;
+        used += (DWORD)take;
+    }
+}
+
+// The first byte decides: no text command starts with the magic's first
+// byte. A binary client's magic is answered with the same four bytes.
+static DWORD Negotiate(ClientContext* client, const char* data, DWORD len) {
+    if (client->recvPos == 0 && data[0] != DOCS_BINARY_MAGIC[0]) {
+        client->protocol = PROTOCOL_TEXT;
+        return 0;
+    }
+
+    DWORD used = 0;
+    while (client->recvPos < DOCS_BINARY_MAGIC_SIZE && used < len) {
+        client->recvBuffer[client->recvPos++] = data[used++];
+    }
+    if (client->recvPos < DOCS_BINARY_MAGIC_SIZE) return used;
+
+    client->recvPos = 0;
+    if (memcmp(client->recvBuffer, DOCS_BINARY_MAGIC, DOCS_BINARY_MAGIC_SIZE) != 0) {
+        LOG_WARN("[Worker-%d] Unknown protocol magic, disconnecting\n", GetCurrentThreadId());
+        SendData(client, "[Error] Unknown protocol.\n", -1);
+        client->disconnectAfterSend = TRUE;
+        return len;
+    }
+
+    LOG_DEBUG("[Worker-%d] Binary protocol for client %p\n", GetCurrentThreadId(), (void*)client);
+    client->protocol = PROTOCOL_BINARY;
+    SendData(client, DOCS_BINARY_MAGIC, DOCS_BINARY_MAGIC_SIZE);
+    return used;
+}
+
+// Run complete lines in order, each in the mode the previous one left behind,
+// so a write block can follow its "write" command in the same buffer. Stops
+// right after an <END> so nothing behind it is answered before
+// [Write_Completed]. Returns the number of bytes consumed.
+static DWORD ParseText(ClientContext* client, const char* data, DWORD len) {
+    DWORD i = 0;
+    while (i < len) {
+        if (client->disconnectAfterSend) return len;   // nothing is run after "bye"
+        if (client->commitPending || PauseIfFull(client)) return i;
+
+        // Whole runs up to the next delimiter; a line longer than the buffer
+        // is cut, as before
+        DWORD end = i + (DWORD)ScanLineEnd(data + i, len - i);
+        size_t n = end - i;
+        if (n > (size_t)(BUF_SIZE - 1 - client->recvPos)) n = BUF_SIZE - 1 - client->recvPos;
+        memcpy(client->recvBuffer + client->recvPos, data + i, n);
+        client->recvPos += (int)n;
+        if (end == len) break;
+        i = end + 1;
+
+        if (client->recvPos > 0) {
+            size_t lineLen = (size_t)client->recvPos;
+            client->recvBuffer[lineLen] = '\0';
+            client->recvPos = 0;
+
+            if (client->isWriteMode) {
+                LOG_TRACE("[Worker-%d] Write mode line received: '%s'\n",
+                    GetCurrentThreadId(), client->recvBuffer);
+                ProcessWriteLine(client, client->recvBuffer);
+            }
+            else {
+                LOG_TRACE("[Worker-%d] Complete command line: '%s'\n",
+                    GetCurrentThreadId(), client->recvBuffer);
+                client->argc = TokenizeCommand(client->recvBuffer, lineLen, client->args, 64);
+                ULONGLONG start = MetricsNow();
+                ProcessCommand(client);
+                RecordCommand(CommandKind(client), start);
+            }
+        }
+    }
+    return len;
+}
+
+static DWORD ParseInput(ClientContext* client, const char* data, DWORD len) {
+    DWORD used = 0;
+    if (client->protocol == PROTOCOL_UNKNOWN && len > 0) used = Negotiate(client, data, len);
+
+    if (client->protocol == PROTOCOL_BINARY) return used + ParseFrames(client, data + used, len - used);
+    if (client->protocol == PROTOCOL_TEXT) return used + ParseText(client, data + used, len - used);
+    return len;     // magic still incomplete
+}
+
+// Keep input that arrived behind a pending commit or a pause until
+// CompleteWrite or SendCompleted
+static BOOL HoldInput(ClientContext* client, const char* data, DWORD len) {
+    if (client->heldPos > 0) {
+        client->heldLen -= client->heldPos;
+        memmove(client->heldInput, client->heldInput + client->heldPos, client->heldLen);
+        client->heldPos = 0;
+    }
+    if (client->heldLen + len > client->heldCap) {
+        size_t cap = client->heldCap ? client->heldCap : BUF_SIZE;
+        while (cap < client->heldLen + len) cap *= 2;
+        char* held = (char*)realloc(client->heldInput, cap);
+        if (!held) return FALSE;
+        client->heldInput = held;
+        client->heldCap = cap;
+    }
+    memcpy(client->heldInput + client->heldLen, data, len);
+    client->heldLen += len;
+    return TRUE;
+}
+
+static size_t HeldBytes(const ClientContext* client) {
+    return client->heldLen - client->heldPos;
+}
+
+// Run input held behind a pending commit or a pause. A paused client only
+// resumes once its output has drained to half the limits, so it does not
+// flap; running what it held may pause it again.
+static void ResumeInput(ClientContext* client) {
+    if (client->inputPaused) {
+        if (client->outBytes > flowMaxOutput / 2 || client->outCount > flowMaxQueued / 2) return;
+        client->inputPaused = FALSE;
+        Metrics()->pausedClients--;
+    }
+    while (!client->commitPending && !client->inputPaused && client->heldPos < client->heldLen) {
+        client->heldPos += ParseInput(client, client->heldInput + client->heldPos,
+            (DWORD)(client->heldLen - client->heldPos));
+    }
+    if (client->heldPos == client->heldLen) client->heldPos = client->heldLen = 0;
+    else if (HeldBytes(client) > flowMaxHeld) PauseInput(client);
+}
+
+void ProcessRecvData(ClientContext* client, const char* data, DWORD len) {
+    // Hex/string dump of every buffer; formatted only when tracing
+    if (LOG_ENABLED(LOG_LEVEL_TRACE)) {
+        char hex[32 * 3 + 1];
+        int hexPos = 0;
+        for (DWORD i = 0; i < len && i < 32; i++) {
+            hexPos += sprintf(hex + hexPos, "%02X ", (unsigned char)data[i]);
+        }
+        hex[hexPos] = '\0';
+        LOG_TRACE("[Worker-%d] Received data (hex): %s\n", GetCurrentThreadId(), hex);
+
+        char str[LOG_RECORD_SIZE];
+        int strPos = 0;
+        for (DWORD i = 0; i < len && strPos < LOG_RECORD_SIZE - 5; i++) {
+            if (data[i] >= 32 && data[i] <= 126) {
+                str[strPos++] = data[i];
+            }
+            else {
+                strPos += sprintf(str + strPos, "\\x%02X", (unsigned char)data[i]);
+            }
+        }
+        str[strPos] = '\0';
+        LOG_TRACE("[Worker-%d] Received data (str): %s\n", GetCurrentThreadId(), str);
+    }
+
+    MetricsRecord* metrics = Metrics();
+    metrics->recvCalls++;
+    metrics->recvBytes += len;
+    client->activeAt = MetricsNow();
+
+    // Pipelined commands: whatever follows an <END> waits for its commit, and
+    // everything waits while the client is paused. Too much of it held pauses
+    // the client too, which stops the backend reading more.
+    DWORD used = 0;
+    if (!client->commitPending && !client->inputPaused && client->heldPos == client->heldLen) {
+        used = ParseInput(client, data, len);
+    }
+    if (used < len && !HoldInput(client, data + used, len - used)) {
+        LOG_ERROR("[Worker-%d] Out of memory holding pipelined input\n", GetCurrentThreadId());
+        SendData(client, "[Error] Out of memory.\n", -1);
+        client->disconnectAfterSend = TRUE;
+    }
+    else if (HeldBytes(client) > flowMaxHeld) {
+        PauseInput(client);
+    }
+}
+
+void CompleteWrite(ClientContext* client) {
+    LOG_DEBUG("[Worker-%d] Write committed for client %p\n", GetCurrentThreadId(), (void*)client);
+    client->commitPending = FALSE;
+    BOOL create = client->createPending;
+    client->createPending = FALSE;
+    DocsStatus status = (DocsStatus)client->writeStatus;
+    if (client->protocol == PROTOCOL_BINARY) {
+        SendStatusFrame(client, (DocsOpcode)client->writeOpcode, status, client->writeRequestId);
+    }
+    else if (status == DOCS_STATUS_OK) {
+        SendData(client, create ? "[OK] Document created.\n" : "[Write_Completed]\n", -1);
+    }
+    else {
+        char message[64];
+        snprintf(message, sizeof(message), "[Error] %s\n", StatusMessage(status));
+        SendData(client, message, -1);
+    }
+    ResumeInput(client);
+}
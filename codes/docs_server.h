@@ -0,0 +1,308 @@
+/// docs_server.h
+// Shared document store, write queue and command protocol. The I/O backends
+// (iocp_server.c on Windows, linux_server.c on Linux) own sockets and
+// completions and call into this module once bytes have been received.
+#ifndef DOCS_SERVER_H
+#define DOCS_SERVER_H
+
+#include "platform.h"
+#include "name_index.h"
+#include "commit_queue.h"
+#include "timer_wheel.h"
+
+#ifndef _WIN32
+#include <sys/uio.h>
+#endif
+
+#define BUF_SIZE 2048
+#define MAX_WORKERS 8
+#define DOC_TABLE_MIN_CAPACITY 64
+
+// IO Operation types
+typedef enum {
+    OP_ACCEPT,
+    OP_RECV,
+    OP_SEND,
+    OP_WRITE_WAIT,
+    OP_COMMIT_DRAIN,    // the rest of a section's combining turn (CommitQueueDrain)
+#ifdef _WIN32
+    OP_TIMEOUT          // a client's timer fired; the Linux loops run theirs inline
+#endif
+} IO_OPERATION;
+
+// Wire protocol of a connection, decided by its first bytes (docs_protocol.h)
+typedef enum {
+    PROTOCOL_UNKNOWN,
+    PROTOCOL_TEXT,
+    PROTOCOL_BINARY
+} WireProtocol;
+
+// Forward declarations
+typedef struct ClientContext ClientContext;
+typedef struct Worker Worker;
+typedef struct ResponseChunk ResponseChunk;
+
+// One piece of a vectored send, in the platform's native layout
+#ifdef _WIN32
+typedef WSABUF SendSegment;
+#define SEGMENT_SET(seg, p, n) ((seg)->buf = (CHAR*)(p), (seg)->len = (ULONG)(n))
+#define SEGMENT_DATA(seg) ((const char*)(seg)->buf)
+#define SEGMENT_LEN(seg) ((size_t)(seg)->len)
+#else
+typedef struct iovec SendSegment;
+#define SEGMENT_SET(seg, p, n) ((seg)->iov_base = (void*)(p), (seg)->iov_len = (n))
+#define SEGMENT_DATA(seg) ((const char*)(seg)->iov_base)
+#define SEGMENT_LEN(seg) ((seg)->iov_len)
+#endif
+
+// A response handed to the backend as one vectored send. Segments point at
+// storage that cannot change under them: string literals, titles (arena,
+// never freed), the cached reply or section body held below, and small
+// fragments rendered into the response's own chunks. Nothing is copied into
+// a PER_IO_DATA buffer, so there is no size cap.
+//
+// A reply too large to render is queued as a stream instead: TakeOutput turns
+// it into one bounded send at a time, each issued only once the one before
+// has completed, so a slow reader holds one chunk's worth of segments.
+typedef struct Response {
+    SendSegment* segs;
+    int count;
+    int capacity;
+    ResponseChunk* chunks;          // rendered fragments
+    struct RenderedRead* hold;      // references released with the response
+    struct SectionBody* holdBody;
+    struct ReadStream* stream;      // produces the segments, chunk by chunk
+    size_t bytes;                   // total length of the segments
+    BOOL failed;                    // an append ran out of memory
+    struct Response* next;          // output queue / responses merged into one send
+} Response;
+
+// Per-IO data structure
+typedef struct PER_IO_DATA {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+    WSABUF wsaBuf;
+#else
+    struct msghdr msg;          // send: unsent part of response->segs
+    int segsLeft;               // segments from msg.msg_iov to the end
+    struct PER_IO_DATA* next;   // pending-send chain (epoll backend)
+#endif
+    Response* response;         // vectored send; freed on completion
+    char buffer[BUF_SIZE];
+    IO_OPERATION operation;
+    SOCKET socket;
+    ClientContext* client;
+    struct Section* section;    // OP_COMMIT_DRAIN
+} PER_IO_DATA;
+
+// Client context structure
+struct ClientContext {
+    SOCKET socket;
+    CRITICAL_SECTION cs;
+    char recvBuffer[BUF_SIZE];
+    int recvPos;
+    char* args[64];             // slices of recvBuffer (TokenizeCommand)
+    int argc;
+
+    // Write operation state: lines staged back to back, each NUL-terminated
+    char* stagedText;
+    size_t stagedLen;
+    size_t stagedCap;
+    int lineCount;
+    struct Document* writeDoc;
+    int sectionIdx;
+    int writeLine;              // staged lines replace writeRemove lines from writeLine
+    int writeRemove;            // (WriteNode)
+
+    BOOL isWriteMode;
+    BOOL commitPending;         // <END> or a create queued, OP_WRITE_WAIT not yet handled
+    BOOL createPending;         // the pending commit is a create (AddDocument)
+    int writeStatus;            // DocsStatus of the commit, set by the combiner
+    uint8_t writeOpcode;        // binary request answered by CompleteWrite
+    DWORD writeRequestId;
+
+    // Pipelined input received while a commit is pending, run by CompleteWrite
+    char* heldInput;
+    size_t heldLen;
+    size_t heldPos;             // consumed so far
+    size_t heldCap;
+
+    // Binary protocol: a frame that spans receives is gathered here
+    WireProtocol protocol;
+    char* frame;
+    size_t frameLen;
+    size_t frameCap;
+
+    // Output produced while handling completions. The backend flushes it as
+    // one vectored send after each completion, with at most one send in flight.
+    Response* outHead;
+    Response* outTail;
+    BOOL sendInFlight;
+    BOOL disconnectAfterSend;   // "bye": shut down once the queue has drained
+
+    // Flow control. Output queued or in flight is counted against the limits
+    // in docs_server.c; a client over them, or with too much input held, is
+    // paused: its input is held unparsed and the backend stops reading from
+    // the socket until the sends have drained it to half the limits.
+    size_t outBytes;            // queued responses plus the send in flight
+    size_t sendBytes;           // the send in flight
+    int outCount;               // responses queued behind it
+    BOOL inputPaused;
+    ULONGLONG progressAt;       // MetricsNow() at the pause or the last send completed since
+
+    // Deadlines (ClientDeadline). The backend keeps one timer per client on
+    // its wheel and only moves it when a deadline comes closer; one that has
+    // moved further away is found when the timer fires, and it is re-armed.
+    ULONGLONG activeAt;         // MetricsNow() at the last receive or send completed
+    ULONGLONG writeAt;          // write mode entered
+    ULONGLONG commitAt;         // commit queued
+    TimerNode timer;
+    ULONGLONG timerDue;         // time the timer is armed (or posted) for, 0 if none
+
+    // Backend side: a paused client's receive is parked here rather than
+    // reposted until reading resumes
+    PER_IO_DATA* parkedRecv;
+
+#ifndef _WIN32
+    // Owning event loop; all I/O for this socket is issued from its thread
+    Worker* worker;
+    int ioRefs;         // in-flight operations referencing this context
+    BOOL closing;
+    PER_IO_DATA* sending;       // send not yet fully written (epoll backend)
+    PER_IO_DATA* recvData;      // the connection's OP_RECV
+    BOOL readStopped;           // reading stopped for inputPaused
+#else
+    volatile LONG refCount;     // the posted recv, the send in flight, each queued commit
+#endif
+};
+
+// Which reply a cached rendering is for
+typedef enum {
+    READ_TEXT,                  // the text protocol's reply, without "__END__"
+    READ_BINARY,                // a READ frame's fields; the header is per request
+    READ_FORMAT_COUNT
+} ReadFormat;
+
+// A read reply rendered once and sent by every read until its version goes
+// stale. A section's renderings hang off its body, so a commit (a new body)
+// makes them unreachable and they go with the old body; the catalog's are
+// rebuilt when a create has changed doc_count.
+typedef struct RenderedRead {
+    volatile LONG refs;         // the owner's pointer plus each response sending it
+    LONG64 version;             // body version, or documents listed in the catalog
+    uint32_t fieldCount;        // READ_BINARY
+    size_t len;
+    char data[];
+} RenderedRead;
+
+// Line table and text behind one or more section bodies, lines back to back,
+// each NUL-terminated. Every body sees a prefix of it. A commit that only
+// appends to the newest body writes past the end that body sees and shares
+// the storage, so an append copies just the new lines; older bodies never
+// look that far. The end is moved only by the section's combiner.
+typedef struct BodyStorage {
+    volatile LONG refs;         // bodies using it
+    int lineCap;
+    int lineCount;              // lines written so far
+    size_t textCap;
+    size_t textLen;             // text bytes written so far
+    char* text;                 // after the line table, or the snapshot mapping
+    char* lines[];
+} BodyStorage;
+
+// Immutable contents of one section: a prefix of its storage. A commit
+// publishes a new body with one pointer store and retires the old one through
+// the epoch collector, so readers take a consistent snapshot without any
+// lock. Reads are sent from the body's renderings; a response takes a
+// reference on one inside its epoch, so it outlives the send even after the
+// body has been replaced and retired.
+typedef struct SectionBody {
+    LONG64 version;             // 1 for the first commit, +1 per commit
+    volatile LONG refs;         // the published pointer plus each user outside an epoch
+    RenderedRead* volatile rendered[READ_FORMAT_COUNT];     // built by the first read
+    BodyStorage* storage;       // referenced
+    int lineCount;
+    size_t textLen;             // bytes of text, NULs included
+    char** lines;               // storage->lines
+} SectionBody;
+
+typedef struct Section {
+    const char* title;
+    struct Document* doc;       // owner, named in the section's log records
+    SectionBody* volatile body; // NULL until the first commit or first use of stored
+    const struct SnapshotSection* stored;   // contents in the startup snapshot, if any
+    CommitQueue commits;        // writes waiting to be published
+
+    // Commit statistics for the metrics: queued by writers, the rest
+    // written by the section's combiner only
+    volatile LONG64 queued;
+    LONG64 committed;
+    LONG64 waitMicros;          // total submit-to-publish time
+    LONG64 maxWaitMicros;
+} Section;
+
+// Document structure. The struct, its titles and its section table come from
+// the store's arena and never move once created.
+typedef struct Document {
+    const char* title;
+    Section* sections;
+    int section_count;
+    NameIndex sectionIndex;     // section title -> section index
+} Document;
+
+// Global variables
+extern volatile LONG doc_count;
+extern SRWLOCK docsLock;            // serialises create; readers never take it
+
+// Document store / protocol (docs_server.c)
+void InitializeDocStore(void);
+// An empty body (refs 1) over new storage with room for lineCap lines and
+// textCap bytes of text, or over the textCap bytes at text if given, which
+// the caller keeps alive
+SectionBody* AllocSectionBody(int lineCap, size_t textCap, char* text);
+Document* FindDoc(const char* title);            // inside EpochEnter/EpochExit
+int FindSection(const Document* doc, const char* title);
+void ParseCommand(char* input, char* args[], int* argc);     // args point into input
+void FreeClientState(ClientContext* client);
+void ProcessCommand(ClientContext* client);
+void ProcessWriteLine(ClientContext* client, const char* line);
+void CompleteWrite(ClientContext* client);      // OP_WRITE_WAIT, under client->cs
+void DrainCommits(Section* section);            // OP_COMMIT_DRAIN
+void ProcessRecvData(ClientContext* client, const char* data, DWORD len);
+void FreeResponse(Response* response);      // and every response linked behind it
+
+// Output queue. SendData copies into the client's queue; nothing reaches the
+// socket until the backend calls FlushOutput once it is done with a completion.
+BOOL SendData(ClientContext* client, const char* data, int len);
+void FlushOutput(ClientContext* client);
+// Queued output merged into one response and marked in flight, or NULL if a
+// send is already in flight or nothing is queued (FlushOutput without the send)
+Response* TakeOutput(ClientContext* client);
+// The send in flight is done. TRUE if the connection should now be shut down
+// (everything up to "[Disconnected]" is out); otherwise call FlushOutput.
+// A paused client whose output has drained enough runs its held input here
+// and clears inputPaused.
+BOOL SendCompleted(ClientContext* client);
+
+// Timeouts. The earliest time one of the client's deadlines runs out, or 0 if
+// none applies: a pause with no send completing (stalled), a commit still
+// unanswered, a write session still open, or else no traffic at all (idle).
+ULONGLONG ClientDeadline(const ClientContext* client);
+// The client's timer fired: TRUE, logged and counted, if a deadline has
+// passed and the backend should disconnect the client
+BOOL ClientTimedOut(ClientContext* client, ULONGLONG now);
+
+// Provided by the I/O backend
+// Send a whole response with one vectored call; takes ownership of it either way
+BOOL SendVector(ClientContext* client, Response* response);
+// Keep the client alive until its queued commit has completed (caller holds client->cs)
+void RetainClient(ClientContext* client);
+// Hand OP_WRITE_WAIT to a thread that may touch the client; callable from any thread.
+// That thread calls CompleteWrite and then drops the reference taken by RetainClient.
+void PostWriteCompletion(ClientContext* client);
+// Hand OP_COMMIT_DRAIN to the calling worker's own queue, behind the events it
+// already has; called by a combiner that ran out of passes. That worker calls
+// DrainCommits.
+void PostCommitDrain(Section* section);
+
+#endif // DOCS_SERVER_H
@@ -0,0 +1,134 @@
+/// epoch.c
+#include "epoch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define EPOCH_BUCKETS 3
+
+typedef struct {
+    void* ptr;
+    EpochFreeFn freeFn;
+} Retired;
+
+// Objects retired while the global epoch had one particular value
+typedef struct {
+    LONG64 epoch;
+    Retired* items;
+    int count;
+    int capacity;
+} LimboBucket;
+
+typedef struct EpochRecord {
+    // (epoch << 1) | 1 while inside a critical section, 0 outside
+    volatile LONG64 state;
+    int nesting;
+    int sinceAdvance;
+    volatile LONG64 pending;
+    LimboBucket limbo[EPOCH_BUCKETS];
+    struct EpochRecord* volatile nextRecord;
+} EpochRecord;
+
+static volatile LONG64 g_epoch = 1;
+static EpochRecord* volatile g_epochRecords = NULL;
+static THREAD_LOCAL EpochRecord* t_epoch = NULL;
+
+static EpochRecord* GetEpochRecord(void) {
+    if (t_epoch) return t_epoch;
+
+    EpochRecord* rec = (EpochRecord*)malloc(sizeof(EpochRecord));
+    if (!rec) abort();     // nothing sensible to fall back to
+    ZeroMemory(rec, sizeof(EpochRecord));
+
+    // Records are never unlinked; threads live for the life of the process
+    EpochRecord* head;
+    do {
+        head = g_epochRecords;
+        rec->nextRecord = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&g_epochRecords, rec, head) != head);
+
+    t_epoch = rec;
+    return rec;
+}
+
+void EpochEnter(void) {
+    EpochRecord* rec = GetEpochRecord();
+    if (rec->nesting++ > 0) return;
+
+    // Full barrier: the announcement must be visible before any shared load
+    InterlockedExchange64(&rec->state, (ReadAcquire64(&g_epoch) << 1) | 1);
+}
+
+void EpochExit(void) {
+    EpochRecord* rec = t_epoch;
+    if (--rec->nesting > 0) return;
+    InterlockedExchange64(&rec->state, 0);
+}
+
+// Move the global epoch forward if every active thread has already seen it
+static LONG64 TryAdvance(void) {
+    LONG64 epoch = ReadAcquire64(&g_epoch);
+
+    for (EpochRecord* rec = g_epochRecords; rec; rec = rec->nextRecord) {
+        LONG64 state = ReadAcquire64(&rec->state);
+        if ((state & 1) && (state >> 1) != epoch) return epoch;
+    }
+
+    InterlockedCompareExchange64(&g_epoch, epoch + 1, epoch);
+    return ReadAcquire64(&g_epoch);
+}
+
+static void FreeBucket(EpochRecord* rec, LimboBucket* bucket) {
+    for (int i = 0; i < bucket->count; i++) {
+        bucket->items[i].freeFn(bucket->items[i].ptr);
+    }
+    InterlockedExchangeAdd64(&rec->pending, -bucket->count);
+    bucket->count = 0;
+}
+
+void EpochRetire(void* ptr, EpochFreeFn freeFn) {
+    if (!ptr) return;
+
+    EpochRecord* rec = GetEpochRecord();
+    LONG64 epoch = ReadAcquire64(&g_epoch);
+
+    if (++rec->sinceAdvance >= EPOCH_ADVANCE_INTERVAL) {
+        rec->sinceAdvance = 0;
+        epoch = TryAdvance();
+    }
+
+    // Anything retired two or more epochs ago can no longer be referenced:
+    // every reader active then has since exited
+    for (int b = 0; b < EPOCH_BUCKETS; b++) {
+        LimboBucket* bucket = &rec->limbo[b];
+        if (bucket->count && bucket->epoch <= epoch - 2) FreeBucket(rec, bucket);
+    }
+
+    LimboBucket* bucket = &rec->limbo[epoch % EPOCH_BUCKETS];
+    if (bucket->count && bucket->epoch != epoch) FreeBucket(rec, bucket);
+    bucket->epoch = epoch;
+
+    if (bucket->count == bucket->capacity) {
+        int capacity = bucket->capacity ? bucket->capacity * 2 : 16;
+        Retired* items = (Retired*)realloc(bucket->items, sizeof(Retired) * capacity);
+        if (!items) {
+            // Cannot defer it; leaking is safer than freeing under a reader
+            return;
+        }
+        bucket->items = items;
+        bucket->capacity = capacity;
+    }
+
+    bucket->items[bucket->count].ptr = ptr;
+    bucket->items[bucket->count].freeFn = freeFn;
+    bucket->count++;
+    InterlockedIncrement64(&rec->pending);
+}
+
+LONG64 EpochPendingCount(void) {
+    LONG64 total = 0;
+    for (EpochRecord* rec = g_epochRecords; rec; rec = rec->nextRecord) {
+        total += ReadAcquire64(&rec->pending);
+    }
+    return total;
+}
@@ -0,0 +1,30 @@
+/// epoch.h
+// Epoch-based reclamation for data that readers walk without a lock: section
+// bodies, the document table and the title index.
+//
+// A reader brackets its accesses with EpochEnter/EpochExit. A writer that
+// unpublishes an object hands it to EpochRetire instead of freeing it; the
+// object is freed once every thread that was inside a critical section at the
+// time has left it (the global epoch has moved on twice). Readers never block
+// and never write shared cache lines other than their own record.
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "platform.h"
+
+#define EPOCH_ADVANCE_INTERVAL 32   // retires between attempts to advance
+
+typedef void (*EpochFreeFn)(void* ptr);
+
+// Critical sections may nest; only the outermost pair has any effect
+void EpochEnter(void);
+void EpochExit(void);
+
+// Free ptr with freeFn once no reader can still hold it. The object must
+// already be unreachable for new readers.
+void EpochRetire(void* ptr, EpochFreeFn freeFn);
+
+// Objects still waiting to be freed, summed over all threads
+LONG64 EpochPendingCount(void);
+
+#endif // EPOCH_H
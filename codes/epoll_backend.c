@@ -0,0 +1,291 @@
+/// epoll_backend.c
+// Edge-triggered epoll reactor, used where io_uring is unavailable.
+//
+// Each worker has its own epoll instance watching its own SO_REUSEPORT
+// listener and the connections accepted from it, so workers never share a
+// queue. Readiness events are translated into the same operations the IOCP
+// worker handles: the listener's PER_IO_DATA is OP_ACCEPT, a connection's is
+// OP_RECV, and EPOLLOUT on a connection completes its pending OP_SENDs.
+// Because events are edge-triggered every handler drains until EAGAIN.
+#include "linux_server.h"
+#include "io_pool.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+
+#define EPOLL_MAX_EVENTS 256
+
+typedef struct {
+    int epfd;
+    PER_IO_DATA* acceptIo;
+    PER_IO_DATA* wakeIo;        // the worker's eventfd (OP_WRITE_WAIT)
+    char recvBuf[BUF_SIZE];     // connections are drained one at a time
+} EpollWorker;
+
+#define EPOLL(w) ((EpollWorker*)(w)->state)
+
+static BOOL EpollProbe(void) {
+    int fd = epoll_create1(EPOLL_CLOEXEC);
+    if (fd < 0) return FALSE;
+    close(fd);
+    return TRUE;
+}
+
+// Write the send in flight until the socket would block, then keep going
+// with whatever the client queued meanwhile. Returns FALSE on a hard error.
+static BOOL FlushSends(ClientContext* client) {
+    while (client->sending) {
+        PER_IO_DATA* ioData = client->sending;
+        ssize_t sent = sendmsg(client->socket, &ioData->msg, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return TRUE;  // wait for EPOLLOUT
+            LOG_ERROR("[Worker-%d] Send failed: %d\n", GetCurrentThreadId(), errno);
+            return FALSE;
+        }
+
+        if (AdvanceSend(ioData, (size_t)sent)) continue;
+
+        // OP_SEND completed
+        client->sending = NULL;
+        FreeSendData(ioData);
+
+        if (SendCompleted(client)) {
+            LOG_DEBUG("[Worker-%d] Disconnection message sent, closing socket\n", GetCurrentThreadId());
+            // Shut down only; the read side sees EOF and releases the client
+            ShutdownClient(client);
+            return TRUE;
+        }
+
+        Response* next = TakeOutput(client);
+        if (next) client->sending = NewSendData(client, next);
+    }
+    return TRUE;
+}
+
+static void DiscardSends(ClientContext* client) {
+    if (client->sending) FreeSendData(client->sending);
+    client->sending = NULL;
+}
+
+static void EpollReleaseClient(ClientContext* client) {
+    if (--client->ioRefs > 0) return;
+    DestroyClientContext(client);
+}
+
+static BOOL EpollPostSend(ClientContext* client, PER_IO_DATA* ioData) {
+    // Only ever one send at a time (see FlushOutput); write it straight away.
+    // Anything the socket cannot take now goes out on the next EPOLLOUT edge.
+    client->sending = ioData;
+
+    if (!FlushSends(client)) {
+        ShutdownClient(client);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void EpollPauseRecv(ClientContext* client) {
+    // Nothing to cancel: HandleRecv simply stops draining the socket, and
+    // the kernel's receive buffer filling up pushes back on the client
+    (void)client;
+}
+
+static void EpollResumeRecv(ClientContext* client) {
+    // Modifying an edge-triggered registration re-checks readiness, so input
+    // that arrived while reading was stopped is reported again
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = client->recvData;
+    if (epoll_ctl(EPOLL(client->worker)->epfd, EPOLL_CTL_MOD, client->socket, &ev) < 0) {
+        LOG_ERROR("[Worker-%d] Failed to resume reading socket %d: %d\n", GetCurrentThreadId(), client->socket, errno);
+    }
+}
+
+static void HandleAccept(Worker* w) {
+    EpollWorker* e = EPOLL(w);
+
+    while (1) {
+        SOCKET sock = accept4(w->listenSocket, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (sock == INVALID_SOCKET) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                LOG_ERROR("[ERROR] Accept failed: %d\n", errno);
+            }
+            return;
+        }
+
+        LOG_TRACE("[Worker-%d] Processing OP_ACCEPT, socket=%d\n", GetCurrentThreadId(), sock);
+
+        ClientContext* newClient = CreateClientContext(w, sock);
+
+        PER_IO_DATA* recvData = AllocIoData();
+        ZeroMemory(recvData, sizeof(PER_IO_DATA));
+        recvData->operation = OP_RECV;
+        recvData->client = newClient;
+        recvData->socket = sock;
+        newClient->recvData = recvData;
+        newClient->ioRefs = 1;
+
+        struct epoll_event ev;
+        ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+        ev.data.ptr = recvData;
+        if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, sock, &ev) < 0) {
+            LOG_ERROR("[ERROR] Failed to register client socket with epoll: %d\n", errno);
+            FreeIoData(recvData);
+            DestroyClientContext(newClient);
+        }
+    }
+}
+
+// Drain the socket, unless flow control has stopped reading it. Returns
+// FALSE once the connection is finished.
+static BOOL HandleRecv(EpollWorker* e, ClientContext* client) {
+    while (1) {
+        if (client->readStopped) return TRUE;
+
+        ssize_t n = recv(client->socket, e->recvBuf, BUF_SIZE, 0);
+        if (n > 0) {
+            LOG_TRACE("[Worker-%d] Processing OP_RECV, bytes=%d, client=%p, isWriteMode=%d\n",
+                GetCurrentThreadId(), (int)n, (void*)client, client->isWriteMode);
+
+            if (!client->closing) {
+                EnterCriticalSection(&client->cs);
+                ProcessRecvData(client, e->recvBuf, (DWORD)n);
+                FlushOutput(client);
+                LeaveCriticalSection(&client->cs);
+                UpdateClient(client);
+            }
+            continue;
+        }
+
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return TRUE;
+            LOG_ERROR("[Worker-%d] Recv failed: %d\n", GetCurrentThreadId(), errno);
+        }
+        else {
+            LOG_DEBUG("[Worker-%d] Client disconnected (OP_RECV with 0 bytes)\n", GetCurrentThreadId());
+        }
+        return FALSE;
+    }
+}
+
+static BOOL EpollWorkerInit(Worker* w) {
+    EpollWorker* e = (EpollWorker*)malloc(sizeof(EpollWorker));
+    ZeroMemory(e, sizeof(EpollWorker));
+    w->state = e;
+
+    e->epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (e->epfd < 0) {
+        LOG_ERROR("[ERROR] epoll_create1 failed: %d\n", errno);
+        return FALSE;
+    }
+
+    e->acceptIo = AllocIoData();
+    ZeroMemory(e->acceptIo, sizeof(PER_IO_DATA));
+    e->acceptIo->operation = OP_ACCEPT;
+    e->acceptIo->socket = w->listenSocket;
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = e->acceptIo;
+    if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, w->listenSocket, &ev) < 0) {
+        LOG_ERROR("[ERROR] Failed to register listen socket with epoll: %d\n", errno);
+        return FALSE;
+    }
+
+    e->wakeIo = AllocIoData();
+    ZeroMemory(e->wakeIo, sizeof(PER_IO_DATA));
+    e->wakeIo->operation = OP_WRITE_WAIT;
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = e->wakeIo;
+    if (epoll_ctl(e->epfd, EPOLL_CTL_ADD, w->wakeFd, &ev) < 0) {
+        LOG_ERROR("[ERROR] Failed to register wakeup eventfd with epoll: %d\n", errno);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void EpollWorkerRun(Worker* w) {
+    EpollWorker* e = EPOLL(w);
+    struct epoll_event events[EPOLL_MAX_EVENTS];
+
+    while (1) {
+        int count = epoll_wait(e->epfd, events, EPOLL_MAX_EVENTS, TimerTimeout(w));
+        if (count < 0) {
+            if (errno != EINTR) LOG_ERROR("[ERROR] epoll_wait failed: %d\n", errno);
+            continue;
+        }
+
+        for (int i = 0; i < count; i++) {
+            PER_IO_DATA* ioData = (PER_IO_DATA*)events[i].data.ptr;
+            uint32_t ready = events[i].events;
+
+            switch (ioData->operation) {
+            case OP_ACCEPT:
+                HandleAccept(w);
+                break;
+
+            case OP_RECV: {
+                ClientContext* client = ioData->client;
+                BOOL alive = TRUE;
+
+                // OP_SEND: the socket drained, push out what is still queued
+                if ((ready & EPOLLOUT) && client->sending) {
+                    if (FlushSends(client)) UpdateClient(client);
+                    else ShutdownClient(client);
+                }
+
+                if (ready & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                    alive = HandleRecv(e, client);
+                }
+
+                if (!alive) {
+                    // Stop watching now; the descriptor itself is closed once a
+                    // commit still queued for this client has come back
+                    epoll_ctl(e->epfd, EPOLL_CTL_DEL, client->socket, NULL);
+                    client->closing = TRUE;
+                    DiscardSends(client);
+                    FreeIoData(ioData);
+                    EpollReleaseClient(client);
+                }
+                break;
+            }
+
+            case OP_WRITE_WAIT: {
+                // Commits applied by other threads; reset the eventfd first
+                uint64_t value;
+                while (read(w->wakeFd, &value, sizeof(value)) > 0) {}
+                DrainMailbox(w);
+                break;
+            }
+
+            case OP_SEND:
+                // Sends are completed inline on EPOLLOUT; never registered
+                break;
+
+            case OP_COMMIT_DRAIN:
+                // Only ever posted to the mailbox
+                break;
+            }
+        }
+
+        RunTimers(w);
+    }
+}
+
+const LinuxBackend g_epollBackend = {
+    "epoll",
+    EpollProbe,
+    EpollWorkerInit,
+    EpollWorkerRun,
+    EpollPostSend,
+    EpollReleaseClient,
+    EpollPauseRecv,
+    EpollResumeRecv
+};
@@ -0,0 +1,156 @@
+/// io_pool.c
+#include "io_pool.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct ObjectPool ObjectPool;
+
+// Header in front of every pooled object. The owner never changes, so a free
+// from any thread knows where the object goes back to.
+typedef struct PoolObject {
+    ObjectPool* owner;
+    struct PoolObject* next;
+} PoolObject;
+
+struct ObjectPool {
+    size_t stride;                      // header + object, pointer aligned
+    PoolObject* localFree;              // owner thread only
+    PoolObject* volatile remoteFree;    // pushed by other threads
+    PoolStats stats;
+};
+
+// All pools of one thread, linked into a global list for GetPoolStats
+typedef struct ThreadPools {
+    ObjectPool pools[POOL_KIND_COUNT];
+    struct ThreadPools* volatile nextThread;
+} ThreadPools;
+
+static const char* g_poolNames[POOL_KIND_COUNT] = { "PER_IO_DATA", "WriteNode" };
+static ThreadPools* volatile g_poolRegistry = NULL;
+static THREAD_LOCAL ThreadPools* t_pools = NULL;
+
+static size_t ObjectSize(POOL_KIND kind) {
+    switch (kind) {
+    case POOL_IO_DATA: return sizeof(PER_IO_DATA);
+    case POOL_WRITE_NODE: return sizeof(WriteNode);
+    default: return 0;
+    }
+}
+
+static ThreadPools* GetThreadPools(void) {
+    if (t_pools) return t_pools;
+
+    ThreadPools* tp = (ThreadPools*)malloc(sizeof(ThreadPools));
+    ZeroMemory(tp, sizeof(ThreadPools));
+    for (int k = 0; k < POOL_KIND_COUNT; k++) {
+        size_t stride = sizeof(PoolObject) + ObjectSize((POOL_KIND)k);
+        tp->pools[k].stride = (stride + sizeof(void*) - 1) & ~(sizeof(void*) - 1);
+    }
+
+    // Publish for stats; threads live for the life of the process
+    ThreadPools* head;
+    do {
+        head = g_poolRegistry;
+        tp->nextThread = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&g_poolRegistry, tp, head) != head);
+
+    t_pools = tp;
+    return tp;
+}
+
+static BOOL RefillSlab(ObjectPool* pool) {
+    char* slab = (char*)malloc(pool->stride * POOL_SLAB_OBJECTS);
+    if (!slab) return FALSE;
+
+    for (int i = POOL_SLAB_OBJECTS - 1; i >= 0; i--) {
+        PoolObject* obj = (PoolObject*)(slab + pool->stride * i);
+        obj->owner = pool;
+        obj->next = pool->localFree;
+        pool->localFree = obj;
+    }
+    pool->stats.slabs++;
+    return TRUE;
+}
+
+static void* PoolAlloc(POOL_KIND kind) {
+    ObjectPool* pool = &GetThreadPools()->pools[kind];
+
+    if (!pool->localFree && pool->remoteFree) {
+        // Take everything other threads have handed back in one exchange
+        pool->localFree = (PoolObject*)InterlockedExchangePointer((PVOID*)&pool->remoteFree, NULL);
+    }
+
+    if (pool->localFree) {
+        pool->stats.hits++;
+    }
+    else {
+        pool->stats.misses++;
+        if (!RefillSlab(pool)) return NULL;
+    }
+
+    PoolObject* obj = pool->localFree;
+    pool->localFree = obj->next;
+    return obj + 1;
+}
+
+static void PoolFree(void* ptr) {
+    if (!ptr) return;
+
+    PoolObject* obj = (PoolObject*)ptr - 1;
+    ObjectPool* pool = obj->owner;
+
+    if (t_pools && pool >= t_pools->pools && pool < t_pools->pools + POOL_KIND_COUNT) {
+        obj->next = pool->localFree;
+        pool->localFree = obj;
+        return;
+    }
+
+    // Cross-thread return: push onto the owner's stack. The owner only ever
+    // detaches the whole list, so there is no pop to race with (no ABA).
+    PoolObject* head;
+    do {
+        head = pool->remoteFree;
+        obj->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&pool->remoteFree, obj, head) != head);
+    InterlockedIncrement64(&pool->stats.remoteFrees);
+}
+
+PER_IO_DATA* AllocIoData(void) {
+    return (PER_IO_DATA*)PoolAlloc(POOL_IO_DATA);
+}
+
+void FreeIoData(PER_IO_DATA* ioData) {
+    PoolFree(ioData);
+}
+
+WriteNode* AllocWriteNode(void) {
+    return (WriteNode*)PoolAlloc(POOL_WRITE_NODE);
+}
+
+void FreeWriteNode(WriteNode* node) {
+    PoolFree(node);
+}
+
+void GetPoolStats(POOL_KIND kind, PoolStats* stats) {
+    ZeroMemory(stats, sizeof(PoolStats));
+    for (ThreadPools* tp = g_poolRegistry; tp; tp = tp->nextThread) {
+        const PoolStats* s = &tp->pools[kind].stats;
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->remoteFrees += s->remoteFrees;
+        stats->slabs += s->slabs;
+    }
+}
+
+void PrintPoolStats(void) {
+    for (int k = 0; k < POOL_KIND_COUNT; k++) {
+        PoolStats stats;
+        GetPoolStats((POOL_KIND)k, &stats);
+        LOG_INFO("[Pool] %s: hits=%lld misses=%lld remote_frees=%lld slabs=%lld\n",
+            g_poolNames[k], (long long)stats.hits, (long long)stats.misses,
+            (long long)stats.remoteFrees, (long long)stats.slabs);
+    }
+}
@@ -0,0 +1,41 @@
+/// io_pool.h
+// Per-worker slab pools for the objects allocated on every request:
+// PER_IO_DATA (one per send / recv / accept) and WriteNode (one per commit).
+//
+// Each thread allocates from its own pool without any synchronisation. An
+// object freed on a different thread than the one that allocated it is pushed
+// onto its owner's remote-return stack (a single CAS); the owner takes the
+// whole stack with one exchange the next time its local free list runs dry.
+// Slabs are never returned to the heap, so once a worker has warmed up the
+// request path performs no heap allocations.
+#ifndef IO_POOL_H
+#define IO_POOL_H
+
+#include "docs_server.h"
+
+#define POOL_SLAB_OBJECTS 64
+#define POOL_STATS_INTERVAL_MS 60000
+
+typedef enum {
+    POOL_IO_DATA,
+    POOL_WRITE_NODE,
+    POOL_KIND_COUNT
+} POOL_KIND;
+
+typedef struct {
+    LONG64 hits;            // served from a free list
+    LONG64 misses;          // needed a new slab
+    LONG64 remoteFrees;     // returned by a thread other than the owner
+    LONG64 slabs;           // slabs allocated so far
+} PoolStats;
+
+PER_IO_DATA* AllocIoData(void);
+void FreeIoData(PER_IO_DATA* ioData);
+WriteNode* AllocWriteNode(void);
+void FreeWriteNode(WriteNode* node);
+
+// Totals over every thread's pool (counters are read without locking)
+void GetPoolStats(POOL_KIND kind, PoolStats* stats);
+void PrintPoolStats(void);
+
+#endif // IO_POOL_H
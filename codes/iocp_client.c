@@ -94,6 +94,9 @@ int main(int argc, char* argv[]) {
     printf("[Client] Available commands:\n");
     printf("  - create <doc_name> <section_count> <section1> <section2> ...\n");
     printf("  - write <doc_name> <section_name>\n");
+    printf("  - append <doc_name> <section_name> [line]\n");
+    printf("  - insert|replace <doc_name> <section_name> <line_no> [line]\n");
+    printf("  - delete <doc_name> <section_name> <line_no>\n");
     printf("  - read [doc_name section_name]\n");
     printf("  - bye\n\n");
 
@@ -159,8 +162,10 @@ int main(int argc, char* argv[]) {
         fflush(stdout);
 
         // Handle different command types
-        if (strncmp(input, "write", 5) == 0) {
-            // Write mode - handle multiple inputs
+        if (strncmp(input, "write", 5) == 0 || strncmp(input, "append", 6) == 0 ||
+            strncmp(input, "insert", 6) == 0 || strncmp(input, "replace", 7) == 0 ||
+            strncmp(input, "delete", 6) == 0) {
+            // Write mode - handle multiple inputs (an edit with its line completes at once)
             printf("[Client] Entering write mode...\n");
             fflush(stdout);
 
@@ -1,463 +1,194 @@
 /// server_iocp.c
-#define _WINSOCK_DEPRECATED_NO_WARNINGS
-#define _CRT_SECURE_NO_WARNINGS
+#include "docs_server.h"
+#include "io_pool.h"
+#include "log.h"
+#include "metrics.h"
 
-#include <winsock2.h>
-#include <ws2tcpip.h>
-#include <mswsock.h>
-#include <windows.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <process.h>
 
 #pragma comment(lib, "ws2_32.lib")
 #pragma comment(lib, "mswsock.lib")
 
-#define MAX_DOCS 100
-#define MAX_SECTIONS 10
-#define MAX_TITLE 64
-#define MAX_LINE 256
-#define MAX_LINES 10
-#define BUF_SIZE 2048
-#define MAX_WORKERS 8
-
-// IO Operation types
-typedef enum {
-    OP_ACCEPT,
-    OP_RECV,
-    OP_SEND,
-    OP_WRITE_WAIT
-} IO_OPERATION;
-
-// Forward declarations
-typedef struct ClientContext ClientContext;
-
-// Per-IO data structure
-typedef struct {
-    OVERLAPPED overlapped;
-    WSABUF wsaBuf;
-    char buffer[BUF_SIZE];
-    IO_OPERATION operation;
-    SOCKET socket;
-    ClientContext* client;
-} PER_IO_DATA;
-
-// Client context structure
-struct ClientContext {
-    SOCKET socket;
-    CRITICAL_SECTION cs;
-    char recvBuffer[BUF_SIZE];
-    int recvPos;
-    char* args[64];
-    int argc;
-
-    // Write operation state
-    char tempLines[MAX_LINES][MAX_LINE];
-    int lineCount;
-    int docIdx;
-    int sectionIdx;
-    LONG64 writeTicket;
-
-    BOOL isWriteMode;
-};
-
-// Document structure
-typedef struct {
-    char title[MAX_TITLE];
-    char section_titles[MAX_SECTIONS][MAX_TITLE];
-    char section_contents[MAX_SECTIONS][MAX_LINES][MAX_LINE];
-    int section_line_count[MAX_SECTIONS];
-    int section_count;
-} Document;
-
-// Lock-free queue node for write requests
-typedef struct WriteNode {
-    struct WriteNode* volatile next;
-    LONG64 ticket;
-    ClientContext* client;
-    int estimatedLines;
-} WriteNode;
-
-// Lock-free queue for each section
-typedef struct {
-    WriteNode* volatile head;
-    WriteNode* volatile tail;
-    volatile LONG64 currentTicket;
-    volatile LONG64 nextTicket;
-} LockFreeQueue;
-
 // Global variables
-Document docs[MAX_DOCS];
-volatile LONG doc_count = 0;
 HANDLE g_hIOCP = NULL;
 SOCKET g_listenSocket = INVALID_SOCKET;
-LockFreeQueue sectionQueues[MAX_DOCS][MAX_SECTIONS];
-SRWLOCK docsLock;
 LPFN_ACCEPTEX lpfnAcceptEx = NULL;
 
+// Deadlines of every client (ClientContext::timer). Workers arm timers under
+// the lock; the main thread advances the wheel and posts each timer that
+// fires to the completion port as OP_TIMEOUT, so the client is checked by a
+// worker under its own cs. Taken after a client's cs, never before it. A
+// client stays on the wheel only while its recv's reference is held.
+static TimerWheel g_timers;
+static CRITICAL_SECTION g_timerLock;
+
 // Function prototypes
-void InitializeLockFreeQueue(LockFreeQueue* queue);
-void EnqueueWrite(LockFreeQueue* queue, ClientContext* client, int estimatedLines);
-WriteNode* DequeueWrite(LockFreeQueue* queue);
-Document* FindDoc(const char* title);
-void ParseCommand(const char* input, char* args[], int* argc);
-BOOL SendData(ClientContext* client, const char* data, int len);
-void ProcessCommand(ClientContext* client);
-void ProcessWriteLine(ClientContext* client, const char* line);
 unsigned __stdcall WorkerThread(void* param);
 
-void InitializeLockFreeQueue(LockFreeQueue* queue) {
-    queue->head = queue->tail = NULL;
-    queue->currentTicket = 0;
-    queue->nextTicket = 0;
+void RetainClient(ClientContext* client) {
+    InterlockedIncrement(&client->refCount);
 }
 
-void EnqueueWrite(LockFreeQueue* queue, ClientContext* client, int estimatedLines) {
-    WriteNode* node = (WriteNode*)malloc(sizeof(WriteNode));
-    node->client = client;
-    node->estimatedLines = estimatedLines;
-    node->next = NULL;
-
-    // Get ticket atomically
-    node->ticket = InterlockedIncrement64(&queue->nextTicket) - 1;
-    client->writeTicket = node->ticket;
-
-    // Lock-free enqueue with priority (shorter writes first)
-    WriteNode* prev = NULL;
-    WriteNode* curr = NULL;
-
-    while (1) {
-        prev = NULL;
-        curr = queue->head;
-
-        // Find insertion point based on estimated lines
-        while (curr && curr->estimatedLines <= estimatedLines) {
-            prev = curr;
-            curr = curr->next;
-        }
-
-        node->next = curr;
-
-        if (prev == NULL) {
-            // Insert at head
-            if (InterlockedCompareExchangePointer((PVOID*)&queue->head, node, curr) == curr) {
-                if (curr == NULL) {
-                    InterlockedCompareExchangePointer((PVOID*)&queue->tail, node, NULL);
-                }
-                break;
-            }
-        }
-        else {
-            // Insert after prev
-            if (InterlockedCompareExchangePointer((PVOID*)&prev->next, node, curr) == curr) {
-                if (curr == NULL) {
-                    InterlockedCompareExchangePointer((PVOID*)&queue->tail, node, prev);
-                }
-                break;
-            }
-        }
-    }
+static void ReleaseClient(ClientContext* client) {
+    if (InterlockedDecrement(&client->refCount) > 0) return;
+    Metrics()->closes++;
+    DeleteCriticalSection(&client->cs);
+    FreeClientState(client);
+    free(client);
 }
 
-WriteNode* DequeueWrite(LockFreeQueue* queue) {
-    WriteNode* head;
-
-    while (1) {
-        head = queue->head;
-        if (head == NULL) return NULL;
-
-        // Check if it's this writer's turn
-        if (head->ticket == queue->currentTicket) {
-            if (InterlockedCompareExchangePointer((PVOID*)&queue->head, head->next, head) == head) {
-                if (head->next == NULL) {
-                    InterlockedCompareExchangePointer((PVOID*)&queue->tail, NULL, head);
-                }
-                InterlockedIncrement64(&queue->currentTicket);
-                return head;
-            }
-        }
-        else {
-            return NULL;
-        }
+// Called from FlushOutput under client->cs. The send holds a reference: its
+// completion flushes whatever was queued in the meantime.
+BOOL SendVector(ClientContext* client, Response* response) {
+    if (client->socket == INVALID_SOCKET) {
+        FreeResponse(response);
+        return FALSE;
     }
-}
 
-Document* FindDoc(const char* title) {
-    for (int i = 0; i < doc_count; i++) {
-        if (strcmp(docs[i].title, title) == 0)
-            return &docs[i];
-    }
-    return NULL;
-}
-
-void ParseCommand(const char* input, char* args[], int* argc) {
-    *argc = 0;
-    const char* p = input;
-
-    // Free previous args
-    for (int i = 0; i < 64 && args[i]; i++) {
-        free(args[i]);
-        args[i] = NULL;
-    }
-
-    while (*p && *argc < 64) {
-        while (*p == ' ' || *p == '\t') p++;
-        if (!*p) break;
-
-        if (*p == '"') {
-            p++;
-            const char* start = p;
-            while (*p && *p != '"') p++;
-            int len = (int)(p - start);
-            args[*argc] = (char*)malloc(len + 1);
-            strncpy(args[*argc], start, len);
-            args[*argc][len] = '\0';
-            (*argc)++;
-            if (*p == '"') p++;
-        }
-        else {
-            const char* start = p;
-            while (*p && *p != ' ' && *p != '\t' && *p != '\n' && *p != '\r') p++;
-            int len = (int)(p - start);
-            args[*argc] = (char*)malloc(len + 1);
-            strncpy(args[*argc], start, len);
-            args[*argc][len] = '\0';
-            (*argc)++;
-        }
-    }
-}
-
-BOOL SendData(ClientContext* client, const char* data, int len) {
-    PER_IO_DATA* ioData = (PER_IO_DATA*)malloc(sizeof(PER_IO_DATA));
+    PER_IO_DATA* ioData = AllocIoData();
     ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
     ioData->operation = OP_SEND;
     ioData->client = client;
+    ioData->response = response;
+    RetainClient(client);
 
-    if (len < 0) len = (int)strlen(data);
-    memcpy(ioData->buffer, data, len);
-    ioData->wsaBuf.buf = ioData->buffer;
-    ioData->wsaBuf.len = len;
-
+    // Every segment goes out with one WSASend; the buffers stay owned by the
+    // response until the completion frees it
     DWORD bytesSent;
-    if (WSASend(client->socket, &ioData->wsaBuf, 1, &bytesSent, 0,
+    if (WSASend(client->socket, response->segs, (DWORD)response->count, &bytesSent, 0,
         &ioData->overlapped, NULL) == SOCKET_ERROR) {
         if (WSAGetLastError() != WSA_IO_PENDING) {
-            printf("[ERROR] WSASend failed: %d\n", WSAGetLastError());
-            free(ioData);
+            LOG_ERROR("[ERROR] WSASend failed: %d\n", WSAGetLastError());
+            FreeResponse(response);
+            FreeIoData(ioData);
+            ReleaseClient(client);      // never the last: the caller holds one
             return FALSE;
         }
     }
     return TRUE;
 }
 
-void ProcessWriteLine(ClientContext* client, const char* line) {
-    printf("[Worker-%d] Processing write line: '%s'\n", GetCurrentThreadId(), line);
-    fflush(stdout);
-
-    if (strcmp(line, "<END>") == 0) {
-        printf("[Worker-%d] Write mode: END signal received, saving %d lines\n",
-            GetCurrentThreadId(), client->lineCount);
-        fflush(stdout);
-
-        // Enqueue write request
-        LockFreeQueue* queue = &sectionQueues[client->docIdx][client->sectionIdx];
-        EnqueueWrite(queue, client, client->lineCount);
-
-        // Wait for turn
-        while (1) {
-            WriteNode* node = DequeueWrite(queue);
-            if (node && node->client == client) {
-                // It's our turn, write to document
-                AcquireSRWLockExclusive(&docsLock);
-
-                Document* doc = &docs[client->docIdx];
-                doc->section_line_count[client->sectionIdx] = 0;
-
-                for (int j = 0; j < client->lineCount && j < MAX_LINES; j++) {
-                    strcpy(doc->section_contents[client->sectionIdx][j],
-                        client->tempLines[j]);
-                }
-                doc->section_line_count[client->sectionIdx] = client->lineCount;
-
-                ReleaseSRWLockExclusive(&docsLock);
-
-                free(node);
-                SendData(client, "[Write_Completed]\n", -1);
+// Connection is gone: close the socket and drop the posted recv's reference.
+// A commit still queued for this client keeps the context until it completes.
+static void CloseClient(ClientContext* client) {
+    EnterCriticalSection(&client->cs);
+    closesocket(client->socket);
+    client->socket = INVALID_SOCKET;
+    EnterCriticalSection(&g_timerLock);
+    TimerCancel(&g_timers, &client->timer);
+    LeaveCriticalSection(&g_timerLock);
+    LeaveCriticalSection(&client->cs);
+    ReleaseClient(client);
+}
 
-                // Write 모드 종료
-                client->isWriteMode = FALSE;
-                client->recvPos = 0;  // Reset receive buffer
+// Under client->cs: bring the client's timer forward if one of its deadlines
+// came closer. One that has moved further away (more traffic) is left for
+// the timer to find when it fires.
+static void UpdateTimer(ClientContext* client) {
+    if (client->socket == INVALID_SOCKET) return;
+    ULONGLONG due = ClientDeadline(client);
+    if (!due || (client->timerDue && client->timerDue <= due)) return;
+    client->timerDue = due;
+    EnterCriticalSection(&g_timerLock);
+    TimerArm(&g_timers, &client->timer, due);
+    LeaveCriticalSection(&g_timerLock);
+}
 
-                // Return to normal recv mode
-                PER_IO_DATA* recvData = (PER_IO_DATA*)malloc(sizeof(PER_IO_DATA));
-                ZeroMemory(&recvData->overlapped, sizeof(OVERLAPPED));
-                recvData->operation = OP_RECV;
-                recvData->client = client;
-                recvData->wsaBuf.buf = recvData->buffer;
-                recvData->wsaBuf.len = BUF_SIZE;
+// Main thread, under g_timerLock. The posted completion holds a reference;
+// the recv's, which keeps the client on the wheel, cannot be dropped while
+// the lock is held.
+static void PostTimeout(TimerNode* node, void* ctx) {
+    ClientContext* client = CONTAINING_RECORD(node, ClientContext, timer);
+    (void)ctx;
 
-                DWORD flags = 0;
-                DWORD bytesRecv = 0;
-                WSARecv(client->socket, &recvData->wsaBuf, 1, &bytesRecv,
-                    &flags, &recvData->overlapped, NULL);
-                break;
-            }
-            Sleep(1);
-        }
-    }
-    else {
-        // Store line
-        if (client->lineCount < MAX_LINES) {
-            strcpy(client->tempLines[client->lineCount], line);
-            client->lineCount++;
-            printf("[Worker-%d] Write mode: stored line %d: '%s'\n",
-                GetCurrentThreadId(), client->lineCount, line);
-            fflush(stdout);
-        }
-        SendData(client, ">> ", -1);
+    PER_IO_DATA* ioData = AllocIoData();
+    ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
+    ioData->operation = OP_TIMEOUT;
+    ioData->client = client;
+    RetainClient(client);
+
+    if (!PostQueuedCompletionStatus(g_hIOCP, 0, (ULONG_PTR)client, &ioData->overlapped)) {
+        LOG_ERROR("[ERROR] PostQueuedCompletionStatus failed: %d\n", GetLastError());
+        FreeIoData(ioData);
+        ReleaseClient(client);
+        // Checked again one tick later
+        TimerArm(&g_timers, &client->timer, MetricsNow());
     }
 }
 
-void ProcessCommand(ClientContext* client) {
-    if (client->argc == 0) return;
-
-    printf("[Server] Processing command: %s\n", client->args[0]);
-    fflush(stdout);
-
-    if (strcmp(client->args[0], "create") == 0) {
-        AcquireSRWLockExclusive(&docsLock);
-
-        if (client->argc < 3 || doc_count >= MAX_DOCS) {
-            ReleaseSRWLockExclusive(&docsLock);
-            SendData(client, "[Error] Invalid create command.\n", -1);
-            return;
-        }
-
-        if (FindDoc(client->args[1])) {
-            ReleaseSRWLockExclusive(&docsLock);
-            SendData(client, "[Error] Document already exists.\n", -1);
-            return;
-        }
-
-        int section_count = atoi(client->args[2]);
-        if (section_count <= 0 || section_count > MAX_SECTIONS ||
-            client->argc != 3 + section_count) {
-            ReleaseSRWLockExclusive(&docsLock);
-            SendData(client, "[Error] Invalid section count or titles.\n", -1);
-            return;
-        }
-
-        int idx = (int)doc_count;
-        strcpy(docs[idx].title, client->args[1]);
-        docs[idx].section_count = section_count;
-
-        for (int i = 0; i < section_count; i++) {
-            strcpy(docs[idx].section_titles[i], client->args[3 + i]);
-            docs[idx].section_line_count[i] = 0;
+// (Re)post the client's one recv. FALSE on a hard error.
+static BOOL PostRecv(ClientContext* client, PER_IO_DATA* ioData) {
+    ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
+    ioData->wsaBuf.buf = ioData->buffer;
+    ioData->wsaBuf.len = BUF_SIZE;
+
+    DWORD flags = 0;
+    DWORD bytesRecv = 0;
+    if (WSARecv(client->socket, &ioData->wsaBuf, 1, &bytesRecv,
+        &flags, &ioData->overlapped, NULL) == SOCKET_ERROR) {
+        int error = WSAGetLastError();
+        if (error != WSA_IO_PENDING) {
+            LOG_ERROR("[ERROR] WSARecv failed: %d\n", error);
+            return FALSE;
         }
-
-        InterlockedIncrement(&doc_count);
-        ReleaseSRWLockExclusive(&docsLock);
-
-        SendData(client, "[OK] Document created.\n", -1);
+        LOG_TRACE("[Worker-%d] WSARecv pending (normal)\n", GetCurrentThreadId());
     }
-    else if (strcmp(client->args[0], "write") == 0) {
-        if (client->argc < 3) {
-            SendData(client, "[Error] Invalid write command.\n", -1);
-            return;
-        }
-
-        AcquireSRWLockShared(&docsLock);
-        Document* doc = FindDoc(client->args[1]);
-        if (!doc) {
-            ReleaseSRWLockShared(&docsLock);
-            SendData(client, "[Error] Document not found.\n", -1);
-            return;
-        }
-
-        int section_idx = -1;
-        for (int i = 0; i < doc->section_count; i++) {
-            if (strcmp(doc->section_titles[i], client->args[2]) == 0) {
-                section_idx = i;
-                break;
-            }
-        }
-
-        if (section_idx == -1) {
-            ReleaseSRWLockShared(&docsLock);
-            SendData(client, "[Error] Section not found.\n", -1);
-            return;
-        }
+    return TRUE;
+}
 
-        client->docIdx = (int)(doc - docs);
-        client->sectionIdx = section_idx;
-        client->lineCount = 0;
-        client->recvPos = 0;  // Reset receive buffer
-        client->isWriteMode = TRUE;  // Set write mode flag
-        ReleaseSRWLockShared(&docsLock);
+// Flow control, under client->cs: a paused client's completed recv is kept
+// here instead of being reposted, which stops reading from the socket
+static void ParkRecv(ClientContext* client, PER_IO_DATA* ioData) {
+    client->parkedRecv = ioData;
+}
 
-        printf("[Server] Write mode enabled for client, doc=%d, section=%d\n",
-            client->docIdx, client->sectionIdx);
-        fflush(stdout);
+// Under client->cs: take the parked recv back, or NULL if there is none
+static PER_IO_DATA* UnparkRecv(ClientContext* client) {
+    PER_IO_DATA* ioData = client->parkedRecv;
+    client->parkedRecv = NULL;
+    return ioData;
+}
 
-        SendData(client, "[OK] You can start writing. Send <END> to finish.\n>> ", -1);
-        // Don't post new WSARecv here - the existing OP_RECV will handle it
+// Post a recv taken back by UnparkRecv, outside client->cs; the connection is
+// closed if that fails
+static void ResumeRecv(ClientContext* client, PER_IO_DATA* ioData) {
+    if (!ioData) return;
+    if (!PostRecv(client, ioData)) {
+        CloseClient(client);
+        FreeIoData(ioData);
     }
-    else if (strcmp(client->args[0], "read") == 0) {
-        char response[BUF_SIZE * 10] = { 0 };
-        int pos = 0;
-
-        AcquireSRWLockShared(&docsLock);
-
-        if (client->argc == 1) {
-            for (int i = 0; i < doc_count; i++) {
-                pos += sprintf(response + pos, "%s\n", docs[i].title);
-                for (int j = 0; j < docs[i].section_count; j++) {
-                    pos += sprintf(response + pos, "    %d. %s\n", j + 1, docs[i].section_titles[j]);
-                }
-            }
-        }
-        else if (client->argc >= 3) {
-            Document* doc = FindDoc(client->args[1]);
-            if (!doc) {
-                ReleaseSRWLockShared(&docsLock);
-                SendData(client, "[Error] Document not found.\n__END__\n", -1);
-                return;
-            }
-
-            int found = 0;
-            for (int i = 0; i < doc->section_count; i++) {
-                if (strcmp(doc->section_titles[i], client->args[2]) == 0) {
-                    found = 1;
-                    pos += sprintf(response + pos, "%s\n    %d. %s\n",
-                        doc->title, i + 1, doc->section_titles[i]);
-
-                    for (int j = 0; j < doc->section_line_count[i]; j++) {
-                        pos += sprintf(response + pos, "       %s\n",
-                            doc->section_contents[i][j]);
-                    }
-                    break;
-                }
-            }
-
-            if (!found) {
-                strcpy(response, "[Error] Section not found.\n");
-                pos = (int)strlen(response);
-            }
-        }
+}
 
-        ReleaseSRWLockShared(&docsLock);
+void PostWriteCompletion(ClientContext* client) {
+    // Any worker may pick this up; client->cs orders it against the recv path
+    PER_IO_DATA* ioData = AllocIoData();
+    ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
+    ioData->operation = OP_WRITE_WAIT;
+    ioData->client = client;
+    ioData->socket = client->socket;
 
-        strcpy(response + pos, "__END__\n");
-        SendData(client, response, -1);
-    }
-    else if (strcmp(client->args[0], "bye") == 0) {
-        SendData(client, "[Disconnected]\n", -1);
-        // 소켓 종료는 SendData 완료 후 처리
+    if (!PostQueuedCompletionStatus(g_hIOCP, 0, (ULONG_PTR)client, &ioData->overlapped)) {
+        LOG_ERROR("[ERROR] PostQueuedCompletionStatus failed: %d\n", GetLastError());
+        FreeIoData(ioData);
+        ReleaseClient(client);
     }
-    else {
-        SendData(client, "[Error] Unknown command.\n", -1);
+}
+
+void PostCommitDrain(Section* section) {
+    // Queued behind the completions already waiting, for whichever worker is free
+    PER_IO_DATA* ioData = AllocIoData();
+    ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
+    ioData->operation = OP_COMMIT_DRAIN;
+    ioData->client = NULL;
+    ioData->section = section;
+
+    if (!PostQueuedCompletionStatus(g_hIOCP, 0, 0, &ioData->overlapped)) {
+        // Not left pending: the turn is finished here instead
+        LOG_ERROR("[ERROR] PostQueuedCompletionStatus failed: %d\n", GetLastError());
+        FreeIoData(ioData);
+        DrainCommits(section);
     }
 }
 
@@ -467,93 +198,85 @@ unsigned __stdcall WorkerThread(void* param) {
     LPOVERLAPPED overlapped;
     PER_IO_DATA* ioData;
 
-    printf("[Worker] Thread %d started\n", GetCurrentThreadId());
-    fflush(stdout);  // 즉시 출력
+    LOG_INFO("[Worker] Thread %d started\n", GetCurrentThreadId());
 
     while (1) {
-        printf("[Worker-%d] Waiting for completion status...\n", GetCurrentThreadId());
-        fflush(stdout);
+        LOG_TRACE("[Worker-%d] Waiting for completion status...\n", GetCurrentThreadId());
 
         BOOL result = GetQueuedCompletionStatus(g_hIOCP, &bytesTransferred,
             &completionKey, &overlapped, INFINITE);
 
-        printf("[Worker-%d] Got completion status: result=%d, bytes=%d, overlapped=%p\n",
+        LOG_TRACE("[Worker-%d] Got completion status: result=%d, bytes=%d, overlapped=%p\n",
             GetCurrentThreadId(), result, bytesTransferred, overlapped);
-        fflush(stdout);
 
         if (!result) {
             DWORD error = GetLastError();
             if (overlapped == NULL) {
-                printf("[Worker-%d] GetQueuedCompletionStatus failed with NULL overlapped: %d\n",
+                LOG_ERROR("[Worker-%d] GetQueuedCompletionStatus failed with NULL overlapped: %d\n",
                     GetCurrentThreadId(), error);
-                fflush(stdout);
                 continue;
             }
 
-            printf("[Worker-%d] GetQueuedCompletionStatus failed: %d\n",
+            LOG_ERROR("[Worker-%d] GetQueuedCompletionStatus failed: %d\n",
                 GetCurrentThreadId(), error);
-            fflush(stdout);
             ioData = CONTAINING_RECORD(overlapped, PER_IO_DATA, overlapped);
 
-            // 연결이 끊어진 경우 정리
-            if (ioData->client) {
-                closesocket(ioData->client->socket);
-                DeleteCriticalSection(&ioData->client->cs);
-                for (int i = 0; i < 64 && ioData->client->args[i]; i++) {
-                    free(ioData->client->args[i]);
+            // 연결이 끊어진 경우 정리 (a failed send is followed by a failed recv)
+            if (ioData->client && ioData->operation == OP_RECV) {
+                CloseClient(ioData->client);
+            }
+            if (ioData->operation == OP_SEND) {
+                // A paused client has no recv posted to notice the failure
+                EnterCriticalSection(&ioData->client->cs);
+                PER_IO_DATA* parked = UnparkRecv(ioData->client);
+                LeaveCriticalSection(&ioData->client->cs);
+                if (parked) {
+                    CloseClient(ioData->client);
+                    FreeIoData(parked);
                 }
-                free(ioData->client);
+                FreeResponse(ioData->response);
+                ReleaseClient(ioData->client);
             }
-            free(ioData);
+            FreeIoData(ioData);
             continue;
         }
 
         // overlapped가 NULL인 경우 체크
         if (overlapped == NULL) {
-            printf("[Worker-%d] WARNING: overlapped is NULL but result is success\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_WARN("[Worker-%d] WARNING: overlapped is NULL but result is success\n", GetCurrentThreadId());
             continue;
         }
 
         ioData = CONTAINING_RECORD(overlapped, PER_IO_DATA, overlapped);
-        printf("[Worker-%d] Operation type: %d\n", GetCurrentThreadId(), ioData->operation);
-        fflush(stdout);
+        LOG_TRACE("[Worker-%d] Operation type: %d\n", GetCurrentThreadId(), ioData->operation);
 
         if (bytesTransferred == 0 && ioData->operation == OP_RECV)
         {
-            printf("[Worker-%d] Client disconnected (OP_RECV with 0 bytes)\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_DEBUG("[Worker-%d] Client disconnected (OP_RECV with 0 bytes)\n", GetCurrentThreadId());
             if (ioData->client)
             {
-                closesocket(ioData->client->socket);
-                DeleteCriticalSection(&ioData->client->cs);
-                for (int i = 0; i < 64 && ioData->client->args[i]; i++)
-                {
-                    free(ioData->client->args[i]);
-                }
-                free(ioData->client);
+                CloseClient(ioData->client);
             }
-            free(ioData);
+            FreeIoData(ioData);
             continue;
         }
 
         switch (ioData->operation) {
         case OP_ACCEPT: {
             // New client accepted
-            printf("[Worker-%d] Processing OP_ACCEPT, socket=%llu, bytesTransferred=%d\n",
+            LOG_TRACE("[Worker-%d] Processing OP_ACCEPT, socket=%llu, bytesTransferred=%d\n",
                 GetCurrentThreadId(), (ULONGLONG)ioData->socket, bytesTransferred);
-            fflush(stdout);
 
             // Check if socket is valid
             if (ioData->socket == INVALID_SOCKET) {
-                printf("[ERROR] Accept socket is invalid!\n");
-                free(ioData);
+                LOG_ERROR("[ERROR] Accept socket is invalid!\n");
+                FreeIoData(ioData);
                 break;
             }
 
             // If AcceptEx received initial data
             if (bytesTransferred > 0) {
-                printf("[Worker-%d] AcceptEx received %d bytes of initial data\n",
+                LOG_DEBUG("[Worker-%d] AcceptEx received %d bytes of initial data\n",
                     GetCurrentThreadId(), bytesTransferred);
                 // This data will be processed after WSARecv is set up
             }
@@ -562,9 +285,8 @@ unsigned __stdcall WorkerThread(void* param) {
             int updateResult = setsockopt(ioData->socket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
                 (char*)&g_listenSocket, sizeof(g_listenSocket));
 
-            printf("[Worker-%d] SO_UPDATE_ACCEPT_CONTEXT result: %d (error: %d)\n",
+            LOG_DEBUG("[Worker-%d] SO_UPDATE_ACCEPT_CONTEXT result: %d (error: %d)\n",
                 GetCurrentThreadId(), updateResult, WSAGetLastError());
-            fflush(stdout);
 
             // Set TCP_NODELAY for immediate send
             int flag = 1;
@@ -575,11 +297,12 @@ unsigned __stdcall WorkerThread(void* param) {
             ZeroMemory(newClient, sizeof(ClientContext));
             newClient->socket = ioData->socket;
             newClient->isWriteMode = FALSE;  // Initialize write mode flag
+            newClient->refCount = 1;         // held by the posted recv
+            newClient->activeAt = MetricsNow();
             InitializeCriticalSection(&newClient->cs);
 
-            printf("[Worker-%d] Created client context for socket %llu\n",
+            LOG_DEBUG("[Worker-%d] Created client context for socket %llu\n",
                 GetCurrentThreadId(), (ULONGLONG)newClient->socket);
-            fflush(stdout);
 
             // Get client address info
             SOCKADDR_IN clientAddr;
@@ -587,13 +310,11 @@ unsigned __stdcall WorkerThread(void* param) {
             if (getpeername(newClient->socket, (SOCKADDR*)&clientAddr, &addrLen) == 0) {
                 char ipStr[INET_ADDRSTRLEN];
                 inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, sizeof(ipStr));
-                printf("[Worker-%d] Client connected from %s:%d\n",
+                LOG_DEBUG("[Worker-%d] Client connected from %s:%d\n",
                     GetCurrentThreadId(), ipStr, ntohs(clientAddr.sin_port));
-                fflush(stdout);
             }
             else {
-                printf("[Worker-%d] getpeername failed: %d\n", GetCurrentThreadId(), WSAGetLastError());
-                fflush(stdout);
+                LOG_ERROR("[Worker-%d] getpeername failed: %d\n", GetCurrentThreadId(), WSAGetLastError());
             }
 
             // Associate client socket with IOCP
@@ -601,27 +322,30 @@ unsigned __stdcall WorkerThread(void* param) {
                 (ULONG_PTR)newClient, 0);
 
             if (hResult == NULL) {
-                printf("[ERROR] Failed to associate client socket with IOCP: %d\n", GetLastError());
+                LOG_ERROR("[ERROR] Failed to associate client socket with IOCP: %d\n", GetLastError());
                 closesocket(newClient->socket);
                 DeleteCriticalSection(&newClient->cs);
                 free(newClient);
-                free(ioData);
+                FreeIoData(ioData);
                 break;
             }
 
-            printf("[Worker-%d] Client socket associated with IOCP successfully\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_DEBUG("[Worker-%d] Client socket associated with IOCP successfully\n", GetCurrentThreadId());
+
+            // Idle timeout from now. Armed before the recv is posted, which may
+            // complete and close the client at once on another worker.
+            Metrics()->accepts++;
+            UpdateTimer(newClient);
 
             // Start receiving from client
-            PER_IO_DATA* recvData = (PER_IO_DATA*)malloc(sizeof(PER_IO_DATA));
+            PER_IO_DATA* recvData = AllocIoData();
             ZeroMemory(&recvData->overlapped, sizeof(OVERLAPPED));
             recvData->operation = OP_RECV;
             recvData->client = newClient;
             recvData->wsaBuf.buf = recvData->buffer;
             recvData->wsaBuf.len = BUF_SIZE;
 
-            printf("[Worker-%d] Starting WSARecv on client socket...\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_DEBUG("[Worker-%d] Starting WSARecv on client socket...\n", GetCurrentThreadId());
 
             DWORD flags = 0;
             DWORD bytesRecv = 0;
@@ -631,35 +355,30 @@ unsigned __stdcall WorkerThread(void* param) {
             if (recvResult == SOCKET_ERROR) {
                 int error = WSAGetLastError();
                 if (error != WSA_IO_PENDING) {
-                    printf("[ERROR] Initial WSARecv failed: %d\n", error);
-                    free(recvData);
-                    closesocket(newClient->socket);
-                    DeleteCriticalSection(&newClient->cs);
-                    free(newClient);
-                    free(ioData);
+                    LOG_ERROR("[ERROR] Initial WSARecv failed: %d\n", error);
+                    FreeIoData(recvData);
+                    CloseClient(newClient);     // off the wheel, then freed
+                    FreeIoData(ioData);
                     break;
                 }
                 else {
-                    printf("[Worker-%d] WSARecv pending (normal)\n", GetCurrentThreadId());
-                    fflush(stdout);
+                    LOG_TRACE("[Worker-%d] WSARecv pending (normal)\n", GetCurrentThreadId());
                 }
             }
             else {
-                printf("[Worker-%d] WSARecv completed immediately with %d bytes\n",
+                LOG_DEBUG("[Worker-%d] WSARecv completed immediately with %d bytes\n",
                     GetCurrentThreadId(), bytesRecv);
-                fflush(stdout);
             }
 
             // Post another AcceptEx
-            printf("[Worker-%d] Creating new accept socket...\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_DEBUG("[Worker-%d] Creating new accept socket...\n", GetCurrentThreadId());
 
             SOCKET newAcceptSocket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP,
                 NULL, 0, WSA_FLAG_OVERLAPPED);
 
             if (newAcceptSocket == INVALID_SOCKET) {
-                printf("[ERROR] Failed to create new accept socket: %d\n", WSAGetLastError());
-                free(ioData);
+                LOG_ERROR("[ERROR] Failed to create new accept socket: %d\n", WSAGetLastError());
+                FreeIoData(ioData);
                 break;
             }
 
@@ -675,188 +394,138 @@ unsigned __stdcall WorkerThread(void* param) {
                 &bytesReceived, &ioData->overlapped)) {
                 int error = WSAGetLastError();
                 if (error != WSA_IO_PENDING) {
-                    printf("[ERROR] AcceptEx failed: %d\n", error);
+                    LOG_ERROR("[ERROR] AcceptEx failed: %d\n", error);
                     closesocket(newAcceptSocket);
-                    free(ioData);
+                    FreeIoData(ioData);
                 }
                 else {
-                    printf("[Worker-%d] New AcceptEx pending (normal)\n", GetCurrentThreadId());
-                    fflush(stdout);
+                    LOG_DEBUG("[Worker-%d] New AcceptEx pending (normal)\n", GetCurrentThreadId());
                 }
             }
 
-            printf("[Worker-%d] OP_ACCEPT processing completed\n", GetCurrentThreadId());
-            fflush(stdout);
+            LOG_DEBUG("[Worker-%d] OP_ACCEPT processing completed\n", GetCurrentThreadId());
             break;
         }
 
         case OP_RECV: {
             ClientContext* client = ioData->client;
 
-            printf("[Worker-%d] Processing OP_RECV, bytes=%d, client=%p, isWriteMode=%d\n",
+            LOG_TRACE("[Worker-%d] Processing OP_RECV, bytes=%d, client=%p, isWriteMode=%d\n",
                 GetCurrentThreadId(), bytesTransferred, client, client ? client->isWriteMode : -1);
-            fflush(stdout);
 
             if (client == NULL) {
-                printf("[ERROR] Client context is NULL in OP_RECV!\n");
-                free(ioData);
+                LOG_ERROR("[ERROR] Client context is NULL in OP_RECV!\n");
+                FreeIoData(ioData);
                 break;
             }
 
             EnterCriticalSection(&client->cs);
+            ProcessRecvData(client, ioData->buffer, bytesTransferred);
+            FlushOutput(client);
+            UpdateTimer(client);
+            // Flow control: a paused client is not read from until its sends drain it
+            BOOL paused = client->inputPaused;
+            if (paused) ParkRecv(client, ioData);
+            LeaveCriticalSection(&client->cs);
+            if (paused) break;
+
+            // Continue receiving
+            LOG_TRACE("[Worker-%d] Posting next WSARecv...\n", GetCurrentThreadId());
+            if (!PostRecv(client, ioData)) {
+                CloseClient(client);
+                FreeIoData(ioData);
+            }
+            break;
+        }
 
-            // Check if in write mode
-            if (client->isWriteMode) {
-                printf("[Worker-%d] OP_RECV in write mode - processing as write data\n", GetCurrentThreadId());
-                fflush(stdout);
-
-                // Process as write data
-                for (DWORD i = 0; i < bytesTransferred; i++) {
-                    char ch = ioData->buffer[i];
-
-                    if (ch == '\n' || ch == '\r') {
-                        if (client->recvPos > 0) {
-                            client->recvBuffer[client->recvPos] = '\0';
-                            printf("[Worker-%d] Write mode line received: '%s'\n",
-                                GetCurrentThreadId(), client->recvBuffer);
-                            fflush(stdout);
-
-                            ProcessWriteLine(client, client->recvBuffer);
-                            client->recvPos = 0;
-                        }
-                    }
-                    else if (client->recvPos < BUF_SIZE - 1) {
-                        client->recvBuffer[client->recvPos++] = ch;
-                    }
-                }
+        case OP_WRITE_WAIT: {
+            // A queued commit was applied by whichever thread drained the section
+            ClientContext* client = ioData->client;
 
-                LeaveCriticalSection(&client->cs);
+            PER_IO_DATA* resume = NULL;
+            EnterCriticalSection(&client->cs);
+            if (client->socket != INVALID_SOCKET) {
+                CompleteWrite(client);
+                FlushOutput(client);
+                UpdateTimer(client);
+                if (!client->inputPaused) resume = UnparkRecv(client);
+            }
+            LeaveCriticalSection(&client->cs);
+            ResumeRecv(client, resume);
 
-                // Continue receiving if still in write mode
-                if (client->isWriteMode) {
-                    ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
-                    ioData->wsaBuf.buf = ioData->buffer;
-                    ioData->wsaBuf.len = BUF_SIZE;
+            FreeIoData(ioData);
+            ReleaseClient(client);
+            break;
+        }
 
-                    DWORD flags = 0;
-                    DWORD bytesRecv = 0;
-                    WSARecv(client->socket, &ioData->wsaBuf, 1, &bytesRecv,
-                        &flags, &ioData->overlapped, NULL);
-                }
-                else {
-                    free(ioData);
-                }
-            }
-            else {
-                // Normal command mode
-                // Print received data as hex for debugging
-                printf("[Worker-%d] Received data (hex): ", GetCurrentThreadId());
-                for (DWORD i = 0; i < bytesTransferred && i < 32; i++) {
-                    printf("%02X ", (unsigned char)ioData->buffer[i]);
-                }
-                printf("\n");
-
-                // Print received data as string
-                printf("[Worker-%d] Received data (str): ", GetCurrentThreadId());
-                for (DWORD i = 0; i < bytesTransferred; i++) {
-                    if (ioData->buffer[i] >= 32 && ioData->buffer[i] <= 126) {
-                        printf("%c", ioData->buffer[i]);
-                    }
-                    else {
-                        printf("\\x%02X", (unsigned char)ioData->buffer[i]);
-                    }
-                }
-                printf("\n");
-                fflush(stdout);
-
-                // Process received data
-                BOOL processedCommand = FALSE;
-                for (DWORD i = 0; i < bytesTransferred; i++) {
-                    char ch = ioData->buffer[i];
-
-                    if (ch == '\n' || ch == '\r') {
-                        if (client->recvPos > 0) {
-                            client->recvBuffer[client->recvPos] = '\0';
-                            printf("[Worker-%d] Complete command line: '%s'\n",
-                                GetCurrentThreadId(), client->recvBuffer);
-                            fflush(stdout);
-
-                            ParseCommand(client->recvBuffer, client->args, &client->argc);
-                            ProcessCommand(client);
-                            processedCommand = TRUE;
-                            client->recvPos = 0;
-                        }
-                    }
-                    else if (client->recvPos < BUF_SIZE - 1) {
-                        client->recvBuffer[client->recvPos++] = ch;
-                    }
-                }
+        case OP_COMMIT_DRAIN:
+            // A combiner ran out of passes; the section's writes continue here
+            DrainCommits(ioData->section);
+            FreeIoData(ioData);
+            break;
 
-                // If no command was processed, send an echo to test connection
-                if (!processedCommand && bytesTransferred > 0) {
-                    printf("[Worker-%d] No complete command, sending echo test\n", GetCurrentThreadId());
-                    char echoMsg[256];
-                    sprintf(echoMsg, "[Echo] Received %d bytes\n", bytesTransferred);
-                    SendData(client, echoMsg, -1);
-                    fflush(stdout);
-                }
+        case OP_SEND: {
+            ClientContext* client = ioData->client;
+            LOG_TRACE("[Worker-%d] Send completed: %d bytes\n", GetCurrentThreadId(), bytesTransferred);
 
-                LeaveCriticalSection(&client->cs);
-
-                // Continue receiving
-                printf("[Worker-%d] Posting next WSARecv...\n", GetCurrentThreadId());
-                fflush(stdout);
-
-                ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
-                ioData->wsaBuf.buf = ioData->buffer;
-                ioData->wsaBuf.len = BUF_SIZE;
-
-                DWORD flags = 0;
-                DWORD bytesRecv = 0;
-                if (WSARecv(client->socket, &ioData->wsaBuf, 1, &bytesRecv,
-                    &flags, &ioData->overlapped, NULL) == SOCKET_ERROR) {
-                    int error = WSAGetLastError();
-                    if (error != WSA_IO_PENDING) {
-                        printf("[ERROR] WSARecv failed: %d\n", error);
-                        closesocket(client->socket);
-                        DeleteCriticalSection(&client->cs);
-                        for (int i = 0; i < 64 && client->args[i]; i++) {
-                            free(client->args[i]);
-                        }
-                        free(client);
-                        free(ioData);
-                    }
-                    else {
-                        printf("[Worker-%d] WSARecv pending (normal)\n", GetCurrentThreadId());
-                        fflush(stdout);
-                    }
+            // Everything queued while this send was in flight goes out next
+            PER_IO_DATA* resume = NULL;
+            EnterCriticalSection(&client->cs);
+            if (client->socket != INVALID_SOCKET) {
+                if (SendCompleted(client)) {
+                    LOG_DEBUG("[Worker-%d] Disconnection message sent, closing socket\n", GetCurrentThreadId());
+                    //소켓만 닫고, 클라이언트 리소스는 OP_RECV 0바이트 완료 쪽에서 처리해준다.
+                    // Shut down rather than close: CloseClient closes the handle once,
+                    // and a commit still queued may hold the context until then.
+                    shutdown(client->socket, SD_BOTH);
+                    resume = UnparkRecv(client);   // so a parked recv sees the EOF
+                }
+                else {
+                    FlushOutput(client);
+                    UpdateTimer(client);
+                    // Reading starts again once a paused client has drained
+                    if (!client->inputPaused) resume = UnparkRecv(client);
                 }
             }
-            break;
-        }
+            LeaveCriticalSection(&client->cs);
+            ResumeRecv(client, resume);
 
-        case OP_WRITE_WAIT: {
-            // This case should not be reached anymore
-            printf("[Worker-%d] WARNING: OP_WRITE_WAIT reached (deprecated)\n", GetCurrentThreadId());
-            free(ioData);
+            FreeResponse(ioData->response);
+            FreeIoData(ioData);
+            ReleaseClient(client);
             break;
         }
 
-        case OP_SEND:
-            printf("[Worker-%d] Send completed: %d bytes\n", GetCurrentThreadId(), bytesTransferred);
-            fflush(stdout);
+        case OP_TIMEOUT: {
+            // The client's timer fired on the main thread: a deadline may have passed
+            ClientContext* client = ioData->client;
 
-            if (ioData->client && strstr(ioData->buffer, "[Disconnected]"))
-            {
-                printf("[Worker-%d] Disconnection message sent, closing socket\n", GetCurrentThreadId());
-                fflush(stdout);
-                //소켓만 닫고, 클라이언트 리소스는 OP_RECV 0바이트 완료 쪽에서 처리해준다.
-                closesocket(ioData->client->socket);
-           }
+            PER_IO_DATA* parked = NULL;
+            EnterCriticalSection(&client->cs);
+            client->timerDue = 0;
+            if (client->socket != INVALID_SOCKET) {
+                if (ClientTimedOut(client, MetricsNow())) {
+                    // A posted recv fails once cancelled and its completion
+                    // closes the client; a parked one is closed here
+                    parked = UnparkRecv(client);
+                    if (!parked) CancelIoEx((HANDLE)client->socket, NULL);
+                }
+                else {
+                    UpdateTimer(client);
+                }
+            }
+            LeaveCriticalSection(&client->cs);
+            if (parked) {
+                // Fails the send in flight; the parked recv's reference goes here
+                CloseClient(client);
+                FreeIoData(parked);
+            }
 
-            free(ioData);
+            FreeIoData(ioData);
+            ReleaseClient(client);
             break;
         }
+        }
     }
 
     return 0;
@@ -868,31 +537,29 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
-    // stdout 버퍼링 비활성화
-    setvbuf(stdout, NULL, _IONBF, 0);
+    // Console output goes through the drain thread from here on
+    if (!LogInit()) {
+        fprintf(stderr, "Failed to start the log thread\n");
+        return 1;
+    }
 
-    printf("[Server] Starting IOCP server...\n");
+    LOG_INFO("[Server] Starting IOCP server...\n");
 
     WSADATA wsaData;
     if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-        printf("[ERROR] WSAStartup failed\n");
+        LOG_ERROR("[ERROR] WSAStartup failed\n");
         return 1;
     }
 
-    // Initialize SRW lock
-    InitializeSRWLock(&docsLock);
-
-    // Initialize lock-free queues
-    for (int i = 0; i < MAX_DOCS; i++) {
-        for (int j = 0; j < MAX_SECTIONS; j++) {
-            InitializeLockFreeQueue(&sectionQueues[i][j]);
-        }
-    }
+    // Initialize document store and write queues
+    InitializeDocStore();
+    InitializeCriticalSection(&g_timerLock);
+    TimerWheelInit(&g_timers, MetricsNow());
 
     // Create IOCP
     g_hIOCP = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
     if (g_hIOCP == NULL) {
-        printf("[ERROR] Failed to create IOCP: %d\n", GetLastError());
+        LOG_ERROR("[ERROR] Failed to create IOCP: %d\n", GetLastError());
         return 1;
     }
 
@@ -901,7 +568,7 @@ int main(int argc, char* argv[]) {
         NULL, 0, WSA_FLAG_OVERLAPPED);
 
     if (g_listenSocket == INVALID_SOCKET) {
-        printf("[ERROR] Failed to create listen socket: %d\n", WSAGetLastError());
+        LOG_ERROR("[ERROR] Failed to create listen socket: %d\n", WSAGetLastError());
         return 1;
     }
 
@@ -911,21 +578,21 @@ int main(int argc, char* argv[]) {
     serverAddr.sin_port = htons(atoi(argv[2]));
 
     if (inet_pton(AF_INET, argv[1], &serverAddr.sin_addr) <= 0) {
-        printf("[ERROR] Invalid IP address: %s\n", argv[1]);
+        LOG_ERROR("[ERROR] Invalid IP address: %s\n", argv[1]);
         return 1;
     }
 
     if (bind(g_listenSocket, (SOCKADDR*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        printf("[ERROR] Bind failed: %d\n", WSAGetLastError());
+        LOG_ERROR("[ERROR] Bind failed: %d\n", WSAGetLastError());
         return 1;
     }
 
     if (listen(g_listenSocket, SOMAXCONN) == SOCKET_ERROR) {
-        printf("[ERROR] Listen failed: %d\n", WSAGetLastError());
+        LOG_ERROR("[ERROR] Listen failed: %d\n", WSAGetLastError());
         return 1;
     }
 
-    printf("[Server] Socket bound and listening on %s:%s\n", argv[1], argv[2]);
+    LOG_INFO("[Server] Socket bound and listening on %s:%s\n", argv[1], argv[2]);
 
     // 실제 바인딩된 주소 확인
     SOCKADDR_IN actualAddr;
@@ -933,12 +600,12 @@ int main(int argc, char* argv[]) {
     if (getsockname(g_listenSocket, (SOCKADDR*)&actualAddr, &addrLen) == 0) {
         char ipStr[INET_ADDRSTRLEN];
         inet_ntop(AF_INET, &actualAddr.sin_addr, ipStr, sizeof(ipStr));
-        printf("[Server] Actually listening on %s:%d\n", ipStr, ntohs(actualAddr.sin_port));
+        LOG_INFO("[Server] Actually listening on %s:%d\n", ipStr, ntohs(actualAddr.sin_port));
     }
 
     // Associate listen socket with IOCP
     if (CreateIoCompletionPort((HANDLE)g_listenSocket, g_hIOCP, 0, 0) == NULL) {
-        printf("[ERROR] Failed to associate listen socket with IOCP: %d\n", GetLastError());
+        LOG_ERROR("[ERROR] Failed to associate listen socket with IOCP: %d\n", GetLastError());
         return 1;
     }
 
@@ -948,11 +615,11 @@ int main(int argc, char* argv[]) {
     if (WSAIoctl(g_listenSocket, SIO_GET_EXTENSION_FUNCTION_POINTER,
         &guidAcceptEx, sizeof(guidAcceptEx), &lpfnAcceptEx, sizeof(lpfnAcceptEx),
         &dwBytes, NULL, NULL) == SOCKET_ERROR) {
-        printf("[ERROR] Failed to load AcceptEx: %d\n", WSAGetLastError());
+        LOG_ERROR("[ERROR] Failed to load AcceptEx: %d\n", WSAGetLastError());
         return 1;
     }
 
-    printf("[Server] AcceptEx loaded successfully\n");
+    LOG_INFO("[Server] AcceptEx loaded successfully\n");
 
     // Create worker threads
     SYSTEM_INFO sysInfo;
@@ -960,45 +627,41 @@ int main(int argc, char* argv[]) {
     int numThreads = sysInfo.dwNumberOfProcessors * 2;
     if (numThreads > MAX_WORKERS) numThreads = MAX_WORKERS;
 
-    printf("[Server] Creating %d worker threads...\n", numThreads);
-    fflush(stdout);
+    LOG_INFO("[Server] Creating %d worker threads...\n", numThreads);
 
     for (int i = 0; i < numThreads; i++) {
         unsigned int threadId;
         HANDLE hThread = (HANDLE)_beginthreadex(NULL, 0, WorkerThread, NULL, 0, &threadId);
         if (hThread == NULL) {
-            printf("[ERROR] Failed to create worker thread %d\n", i);
+            LOG_ERROR("[ERROR] Failed to create worker thread %d\n", i);
         }
         else {
-            printf("[Server] Worker thread %d created with ID %u\n", i, threadId);
+            LOG_INFO("[Server] Worker thread %d created with ID %u\n", i, threadId);
             CloseHandle(hThread);  // 핸들은 닫아도 스레드는 계속 실행됨
         }
-        fflush(stdout);
     }
 
-    printf("[Server] All worker threads created\n");
-    fflush(stdout);
+    LOG_INFO("[Server] All worker threads created\n");
 
     // Start accepting connections
-    printf("[Server] Starting accept loop...\n");
+    LOG_INFO("[Server] Starting accept loop...\n");
 
     for (int i = 0; i < 10; i++) {
         SOCKET acceptSocket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP,
             NULL, 0, WSA_FLAG_OVERLAPPED);
 
         if (acceptSocket == INVALID_SOCKET) {
-            printf("[ERROR] Failed to create accept socket: %d\n", WSAGetLastError());
+            LOG_ERROR("[ERROR] Failed to create accept socket: %d\n", WSAGetLastError());
             continue;
         }
 
-        PER_IO_DATA* ioData = (PER_IO_DATA*)malloc(sizeof(PER_IO_DATA));
+        PER_IO_DATA* ioData = AllocIoData();
         ZeroMemory(&ioData->overlapped, sizeof(OVERLAPPED));
         ioData->operation = OP_ACCEPT;
         ioData->socket = acceptSocket;
 
-        printf("[Server] Calling AcceptEx for socket %d (handle: %llu)...\n",
+        LOG_DEBUG("[Server] Calling AcceptEx for socket %d (handle: %llu)...\n",
             i, (ULONGLONG)acceptSocket);
-        fflush(stdout);
 
         DWORD bytesReceived;
         if (!lpfnAcceptEx(g_listenSocket, acceptSocket, ioData->buffer, 0,
@@ -1006,24 +669,35 @@ int main(int argc, char* argv[]) {
             &bytesReceived, &ioData->overlapped)) {
             int error = WSAGetLastError();
             if (error != WSA_IO_PENDING) {
-                printf("[ERROR] AcceptEx failed: %d\n", error);
+                LOG_ERROR("[ERROR] AcceptEx failed: %d\n", error);
                 closesocket(acceptSocket);
-                free(ioData);
+                FreeIoData(ioData);
             }
             else {
-                printf("[Server] AcceptEx pending on socket %d\n", i);
+                LOG_DEBUG("[Server] AcceptEx pending on socket %d\n", i);
             }
         }
         else {
-            printf("[Server] AcceptEx completed immediately on socket %d\n", i);
+            LOG_DEBUG("[Server] AcceptEx completed immediately on socket %d\n", i);
         }
     }
 
-    printf("[Server] IOCP Server ready. Waiting for connections...\n");
-    printf("[Server] Main thread going to sleep. Worker threads are handling connections.\n");
+    LOG_INFO("[Server] IOCP Server ready. Waiting for connections...\n");
+    LOG_INFO("[Server] Main thread going to sleep. Worker threads are handling connections.\n");
 
-    // Wait forever
-    Sleep(INFINITE);
+    // Main thread only drives the timer wheel and reports allocator counters
+    // from here on
+    ULONGLONG lastStats = GetTickCount64();
+    while (1) {
+        Sleep(TIMER_TICK_MS);
+        EnterCriticalSection(&g_timerLock);
+        TimerWheelAdvance(&g_timers, MetricsNow(), PostTimeout, NULL);
+        LeaveCriticalSection(&g_timerLock);
+        if (GetTickCount64() - lastStats >= POOL_STATS_INTERVAL_MS) {
+            lastStats = GetTickCount64();
+            PrintPoolStats();
+        }
+    }
 
     closesocket(g_listenSocket);
     CloseHandle(g_hIOCP);
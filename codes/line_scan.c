@@ -0,0 +1,195 @@
+/// line_scan.c
+#include "line_scan.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define LINE_SCAN_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(_MSC_VER)
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+// Up to four bytes to look for; unused slots repeat the first one
+typedef struct {
+    char b[4];
+} ByteSet;
+
+static const ByteSet lineSet = { { '\n', '\r', '\n', '\n' } };
+static const ByteSet tokenSet = { { ' ', '\t', '\n', '\r' } };
+static const ByteSet quoteSet = { { '"', '"', '"', '"' } };
+
+typedef size_t (*ScanFn)(const char* data, size_t len, const ByteSet* set);
+
+static size_t ScanScalar(const char* data, size_t len, const ByteSet* set) {
+    for (size_t i = 0; i < len; i++) {
+        char c = data[i];
+        if (c == set->b[0] || c == set->b[1] || c == set->b[2] || c == set->b[3]) return i;
+    }
+    return len;
+}
+
+#ifdef LINE_SCAN_X86
+
+static unsigned LowestBit(unsigned mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (unsigned)index;
+#else
+    return (unsigned)__builtin_ctz(mask);
+#endif
+}
+
+static size_t ScanSse2(const char* data, size_t len, const ByteSet* set) {
+    const __m128i a = _mm_set1_epi8(set->b[0]);
+    const __m128i b = _mm_set1_epi8(set->b[1]);
+    const __m128i c = _mm_set1_epi8(set->b[2]);
+    const __m128i d = _mm_set1_epi8(set->b[3]);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, a), _mm_cmpeq_epi8(v, b)),
+            _mm_or_si128(_mm_cmpeq_epi8(v, c), _mm_cmpeq_epi8(v, d)));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) return i + LowestBit(mask);
+    }
+    return i + ScanScalar(data + i, len - i, set);
+}
+
+TARGET_AVX2 static size_t ScanAvx2(const char* data, size_t len, const ByteSet* set) {
+    const __m256i a = _mm256_set1_epi8(set->b[0]);
+    const __m256i b = _mm256_set1_epi8(set->b[1]);
+    const __m256i c = _mm256_set1_epi8(set->b[2]);
+    const __m256i d = _mm256_set1_epi8(set->b[3]);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(data + i));
+        __m256i hit = _mm256_or_si256(
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, a), _mm256_cmpeq_epi8(v, b)),
+            _mm256_or_si256(_mm256_cmpeq_epi8(v, c), _mm256_cmpeq_epi8(v, d)));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(hit);
+        if (mask) return i + LowestBit(mask);
+    }
+
+    // Command lines are short, so most of them end up here. Kept in this
+    // function rather than calling ScanSse2: its legacy-encoded SSE right
+    // after 256-bit code costs a state transition on many CPUs.
+    if (i + 16 <= len) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(data + i));
+        __m128i hit = _mm_or_si128(
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(a)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(b))),
+            _mm_or_si128(_mm_cmpeq_epi8(v, _mm256_castsi256_si128(c)), _mm_cmpeq_epi8(v, _mm256_castsi256_si128(d))));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) return i + LowestBit(mask);
+        i += 16;
+    }
+    return i + ScanScalar(data + i, len - i, set);
+}
+
+static BOOL CpuHasAvx2(void) {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return FALSE;
+    __cpuid(info, 1);
+    if (!(info[2] & (1 << 27))) return FALSE;           // OSXSAVE
+    if ((_xgetbv(0) & 6) != 6) return FALSE;            // OS saves YMM state
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") != 0;
+#endif
+}
+
+#endif // LINE_SCAN_X86
+
+static ScanFn g_scan = ScanScalar;
+static LineScanPath g_path = LINE_SCAN_SCALAR;
+
+BOOL LineScanUse(LineScanPath path) {
+    switch (path) {
+    case LINE_SCAN_SCALAR:
+        g_scan = ScanScalar;
+        break;
+#ifdef LINE_SCAN_X86
+    case LINE_SCAN_SSE2:
+        g_scan = ScanSse2;      // part of the x86-64 baseline
+        break;
+    case LINE_SCAN_AVX2:
+        if (!CpuHasAvx2()) return FALSE;
+        g_scan = ScanAvx2;
+        break;
+#endif
+    default:
+        return FALSE;
+    }
+    g_path = path;
+    return TRUE;
+}
+
+void LineScanInit(void) {
+    if (!LineScanUse(LINE_SCAN_AVX2) && !LineScanUse(LINE_SCAN_SSE2)) {
+        LineScanUse(LINE_SCAN_SCALAR);
+    }
+}
+
+LineScanPath LineScanCurrent(void) {
+    return g_path;
+}
+
+const char* LineScanName(LineScanPath path) {
+    switch (path) {
+    case LINE_SCAN_SSE2: return "sse2";
+    case LINE_SCAN_AVX2: return "avx2";
+    default: return "scalar";
+    }
+}
+
+size_t ScanLineEnd(const char* data, size_t len) {
+    return g_scan(data, len, &lineSet);
+}
+
+size_t ScanTokenEnd(const char* data, size_t len) {
+    return g_scan(data, len, &tokenSet);
+}
+
+size_t ScanQuote(const char* data, size_t len) {
+    return g_scan(data, len, &quoteSet);
+}
+
+int TokenizeCommand(char* line, size_t len, char* args[], int maxArgs) {
+    int argc = 0;
+    size_t i = 0;
+
+    while (argc < maxArgs) {
+        // Separators are usually a single space; not worth a vector load
+        while (i < len && (line[i] == ' ' || line[i] == '\t')) i++;
+        if (i >= len) break;
+
+        size_t start;
+        if (line[i] == '"') {
+            start = ++i;
+            i += ScanQuote(line + i, len - i);
+        }
+        else {
+            start = i;
+            i += ScanTokenEnd(line + i, len - i);
+        }
+
+        // The closing quote or separator becomes the terminator
+        args[argc++] = line + start;
+        line[i] = '\0';
+        if (i < len) i++;
+    }
+    return argc;
+}
@@ -0,0 +1,37 @@
+/// line_scan.h
+// Delimiter scanning and in-place tokenizing for the text protocol.
+//
+// The scans look for the first of a small set of bytes 16 (SSE2) or 32
+// (AVX2) bytes at a time, falling back to a byte loop for the tail and on
+// CPUs or compilers without either. LineScanInit picks the widest path the
+// CPU supports; until it runs the scalar path is used, which gives the same
+// results.
+#ifndef LINE_SCAN_H
+#define LINE_SCAN_H
+
+#include "platform.h"
+
+typedef enum {
+    LINE_SCAN_SCALAR,
+    LINE_SCAN_SSE2,
+    LINE_SCAN_AVX2
+} LineScanPath;
+
+// Select the best path for this CPU; call once at startup
+void LineScanInit(void);
+// Force a path (benchmarks); FALSE if this build or CPU cannot run it
+BOOL LineScanUse(LineScanPath path);
+LineScanPath LineScanCurrent(void);
+const char* LineScanName(LineScanPath path);
+
+// Offset of the first byte of the set in data, or len if there is none
+size_t ScanLineEnd(const char* data, size_t len);       // '\n' '\r'
+size_t ScanTokenEnd(const char* data, size_t len);      // ' ' '\t' '\n' '\r'
+size_t ScanQuote(const char* data, size_t len);         // '"'
+
+// Split a command line into arguments without allocating: each argument is a
+// slice of line, terminated in place (line[len] must be writable). Quoted
+// arguments may contain spaces. Returns the argument count, at most maxArgs.
+int TokenizeCommand(char* line, size_t len, char* args[], int maxArgs);
+
+#endif // LINE_SCAN_H
@@ -0,0 +1,372 @@
+/// linux_server.c
+// Linux entry point. Every worker thread gets its own listen socket bound with
+// SO_REUSEPORT, so the kernel spreads incoming connections across workers and
+// a connection is owned by exactly one event loop for its whole lifetime.
+// The event loop itself is io_uring when the kernel allows it, otherwise an
+// edge-triggered epoll reactor.
+#include "linux_server.h"
+#include "io_pool.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <signal.h>
+#include <sys/eventfd.h>
+
+// Global variables
+static Worker g_workers[MAX_WORKERS];
+static THREAD_LOCAL Worker* t_worker = NULL;     // the worker running on this thread
+
+// Function prototypes
+void* WorkerThread(void* param);
+
+ClientContext* CreateClientContext(Worker* w, SOCKET sock) {
+    // Set TCP_NODELAY for immediate send
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
+
+    // Create new client context
+    ClientContext* newClient = (ClientContext*)malloc(sizeof(ClientContext));
+    ZeroMemory(newClient, sizeof(ClientContext));
+    newClient->socket = sock;
+    newClient->isWriteMode = FALSE;
+    newClient->worker = w;
+    newClient->activeAt = MetricsNow();
+    InitializeCriticalSection(&newClient->cs);
+    Metrics()->accepts++;
+    UpdateClient(newClient);
+
+    struct sockaddr_in clientAddr;
+    socklen_t addrLen = sizeof(clientAddr);
+    if (getpeername(sock, (struct sockaddr*)&clientAddr, &addrLen) == 0) {
+        char ipStr[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &clientAddr.sin_addr, ipStr, sizeof(ipStr));
+        LOG_DEBUG("[Worker-%d] Client connected from %s:%d\n",
+            GetCurrentThreadId(), ipStr, ntohs(clientAddr.sin_port));
+    }
+    return newClient;
+}
+
+void DestroyClientContext(ClientContext* client) {
+    TimerCancel(&client->worker->timers, &client->timer);
+    Metrics()->closes++;
+    LOG_DEBUG("[Worker-%d] Releasing client context for socket %d\n",
+        GetCurrentThreadId(), client->socket);
+
+    closesocket(client->socket);
+    DeleteCriticalSection(&client->cs);
+    FreeClientState(client);
+    free(client);
+}
+
+PER_IO_DATA* NewSendData(ClientContext* client, Response* response) {
+    PER_IO_DATA* ioData = AllocIoData();
+    ioData->operation = OP_SEND;
+    ioData->client = client;
+    ioData->socket = client->socket;
+    ioData->next = NULL;
+    ioData->response = response;
+
+    // The backend sends straight from the response's segments
+    ioData->segsLeft = response->count;
+    ZeroMemory(&ioData->msg, sizeof(ioData->msg));
+    ioData->msg.msg_iov = response->segs;
+    ioData->msg.msg_iovlen = response->count < IOV_MAX ? response->count : IOV_MAX;
+    return ioData;
+}
+
+BOOL SendVector(ClientContext* client, Response* response) {
+    if (client->closing) {
+        FreeResponse(response);
+        return FALSE;
+    }
+    return client->worker->backend->postSend(client, NewSendData(client, response));
+}
+
+BOOL AdvanceSend(PER_IO_DATA* ioData, size_t sent) {
+    struct iovec* iov = ioData->msg.msg_iov;
+    while (ioData->segsLeft > 0 && sent >= iov->iov_len) {
+        sent -= iov->iov_len;
+        iov++;
+        ioData->segsLeft--;
+    }
+    if (ioData->segsLeft == 0) return FALSE;
+
+    iov->iov_base = (char*)iov->iov_base + sent;
+    iov->iov_len -= sent;
+    ioData->msg.msg_iov = iov;
+    ioData->msg.msg_iovlen = ioData->segsLeft < IOV_MAX ? ioData->segsLeft : IOV_MAX;
+    return TRUE;
+}
+
+void FreeSendData(PER_IO_DATA* ioData) {
+    FreeResponse(ioData->response);
+    FreeIoData(ioData);
+}
+
+// Only ever brought forward here. A deadline that has moved further away
+// (more traffic) is left for the timer to find when it fires.
+static void UpdateTimer(ClientContext* client) {
+    ULONGLONG due = ClientDeadline(client);
+    if (!due || (client->timerDue && client->timerDue <= due)) return;
+    client->timerDue = due;
+    TimerArm(&client->worker->timers, &client->timer, due);
+}
+
+void UpdateClient(ClientContext* client) {
+    Worker* w = client->worker;
+    if (client->closing) return;
+    UpdateTimer(client);
+    if (client->inputPaused == client->readStopped) return;
+
+    client->readStopped = client->inputPaused;
+    if (client->readStopped) w->backend->pauseRecv(client);
+    else w->backend->resumeRecv(client);
+}
+
+void ShutdownClient(ClientContext* client) {
+    client->closing = TRUE;
+    shutdown(client->socket, SHUT_RDWR);
+    TimerCancel(&client->worker->timers, &client->timer);
+    if (client->readStopped) {
+        client->readStopped = FALSE;
+        client->worker->backend->resumeRecv(client);
+    }
+}
+
+static void ClientTimerExpired(TimerNode* node, void* ctx) {
+    ClientContext* client = CONTAINING_RECORD(node, ClientContext, timer);
+    (void)ctx;
+    client->timerDue = 0;
+    if (client->closing) return;
+
+    EnterCriticalSection(&client->cs);
+    BOOL expired = ClientTimedOut(client, MetricsNow());
+    LeaveCriticalSection(&client->cs);
+    if (expired) ShutdownClient(client);
+    else UpdateTimer(client);
+}
+
+void RunTimers(Worker* w) {
+    TimerWheelAdvance(&w->timers, MetricsNow(), ClientTimerExpired, NULL);
+}
+
+int TimerTimeout(Worker* w) {
+    return TimerWheelTimeout(&w->timers, MetricsNow());
+}
+
+void RetainClient(ClientContext* client) {
+    // Called from ProcessRecvData, which only ever runs on the owning worker
+    client->ioRefs++;
+}
+
+static void PostToMailbox(Worker* w, PER_IO_DATA* ioData) {
+    PER_IO_DATA* head;
+    do {
+        head = w->mailbox;
+        ioData->next = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&w->mailbox, ioData, head) != head);
+
+    // A non-empty mailbox already has a wakeup on its way
+    if (head == NULL) {
+        uint64_t one = 1;
+        if (write(w->wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            LOG_ERROR("[ERROR] Failed to wake worker %d: %d\n", w->id, errno);
+        }
+    }
+}
+
+void PostWriteCompletion(ClientContext* client) {
+    PER_IO_DATA* ioData = AllocIoData();
+    ioData->operation = OP_WRITE_WAIT;
+    ioData->client = client;
+    ioData->socket = client->socket;
+
+    // Only the owning worker may touch the client's socket and ring
+    PostToMailbox(client->worker, ioData);
+}
+
+void PostCommitDrain(Section* section) {
+    // Through the wakeup like any other post, so the events already
+    // waiting on this worker run first
+    PER_IO_DATA* ioData = AllocIoData();
+    ioData->operation = OP_COMMIT_DRAIN;
+    ioData->client = NULL;
+    ioData->section = section;
+    PostToMailbox(t_worker, ioData);
+}
+
+void DrainMailbox(Worker* w) {
+    PER_IO_DATA* list = (PER_IO_DATA*)InterlockedExchangePointer((PVOID*)&w->mailbox, NULL);
+
+    // The stack is newest first; complete in posting order
+    PER_IO_DATA* ordered = NULL;
+    while (list) {
+        PER_IO_DATA* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+
+    while (ordered) {
+        PER_IO_DATA* ioData = ordered;
+        ClientContext* client = ioData->client;
+        ordered = ioData->next;
+
+        if (ioData->operation == OP_COMMIT_DRAIN) {
+            DrainCommits(ioData->section);
+            FreeIoData(ioData);
+            continue;
+        }
+
+        // OP_WRITE_WAIT: the section drainer applied this client's commit
+        if (!client->closing) {
+            EnterCriticalSection(&client->cs);
+            CompleteWrite(client);
+            FlushOutput(client);
+            LeaveCriticalSection(&client->cs);
+            UpdateClient(client);
+        }
+        FreeIoData(ioData);
+        w->backend->releaseClient(client);
+    }
+}
+
+static SOCKET CreateListenSocket(const struct sockaddr_in* addr) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) {
+        LOG_ERROR("[ERROR] Failed to create listen socket: %d\n", errno);
+        return INVALID_SOCKET;
+    }
+
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) == SOCKET_ERROR) {
+        LOG_ERROR("[ERROR] SO_REUSEPORT failed: %d\n", errno);
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    if (bind(sock, (const struct sockaddr*)addr, sizeof(*addr)) == SOCKET_ERROR) {
+        LOG_ERROR("[ERROR] Bind failed: %d\n", errno);
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    if (listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+        LOG_ERROR("[ERROR] Listen failed: %d\n", errno);
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
+
+void* WorkerThread(void* param) {
+    Worker* w = (Worker*)param;
+    t_worker = w;
+
+    LOG_INFO("[Worker] Thread %d started (%s)\n", GetCurrentThreadId(), w->backend->name);
+    TimerWheelInit(&w->timers, MetricsNow());
+
+    if (!w->backend->init(w)) {
+        LOG_ERROR("[ERROR] Worker %d could not initialise the %s backend\n", w->id, w->backend->name);
+        exit(1);
+    }
+
+    w->backend->run(w);
+    return NULL;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <IP> <Port> [uring|epoll]\n", argv[0]);
+        return 1;
+    }
+
+    // Console output goes through the drain thread from here on
+    if (!LogInit()) {
+        fprintf(stderr, "Failed to start the log thread\n");
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    // Pick the event loop: io_uring unless it is unavailable or epoll was requested
+    const LinuxBackend* backend = NULL;
+    if (argc == 4) {
+        if (strcmp(argv[3], g_uringBackend.name) == 0) backend = &g_uringBackend;
+        else if (strcmp(argv[3], g_epollBackend.name) == 0) backend = &g_epollBackend;
+        else {
+            fprintf(stderr, "Unknown backend: %s\n", argv[3]);
+            return 1;
+        }
+        if (!backend->probe()) {
+            LOG_ERROR("[ERROR] The %s backend is not supported by this kernel\n", backend->name);
+            return 1;
+        }
+    }
+    else {
+        backend = g_uringBackend.probe() ? &g_uringBackend : &g_epollBackend;
+    }
+
+    LOG_INFO("[Server] Starting %s server...\n", backend->name);
+
+    // Initialize document store and write queues
+    InitializeDocStore();
+
+    struct sockaddr_in serverAddr;
+    ZeroMemory(&serverAddr, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(atoi(argv[2]));
+
+    if (inet_pton(AF_INET, argv[1], &serverAddr.sin_addr) <= 0) {
+        LOG_ERROR("[ERROR] Invalid IP address: %s\n", argv[1]);
+        return 1;
+    }
+
+    // One worker (and one listener) per core
+    long numThreads = sysconf(_SC_NPROCESSORS_ONLN);
+    if (numThreads < 1) numThreads = 1;
+    if (numThreads > MAX_WORKERS) numThreads = MAX_WORKERS;
+
+    // Bind every listener before any worker starts accepting
+    for (int i = 0; i < numThreads; i++) {
+        g_workers[i].id = i;
+        g_workers[i].backend = backend;
+        g_workers[i].listenSocket = CreateListenSocket(&serverAddr);
+        if (g_workers[i].listenSocket == INVALID_SOCKET) return 1;
+
+        g_workers[i].wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (g_workers[i].wakeFd < 0) {
+            LOG_ERROR("[ERROR] eventfd failed: %d\n", errno);
+            return 1;
+        }
+    }
+
+    LOG_INFO("[Server] %ld listeners bound on %s:%s (SO_REUSEPORT)\n", numThreads, argv[1], argv[2]);
+    LOG_INFO("[Server] Creating %ld worker threads...\n", numThreads);
+
+    for (int i = 0; i < numThreads; i++) {
+        // A listener without a worker would strand the connections hashed to it
+        if (pthread_create(&g_workers[i].thread, NULL, WorkerThread, &g_workers[i]) != 0) {
+            LOG_ERROR("[ERROR] Failed to create worker thread %d\n", i);
+            return 1;
+        }
+        LOG_INFO("[Server] Worker thread %d created\n", i);
+    }
+
+    LOG_INFO("[Server] %s server ready. Waiting for connections...\n", backend->name);
+
+    // Main thread only reports allocator counters from here on
+    while (1) {
+        Sleep(POOL_STATS_INTERVAL_MS);
+        PrintPoolStats();
+    }
+
+    for (int i = 0; i < numThreads; i++) {
+        closesocket(g_workers[i].listenSocket);
+    }
+    return 0;
+}
@@ -0,0 +1,69 @@
+/// linux_server.h
+// Linux event-loop backends. linux_server.c owns startup, the per-worker
+// SO_REUSEPORT listeners and client context lifetime; each backend drives one
+// worker's completions/readiness events and dispatches them through the same
+// OP_ACCEPT / OP_RECV / OP_SEND / OP_WRITE_WAIT cases as the IOCP WorkerThread.
+#ifndef LINUX_SERVER_H
+#define LINUX_SERVER_H
+
+#include "docs_server.h"
+
+typedef struct {
+    const char* name;
+    BOOL (*probe)(void);                        // can this kernel run the backend?
+    BOOL (*init)(Worker* w);                    // per-worker setup, on the worker thread
+    void (*run)(Worker* w);                     // event loop, never returns
+    BOOL (*postSend)(ClientContext* client, PER_IO_DATA* ioData);
+    void (*releaseClient)(ClientContext* client);   // drop one ioRefs reference
+    void (*pauseRecv)(ClientContext* client);       // stop reading (flow control)
+    void (*resumeRecv)(ClientContext* client);      // read again, from where it stopped
+} LinuxBackend;
+
+// One worker per thread; nothing here is shared between workers
+struct Worker {
+    int id;
+    pthread_t thread;
+    SOCKET listenSocket;        // this worker's SO_REUSEPORT listener
+    const LinuxBackend* backend;
+    void* state;                // backend-private loop state
+
+    // Completions posted by other threads (OP_WRITE_WAIT), and the worker's
+    // own deferred commit turns (OP_COMMIT_DRAIN). Producers push
+    // onto the stack and signal wakeFd (an eventfd) when it was empty; the
+    // backend watches wakeFd and calls DrainMailbox.
+    PER_IO_DATA* volatile mailbox;
+    int wakeFd;
+
+    // Deadlines of this worker's clients (ClientContext::timer). The backend
+    // waits no longer than TimerTimeout and calls RunTimers after each batch
+    // of events.
+    TimerWheel timers;
+};
+
+extern const LinuxBackend g_uringBackend;
+extern const LinuxBackend g_epollBackend;
+
+// linux_server.c
+ClientContext* CreateClientContext(Worker* w, SOCKET sock);
+void DestroyClientContext(ClientContext* client);
+void DrainMailbox(Worker* w);   // after wakeFd has been read
+// OP_SEND for a response taken from the client's output queue
+PER_IO_DATA* NewSendData(ClientContext* client, Response* response);
+// Account for sent bytes of an OP_SEND; TRUE while part of it is still unsent.
+// msg then covers the rest, at most IOV_MAX segments per call.
+BOOL AdvanceSend(PER_IO_DATA* ioData, size_t sent);
+void FreeSendData(PER_IO_DATA* ioData);     // the IO data and its response
+
+// After handling anything for a client: stop or resume reading to match
+// client->inputPaused (flow control), and bring its timer forward if one of
+// its deadlines came closer
+void UpdateClient(ClientContext* client);
+// Shut the connection down from this side; reading resumes so the receive
+// sees the end of the stream and releases the client as usual
+void ShutdownClient(ClientContext* client);
+// Disconnect the clients whose deadlines have passed
+void RunTimers(Worker* w);
+// Milliseconds the event loop may wait: -1 (forever) if no timer is armed
+int TimerTimeout(Worker* w);
+
+#endif // LINUX_SERVER_H
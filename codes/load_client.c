@@ -0,0 +1,887 @@
+/// load_client.c
+// Load generator for the document server: many connections driven from a few
+// threads, each polling its share of the sockets.
+//
+// Usage: load_client [options] [ip port]      (address from config.txt if omitted)
+//   -c N        connections (100)
+//   -t N        threads (4)
+//   -d S        measured seconds (10)
+//   -w S        warm-up seconds, not recorded (2)
+//   -r RATE     open loop at RATE requests/s in total; 0 = closed loop (0)
+//   -i USEC     closed loop: expected interval for coordinated-omission correction
+//   -m C:W:R    request mix in percent: create, write, read (5:25:70)
+//   -l N        lines per write (10)
+//   -D N        documents created up front (16)
+//   -S N        sections per document (4)
+//   -p PROTO    text or binary (text)
+//
+// Closed loop: every connection sends its next request as soon as the last
+// one is answered. Open loop: every connection has a fixed schedule, and a
+// request that could not be sent on time because the previous one was still
+// outstanding is timed from when it should have been sent, so a stalled
+// server shows up in the tail instead of simply slowing the load down
+// (coordinated omission). In closed loop the same correction is applied if
+// -i gives the interval requests were meant to arrive at.
+#include "platform.h"
+#include "docs_protocol.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef _WIN32
+typedef WSAPOLLFD PollFd;
+#define PollSockets(fds, n, ms) WSAPoll((fds), (ULONG)(n), (ms))
+#else
+#include <poll.h>
+#include <fcntl.h>
+#include <signal.h>
+typedef struct pollfd PollFd;
+#define PollSockets(fds, n, ms) poll((fds), (nfds_t)(n), (ms))
+#endif
+
+#define LOAD_MAX_THREADS 64
+#define LOAD_RECV_SIZE 65536
+#define LOAD_TITLE_SIZE 64
+
+// Latency histogram: exact below 128us, then 64 buckets per power of two
+// (under 1.6% error), up to about 2^40us
+#define HIST_SUB_BITS 7
+#define HIST_SUB (1 << HIST_SUB_BITS)
+#define HIST_HALF (HIST_SUB / 2)
+#define HIST_SHIFTS 40
+#define HIST_SIZE (HIST_SUB + HIST_SHIFTS * HIST_HALF)
+
+typedef struct {
+    ULONGLONG counts[HIST_SIZE];
+    ULONGLONG total;
+    ULONGLONG max;
+} Histogram;
+
+typedef enum {
+    KIND_CREATE,
+    KIND_WRITE,
+    KIND_READ,
+    KIND_COUNT,
+    KIND_NONE = KIND_COUNT
+} RequestKind;
+
+static const char* kindNames[KIND_COUNT] = { "create", "write", "read" };
+
+typedef struct {
+    SOCKET sock;
+    int index;
+    RequestKind kind;           // in flight, or KIND_NONE
+    ULONGLONG intended;         // when the request should have been sent
+    ULONGLONG sentAt;           // when it actually was
+    ULONGLONG nextDue;          // open loop: next slot in the schedule
+    int created;                // documents created by this connection
+
+    char* out;                  // request bytes not yet sent
+    size_t outLen;
+    size_t outPos;
+    size_t outCap;
+
+    // Text: end of the response is a terminator string, or a number of lines
+    // when a write was refused and its lines come back as unknown commands
+    const char* term;
+    size_t termLen;
+    size_t matched;
+    int linesLeft;
+    size_t seen;                // bytes of this response so far
+    char first[2];              // first two bytes, "[E" marks an error
+
+    // Binary: header, then the payload it announces
+    unsigned char header[DOCS_FRAME_HEADER_SIZE];
+    size_t headerHave;
+    size_t bodyLeft;
+    BOOL failed;
+} LoadConn;
+
+typedef struct {
+    int index;
+    LoadConn* conns;
+    int count;
+    Histogram latency[KIND_COUNT];      // from the intended send time
+    Histogram service;                  // from the actual send time, all kinds
+    ULONGLONG completed[KIND_COUNT];    // responses, without back-filled samples
+    ULONGLONG errors;
+    ULONGLONG dropped;                  // connections lost
+    ULONGLONG late;                     // open loop: sent after their slot
+} LoadThread;
+
+// Options
+static char g_ip[64] = "127.0.0.1";
+static int g_port = 8080;
+static int g_connections = 100;
+static int g_threads = 4;
+static int g_seconds = 10;
+static int g_warmup = 2;
+static double g_rate = 0;
+static ULONGLONG g_expected = 0;
+static int g_mix[KIND_COUNT] = { 5, 25, 70 };
+static int g_lines = 10;
+static int g_docs = 16;
+static int g_sections = 4;
+static BOOL g_binary = FALSE;
+
+static unsigned g_runId;
+static ULONGLONG g_start;           // start of warm-up
+static ULONGLONG g_measureFrom;
+static ULONGLONG g_end;
+
+static ULONGLONG NowMicros(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (ULONGLONG)(now.QuadPart / freq.QuadPart * 1000000 +
+        now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000 + (ULONGLONG)ts.tv_nsec / 1000;
+#endif
+}
+
+static int HighestBit(ULONGLONG v) {
+    int bit = 0;
+    while (v >>= 1) bit++;
+    return bit;
+}
+
+static int HistIndex(ULONGLONG v) {
+    if (v < HIST_SUB) return (int)v;
+    int shift = HighestBit(v) - HIST_SUB_BITS + 1;     // v >> shift is in [HALF, SUB)
+    if (shift > HIST_SHIFTS) return HIST_SIZE - 1;
+    return HIST_SUB + (shift - 1) * HIST_HALF + (int)((v >> shift) - HIST_HALF);
+}
+
+// Highest value that lands in bucket i
+static ULONGLONG HistValue(int i) {
+    if (i < HIST_SUB) return (ULONGLONG)i;
+    int shift = (i - HIST_SUB) / HIST_HALF + 1;
+    ULONGLONG mantissa = (ULONGLONG)((i - HIST_SUB) % HIST_HALF + HIST_HALF);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static void HistRecord(Histogram* h, ULONGLONG v) {
+    h->counts[HistIndex(v)]++;
+    h->total++;
+    if (v > h->max) h->max = v;
+}
+
+// Back-fill the samples a closed-loop client would have taken while it was
+// stuck waiting (HdrHistogram's recordValueWithExpectedInterval)
+static void HistRecordCorrected(Histogram* h, ULONGLONG v, ULONGLONG expected) {
+    HistRecord(h, v);
+    if (expected == 0 || v <= expected) return;
+    for (ULONGLONG missing = v - expected; missing >= expected; missing -= expected) {
+        HistRecord(h, missing);
+    }
+}
+
+static void HistMerge(Histogram* into, const Histogram* from) {
+    for (int i = 0; i < HIST_SIZE; i++) into->counts[i] += from->counts[i];
+    into->total += from->total;
+    if (from->max > into->max) into->max = from->max;
+}
+
+static ULONGLONG HistPercentile(const Histogram* h, double pct) {
+    if (h->total == 0) return 0;
+    ULONGLONG rank = (ULONGLONG)(pct / 100.0 * h->total + 0.5);
+    if (rank < 1) rank = 1;
+    ULONGLONG seen = 0;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) return HistValue(i) < h->max ? HistValue(i) : h->max;
+    }
+    return h->max;
+}
+
+static void ReadConfig(const char* filename, char* ip, int* port) {
+    FILE* fp = fopen(filename, "r");
+    if (!fp) return;
+
+    char line[512];
+    while (fgets(line, sizeof(line), fp)) {
+        if (strncmp(line, "docs_server", 11) == 0) {
+            char* p = strchr(line, '=');
+            if (p) {
+                p++;
+                while (*p == ' ' || *p == '\t') p++;
+                sscanf(p, "%63s %d", ip, port);
+                break;
+            }
+        }
+    }
+    fclose(fp);
+}
+
+static BOOL WouldBlock(void) {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+static BOOL SetNonBlocking(SOCKET sock) {
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket(sock, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+static BOOL SendAll(SOCKET sock, const char* data, size_t len) {
+    while (len > 0) {
+        int n = send(sock, data, (int)len, 0);
+        if (n <= 0) return FALSE;
+        data += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static BOOL RecvAll(SOCKET sock, char* data, size_t len) {
+    while (len > 0) {
+        int n = recv(sock, data, (int)len, 0);
+        if (n <= 0) return FALSE;
+        data += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+static SOCKET Connect(void) {
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock == INVALID_SOCKET) return INVALID_SOCKET;
+
+    int flag = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (char*)&flag, sizeof(flag));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)g_port);
+    if (inet_pton(AF_INET, g_ip, &addr.sin_addr) <= 0 ||
+        connect(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        closesocket(sock);
+        return INVALID_SOCKET;
+    }
+
+    if (g_binary) {
+        char reply[DOCS_BINARY_MAGIC_SIZE];
+        if (!SendAll(sock, DOCS_BINARY_MAGIC, DOCS_BINARY_MAGIC_SIZE) ||
+            !RecvAll(sock, reply, sizeof(reply)) ||
+            memcmp(reply, DOCS_BINARY_MAGIC, DOCS_BINARY_MAGIC_SIZE) != 0) {
+            closesocket(sock);
+            return INVALID_SOCKET;
+        }
+    }
+    return sock;
+}
+
+// Request building
+
+static BOOL Reserve(LoadConn* conn, size_t len) {
+    if (conn->outLen + len <= conn->outCap) return TRUE;
+    size_t cap = conn->outCap ? conn->outCap : 4096;
+    while (cap < conn->outLen + len) cap *= 2;
+    char* out = (char*)realloc(conn->out, cap);
+    if (!out) return FALSE;
+    conn->out = out;
+    conn->outCap = cap;
+    return TRUE;
+}
+
+static void Append(LoadConn* conn, const void* data, size_t len) {
+    if (!Reserve(conn, len)) return;
+    memcpy(conn->out + conn->outLen, data, len);
+    conn->outLen += len;
+}
+
+static void AppendText(LoadConn* conn, const char* text) {
+    Append(conn, text, strlen(text));
+}
+
+static size_t g_frameStart;
+
+static void BeginFrame(LoadConn* conn) {
+    unsigned char header[DOCS_FRAME_HEADER_SIZE] = { 0 };
+    g_frameStart = conn->outLen;
+    Append(conn, header, sizeof(header));
+}
+
+static void AppendField(LoadConn* conn, const char* data, size_t len) {
+    unsigned char prefix[4];
+    DocsPutU32(prefix, (uint32_t)len);
+    Append(conn, prefix, 4);
+    Append(conn, data, len);
+}
+
+static void EndFrame(LoadConn* conn, DocsOpcode opcode, uint32_t fields) {
+    DocsFrameHeader header;
+    header.opcode = (uint8_t)opcode;
+    header.status = 0;
+    header.fieldCount = fields;
+    header.length = (uint32_t)(conn->outLen - g_frameStart - DOCS_FRAME_HEADER_SIZE);
+    header.requestId = (uint32_t)conn->index;
+    if (conn->outLen >= g_frameStart + DOCS_FRAME_HEADER_SIZE) {
+        DocsEncodeHeader((unsigned char*)conn->out + g_frameStart, &header);
+    }
+}
+
+static const char* g_words[] = {
+    "the", "server", "section", "document", "completion", "port", "socket",
+    "buffer", "worker", "thread", "commit", "snapshot", "version", "queue",
+};
+
+// A line of ordinary text; never a command name, so a refused write's lines
+// all come back as "Unknown command"
+static int MakeLine(char* out, unsigned* seed) {
+    int len = 0;
+    int words = 4 + (int)(*seed % 12);
+    for (int i = 0; i < words; i++) {
+        *seed = *seed * 1103515245u + 12345u;
+        const char* w = g_words[(*seed >> 16) % (sizeof(g_words) / sizeof(g_words[0]))];
+        len += sprintf(out + len, i ? " %s" : "%s", w);
+    }
+    return len;
+}
+
+static RequestKind PickKind(unsigned* seed) {
+    *seed = *seed * 1103515245u + 12345u;
+    int r = (int)((*seed >> 16) % 100);
+    if (r < g_mix[KIND_CREATE]) return KIND_CREATE;
+    if (r < g_mix[KIND_CREATE] + g_mix[KIND_WRITE]) return KIND_WRITE;
+    return KIND_READ;
+}
+
+static void ExpectText(LoadConn* conn, const char* term) {
+    conn->term = term;
+    conn->termLen = strlen(term);
+    conn->matched = 0;
+    conn->linesLeft = 0;
+}
+
+static void BuildRequest(LoadConn* conn, RequestKind kind, unsigned* seed) {
+    char doc[LOAD_TITLE_SIZE], section[16];
+    *seed = *seed * 1103515245u + 12345u;
+    snprintf(doc, sizeof(doc), "load-%u-%d", g_runId, (int)((*seed >> 16) % g_docs));
+    snprintf(section, sizeof(section), "s%d", (int)((*seed >> 8) % g_sections));
+
+    conn->outLen = conn->outPos = 0;
+    conn->seen = 0;
+    conn->headerHave = 0;
+    conn->failed = FALSE;
+
+    if (kind == KIND_CREATE) {
+        snprintf(doc, sizeof(doc), "load-%u-c%d-%d", g_runId, conn->index, conn->created++);
+        if (g_binary) {
+            BeginFrame(conn);
+            AppendField(conn, doc, strlen(doc));
+            AppendField(conn, "s0", 2);
+            EndFrame(conn, DOCS_OP_CREATE, 2);
+        }
+        else {
+            char line[128];
+            snprintf(line, sizeof(line), "create \"%s\" 1 \"s0\"\n", doc);
+            AppendText(conn, line);
+            ExpectText(conn, "\n");
+        }
+    }
+    else if (kind == KIND_WRITE) {
+        char line[256];
+        if (g_binary) {
+            BeginFrame(conn);
+            AppendField(conn, doc, strlen(doc));
+            AppendField(conn, section, strlen(section));
+            for (int i = 0; i < g_lines; i++) AppendField(conn, line, (size_t)MakeLine(line, seed));
+            EndFrame(conn, DOCS_OP_WRITE, 2 + (uint32_t)g_lines);
+        }
+        else {
+            // The whole block at once; the server runs pipelined lines in order
+            snprintf(line, sizeof(line), "write \"%s\" \"%s\"\n", doc, section);
+            AppendText(conn, line);
+            for (int i = 0; i < g_lines; i++) {
+                int len = MakeLine(line, seed);
+                line[len++] = '\n';
+                Append(conn, line, (size_t)len);
+            }
+            AppendText(conn, "<END>\n");
+            ExpectText(conn, "[Write_Completed]\n");
+        }
+    }
+    else {
+        if (g_binary) {
+            BeginFrame(conn);
+            AppendField(conn, doc, strlen(doc));
+            AppendField(conn, section, strlen(section));
+            EndFrame(conn, DOCS_OP_READ, 2);
+        }
+        else {
+            char line[128];
+            snprintf(line, sizeof(line), "read \"%s\" \"%s\"\n", doc, section);
+            AppendText(conn, line);
+            ExpectText(conn, "\n__END__\n");
+        }
+    }
+    conn->kind = kind;
+}
+
+// Response tracking. Returns the number of bytes that belong to the current
+// response; *done is set once it is complete.
+
+static size_t ConsumeText(LoadConn* conn, const char* data, size_t len, BOOL* done) {
+    for (size_t i = 0; i < len; i++) {
+        char ch = data[i];
+        if (conn->seen < 2) conn->first[conn->seen] = ch;
+        conn->seen++;
+
+        // A refused write: the error line, then one per line and <END>
+        if (conn->seen == 2 && conn->kind == KIND_WRITE && conn->first[0] == '[' && conn->first[1] == 'E') {
+            conn->failed = TRUE;
+            conn->linesLeft = g_lines + 2;
+        }
+        if (conn->linesLeft > 0) {
+            if (ch == '\n' && --conn->linesLeft == 0) {
+                *done = TRUE;
+                return i + 1;
+            }
+            continue;
+        }
+
+        if (ch == conn->term[conn->matched]) {
+            if (++conn->matched == conn->termLen) {
+                if (conn->first[0] == '[' && conn->first[1] == 'E') conn->failed = TRUE;
+                *done = TRUE;
+                return i + 1;
+            }
+        }
+        else {
+            conn->matched = ch == conn->term[0] ? 1 : 0;
+        }
+    }
+    return len;
+}
+
+static size_t ConsumeFrame(LoadConn* conn, const char* data, size_t len, BOOL* done) {
+    size_t used = 0;
+    if (conn->headerHave < DOCS_FRAME_HEADER_SIZE) {
+        size_t take = DOCS_FRAME_HEADER_SIZE - conn->headerHave;
+        if (take > len) take = len;
+        memcpy(conn->header + conn->headerHave, data, take);
+        conn->headerHave += take;
+        used = take;
+        if (conn->headerHave < DOCS_FRAME_HEADER_SIZE) return used;
+
+        DocsFrameHeader header;
+        DocsDecodeHeader(conn->header, &header);
+        conn->bodyLeft = header.length;
+        if (header.status != DOCS_STATUS_OK) conn->failed = TRUE;
+    }
+
+    size_t take = len - used < conn->bodyLeft ? len - used : conn->bodyLeft;
+    conn->bodyLeft -= take;
+    used += take;
+    if (conn->bodyLeft == 0) *done = TRUE;
+    return used;
+}
+
+static void CloseConn(LoadThread* thread, LoadConn* conn) {
+    closesocket(conn->sock);
+    conn->sock = INVALID_SOCKET;
+    conn->kind = KIND_NONE;
+    thread->dropped++;
+}
+
+static BOOL FlushRequest(LoadConn* conn) {
+    while (conn->outPos < conn->outLen) {
+        int n = send(conn->sock, conn->out + conn->outPos, (int)(conn->outLen - conn->outPos), 0);
+        if (n < 0) return WouldBlock();
+        conn->outPos += (size_t)n;
+    }
+    return TRUE;
+}
+
+static void StartRequest(LoadThread* thread, LoadConn* conn, ULONGLONG intended, unsigned* seed) {
+    BuildRequest(conn, PickKind(seed), seed);
+    conn->intended = intended;
+    conn->sentAt = NowMicros();
+    if (!FlushRequest(conn)) CloseConn(thread, conn);
+}
+
+static void FinishRequest(LoadThread* thread, LoadConn* conn, ULONGLONG now) {
+    if (conn->intended >= g_measureFrom) {
+        ULONGLONG latency = now - conn->intended;
+        if (g_rate > 0) HistRecord(&thread->latency[conn->kind], latency);
+        else HistRecordCorrected(&thread->latency[conn->kind], latency, g_expected);
+        HistRecord(&thread->service, now - conn->sentAt);
+        thread->completed[conn->kind]++;
+        if (conn->failed) thread->errors++;
+    }
+    conn->kind = KIND_NONE;
+}
+
+static void RunThread(LoadThread* thread) {
+    char* buf = (char*)malloc(LOAD_RECV_SIZE);
+    PollFd* fds = (PollFd*)calloc((size_t)thread->count, sizeof(PollFd));
+    LoadConn** polled = (LoadConn**)calloc((size_t)thread->count, sizeof(LoadConn*));
+    if (!buf || !fds || !polled) {
+        printf("[Load] Out of memory\n");
+        exit(1);
+    }
+    unsigned seed = 0x9E3779B9u * (unsigned)(thread->index + 1);
+    ULONGLONG interval = g_rate > 0 ? (ULONGLONG)(g_connections * 1e6 / g_rate) : 0;
+
+    // Spread the connections' schedules over one interval
+    for (int i = 0; i < thread->count; i++) {
+        LoadConn* conn = &thread->conns[i];
+        conn->kind = KIND_NONE;
+        conn->nextDue = g_start + interval * (ULONGLONG)conn->index / (ULONGLONG)g_connections;
+    }
+
+    for (;;) {
+        ULONGLONG now = NowMicros();
+        if (now >= g_end) break;
+
+        // Start what is due; a connection still busy picks its slot up late
+        ULONGLONG wake = g_end;
+        int n = 0;
+        for (int i = 0; i < thread->count; i++) {
+            LoadConn* conn = &thread->conns[i];
+            if (conn->sock == INVALID_SOCKET) continue;
+
+            if (conn->kind == KIND_NONE) {
+                if (interval == 0) {
+                    StartRequest(thread, conn, now, &seed);
+                }
+                else if (now >= conn->nextDue) {
+                    if (now - conn->nextDue > interval) thread->late++;
+                    StartRequest(thread, conn, conn->nextDue, &seed);
+                    conn->nextDue += interval;
+                }
+                if (conn->sock == INVALID_SOCKET) continue;
+            }
+            if (interval > 0 && conn->kind == KIND_NONE && conn->nextDue < wake) wake = conn->nextDue;
+
+            fds[n].fd = conn->sock;
+            fds[n].events = POLLIN;
+            if (conn->outPos < conn->outLen) fds[n].events |= POLLOUT;
+            fds[n].revents = 0;
+            polled[n++] = conn;
+        }
+        if (n == 0 && interval == 0) break;
+
+        now = NowMicros();
+        int timeout = wake > now ? (int)((wake - now + 999) / 1000) : 0;
+        if (timeout > 100) timeout = 100;
+        if (PollSockets(fds, n, timeout) < 0) continue;
+
+        for (int i = 0; i < n; i++) {
+            LoadConn* conn = polled[i];
+            if (fds[i].revents & POLLOUT) {
+                if (!FlushRequest(conn)) {
+                    CloseConn(thread, conn);
+                    continue;
+                }
+            }
+            if (!(fds[i].revents & (POLLIN | POLLERR | POLLHUP))) continue;
+
+            for (;;) {
+                int got = recv(conn->sock, buf, LOAD_RECV_SIZE, 0);
+                if (got < 0 && WouldBlock()) break;
+                if (got <= 0 || conn->kind == KIND_NONE) {
+                    // Closed, failed, or bytes nobody asked for
+                    CloseConn(thread, conn);
+                    break;
+                }
+
+                BOOL done = FALSE;
+                size_t used = g_binary ? ConsumeFrame(conn, buf, (size_t)got, &done)
+                    : ConsumeText(conn, buf, (size_t)got, &done);
+                if (!done) continue;
+                if (used != (size_t)got) {
+                    CloseConn(thread, conn);
+                    break;
+                }
+                now = NowMicros();
+                FinishRequest(thread, conn, now);
+                if (interval == 0 && now < g_end) StartRequest(thread, conn, now, &seed);
+                if (conn->sock == INVALID_SOCKET || conn->kind == KIND_NONE) break;
+            }
+        }
+    }
+
+    free(polled);
+    free(fds);
+    free(buf);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall LoadThreadProc(void* param) {
+#else
+static void* LoadThreadProc(void* param) {
+#endif
+    RunThread((LoadThread*)param);
+    return 0;
+}
+
+// Create the documents every write and read targets, on one connection
+static BOOL CreateDocuments(void) {
+    SOCKET sock = Connect();
+    if (sock == INVALID_SOCKET) return FALSE;
+
+    LoadConn conn;
+    memset(&conn, 0, sizeof(conn));
+    conn.sock = sock;
+    for (int d = 0; d < g_docs; d++) {
+        char doc[LOAD_TITLE_SIZE], section[16];
+        snprintf(doc, sizeof(doc), "load-%u-%d", g_runId, d);
+        conn.outLen = 0;
+
+        if (g_binary) {
+            BeginFrame(&conn);
+            AppendField(&conn, doc, strlen(doc));
+            for (int s = 0; s < g_sections; s++) {
+                snprintf(section, sizeof(section), "s%d", s);
+                AppendField(&conn, section, strlen(section));
+            }
+            EndFrame(&conn, DOCS_OP_CREATE, 1 + (uint32_t)g_sections);
+        }
+        else {
+            char line[128];
+            snprintf(line, sizeof(line), "create \"%s\" %d", doc, g_sections);
+            AppendText(&conn, line);
+            for (int s = 0; s < g_sections; s++) {
+                snprintf(line, sizeof(line), " \"s%d\"", s);
+                AppendText(&conn, line);
+            }
+            AppendText(&conn, "\n");
+        }
+        if (!SendAll(sock, conn.out, conn.outLen)) break;
+
+        // One response per create: a line, or a frame with at most a message
+        char reply[256];
+        BOOL ok = FALSE;
+        if (g_binary) {
+            DocsFrameHeader header;
+            ok = RecvAll(sock, reply, DOCS_FRAME_HEADER_SIZE);
+            if (ok) {
+                DocsDecodeHeader((unsigned char*)reply, &header);
+                ok = header.length < sizeof(reply) && RecvAll(sock, reply, header.length) &&
+                    header.status == DOCS_STATUS_OK;
+            }
+        }
+        else {
+            size_t len = 0;
+            while (len < sizeof(reply) - 1 && RecvAll(sock, reply + len, 1) && reply[len] != '\n') len++;
+            reply[len] = '\0';
+            ok = strncmp(reply, "[OK]", 4) == 0;
+        }
+        if (!ok) {
+            printf("[Load] Could not create %s\n", doc);
+            break;
+        }
+        if (d == g_docs - 1) {
+            free(conn.out);
+            closesocket(sock);
+            return TRUE;
+        }
+    }
+    free(conn.out);
+    closesocket(sock);
+    return FALSE;
+}
+
+static void Usage(const char* name) {
+    printf("Usage: %s [-c conns] [-t threads] [-d secs] [-w secs] [-r rate] [-i usec]\n"
+        "       [-m create:write:read] [-l lines] [-D docs] [-S sections] [-p text|binary] [ip port]\n",
+        name);
+}
+
+static BOOL ParseArgs(int argc, char* argv[]) {
+    ReadConfig("config.txt", g_ip, &g_port);
+
+    int positional = 0;
+    for (int i = 1; i < argc; i++) {
+        const char* arg = argv[i];
+        if (arg[0] == '-' && arg[1] && !arg[2] && i + 1 < argc) {
+            const char* value = argv[++i];
+            switch (arg[1]) {
+            case 'c': g_connections = atoi(value); break;
+            case 't': g_threads = atoi(value); break;
+            case 'd': g_seconds = atoi(value); break;
+            case 'w': g_warmup = atoi(value); break;
+            case 'r': g_rate = atof(value); break;
+            case 'i': g_expected = (ULONGLONG)atoll(value); break;
+            case 'l': g_lines = atoi(value); break;
+            case 'D': g_docs = atoi(value); break;
+            case 'S': g_sections = atoi(value); break;
+            case 'm':
+                if (sscanf(value, "%d:%d:%d", &g_mix[KIND_CREATE], &g_mix[KIND_WRITE], &g_mix[KIND_READ]) != 3) {
+                    return FALSE;
+                }
+                break;
+            case 'p':
+                if (strcmp(value, "binary") == 0) g_binary = TRUE;
+                else if (strcmp(value, "text") != 0) return FALSE;
+                break;
+            default:
+                return FALSE;
+            }
+        }
+        else if (positional == 0) {
+            snprintf(g_ip, sizeof(g_ip), "%s", arg);
+            positional++;
+        }
+        else if (positional == 1) {
+            g_port = atoi(arg);
+            positional++;
+        }
+        else {
+            return FALSE;
+        }
+    }
+
+    if (g_threads > g_connections) g_threads = g_connections;
+    return g_connections > 0 && g_threads > 0 && g_threads <= LOAD_MAX_THREADS &&
+        g_seconds > 0 && g_warmup >= 0 && g_rate >= 0 && g_lines >= 0 &&
+        g_docs > 0 && g_sections > 0 && g_sections <= 60 &&
+        g_mix[KIND_CREATE] >= 0 && g_mix[KIND_WRITE] >= 0 && g_mix[KIND_READ] >= 0 &&
+        g_mix[KIND_CREATE] + g_mix[KIND_WRITE] + g_mix[KIND_READ] == 100;
+}
+
+// count and req/s are real responses; the percentiles include back-filled samples
+static void PrintRow(const char* name, const Histogram* h, ULONGLONG count, double seconds) {
+    printf("[Load] %-8s %10llu %10.0f %9llu %9llu %9llu %9llu\n", name,
+        (unsigned long long)count, count / seconds,
+        (unsigned long long)HistPercentile(h, 50.0), (unsigned long long)HistPercentile(h, 99.0),
+        (unsigned long long)HistPercentile(h, 99.9), (unsigned long long)h->max);
+}
+
+int main(int argc, char* argv[]) {
+    setvbuf(stdout, NULL, _IONBF, 0);
+
+    if (!ParseArgs(argc, argv)) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+        printf("[ERROR] WSAStartup failed\n");
+        return 1;
+    }
+#else
+    signal(SIGPIPE, SIG_IGN);
+#endif
+
+    g_runId = (unsigned)time(NULL) ^ (unsigned)GetCurrentThreadId() << 16;
+    printf("[Load] %s:%d, %s protocol, %d connections, %d threads, ", g_ip, g_port,
+        g_binary ? "binary" : "text", g_connections, g_threads);
+    if (g_rate > 0) printf("open loop at %.0f req/s", g_rate);
+    else printf("closed loop");
+    printf(", mix %d:%d:%d, %ds + %ds warm-up\n", g_mix[KIND_CREATE], g_mix[KIND_WRITE],
+        g_mix[KIND_READ], g_seconds, g_warmup);
+
+    if (!CreateDocuments()) {
+        printf("[ERROR] Could not set up %d documents on %s:%d\n", g_docs, g_ip, g_port);
+        return 1;
+    }
+
+    LoadConn* conns = (LoadConn*)calloc((size_t)g_connections, sizeof(LoadConn));
+    LoadThread* threads = (LoadThread*)calloc((size_t)g_threads, sizeof(LoadThread));
+    if (!conns || !threads) return 1;
+
+    for (int i = 0; i < g_connections; i++) {
+        conns[i].index = i;
+        conns[i].sock = Connect();
+        if (conns[i].sock == INVALID_SOCKET || !SetNonBlocking(conns[i].sock)) {
+            printf("[ERROR] Connection %d failed: %d\n", i, WSAGetLastError());
+            return 1;
+        }
+    }
+    printf("[Load] %d connections open\n", g_connections);
+
+    // Contiguous slices of the connection array, one per thread
+    for (int t = 0; t < g_threads; t++) {
+        int first = g_connections * t / g_threads;
+        threads[t].index = t;
+        threads[t].conns = conns + first;
+        threads[t].count = g_connections * (t + 1) / g_threads - first;
+    }
+
+    g_start = NowMicros();
+    g_measureFrom = g_start + (ULONGLONG)g_warmup * 1000000;
+    g_end = g_measureFrom + (ULONGLONG)g_seconds * 1000000;
+
+#ifdef _WIN32
+    HANDLE handles[LOAD_MAX_THREADS];
+#else
+    pthread_t handles[LOAD_MAX_THREADS];
+#endif
+    for (int t = 0; t < g_threads; t++) {
+#ifdef _WIN32
+        handles[t] = (HANDLE)_beginthreadex(NULL, 0, LoadThreadProc, &threads[t], 0, NULL);
+        if (handles[t] == NULL) return 1;
+#else
+        if (pthread_create(&handles[t], NULL, LoadThreadProc, &threads[t]) != 0) return 1;
+#endif
+    }
+    for (int t = 0; t < g_threads; t++) {
+#ifdef _WIN32
+        WaitForSingleObject(handles[t], INFINITE);
+        CloseHandle(handles[t]);
+#else
+        pthread_join(handles[t], NULL);
+#endif
+    }
+
+    static Histogram kinds[KIND_COUNT], all, service;
+    ULONGLONG completed[KIND_COUNT] = { 0 };
+    ULONGLONG errors = 0, dropped = 0, late = 0;
+    for (int t = 0; t < g_threads; t++) {
+        for (int k = 0; k < KIND_COUNT; k++) {
+            HistMerge(&kinds[k], &threads[t].latency[k]);
+            HistMerge(&all, &threads[t].latency[k]);
+            completed[k] += threads[t].completed[k];
+        }
+        HistMerge(&service, &threads[t].service);
+        errors += threads[t].errors;
+        dropped += threads[t].dropped;
+        late += threads[t].late;
+    }
+
+    double seconds = (double)g_seconds;
+    printf("[Load] %-8s %10s %10s %9s %9s %9s %9s\n", "latency", "count", "req/s",
+        "p50(us)", "p99(us)", "p999(us)", "max(us)");
+    for (int k = 0; k < KIND_COUNT; k++) {
+        if (completed[k] > 0) PrintRow(kindNames[k], &kinds[k], completed[k], seconds);
+    }
+    PrintRow("all", &all, service.total, seconds);
+    PrintRow("service", &service, service.total, seconds);
+    if (g_rate == 0 && g_expected == 0) {
+        printf("[Load] Closed loop without -i: latencies are not corrected for coordinated omission\n");
+    }
+    printf("[Load] errors: %llu, connections lost: %llu, late sends: %llu\n",
+        (unsigned long long)errors, (unsigned long long)dropped, (unsigned long long)late);
+
+    for (int i = 0; i < g_connections; i++) {
+        if (conns[i].sock != INVALID_SOCKET) closesocket(conns[i].sock);
+        free(conns[i].out);
+    }
+    free(conns);
+    free(threads);
+#ifdef _WIN32
+    WSACleanup();
+#endif
+    return dropped == 0 ? 0 : 1;
+}
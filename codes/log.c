@@ -0,0 +1,179 @@
+/// log.c
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+
+#define LOG_BATCH_SIZE 65536
+
+typedef struct {
+    int len;
+    char text[LOG_RECORD_SIZE - sizeof(int)];
+} LogRecord;
+
+// Single producer (the owning thread), single consumer (the drain thread).
+// head and tail only ever grow; the slot is index & (LOG_RING_RECORDS - 1).
+typedef struct LogRing {
+    volatile LONG tail;                 // next slot the producer fills
+    volatile LONG head;                 // next slot the consumer reads
+    volatile LONG dropped;              // messages lost to a full ring
+    struct LogRing* volatile nextRing;
+    LogRecord records[LOG_RING_RECORDS];
+} LogRing;
+
+volatile LONG g_logLevel = LOG_DEFAULT_LEVEL;
+
+static LogRing* volatile g_logRings = NULL;
+static THREAD_LOCAL LogRing* t_logRing = NULL;
+static CRITICAL_SECTION g_drainLock;   // LogFlush may run beside the drain thread
+static char g_batch[LOG_BATCH_SIZE];
+
+static const char* g_levelNames[LOG_LEVEL_OFF] = { "trace", "debug", "info", "warn", "error" };
+
+static LogRing* GetLogRing(void) {
+    if (t_logRing) return t_logRing;
+
+    LogRing* ring = (LogRing*)malloc(sizeof(LogRing));
+    if (!ring) return NULL;
+    ZeroMemory(ring, sizeof(LogRing));
+
+    // Rings are never unlinked; threads live for the life of the process
+    LogRing* head;
+    do {
+        head = g_logRings;
+        ring->nextRing = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&g_logRings, ring, head) != head);
+
+    t_logRing = ring;
+    return ring;
+}
+
+void LogWrite(int level, const char* fmt, ...) {
+    (void)level;
+    LogRing* ring = GetLogRing();
+    if (!ring) return;
+
+    LONG tail = ring->tail;
+    LONG head = InterlockedCompareExchange(&ring->head, 0, 0);
+    if (tail - head >= LOG_RING_RECORDS) {
+        InterlockedIncrement(&ring->dropped);
+        return;
+    }
+
+    // Format straight into the slot; it is not visible until tail moves
+    LogRecord* rec = &ring->records[tail & (LOG_RING_RECORDS - 1)];
+    va_list args;
+    va_start(args, fmt);
+    int len = vsnprintf(rec->text, sizeof(rec->text), fmt, args);
+    va_end(args);
+
+    if (len < 0) len = 0;
+    if (len >= (int)sizeof(rec->text)) {
+        len = (int)sizeof(rec->text) - 1;
+        rec->text[len - 1] = '\n';      // keep truncated lines on their own line
+    }
+    rec->len = len;
+
+    InterlockedExchange(&ring->tail, tail + 1);
+}
+
+// Copy whatever is queued into batched writes. Returns the number of records.
+static int DrainRings(void) {
+    int count = 0;
+    size_t used = 0;
+
+    EnterCriticalSection(&g_drainLock);
+    for (LogRing* ring = g_logRings; ring; ring = ring->nextRing) {
+        LONG head = ring->head;
+        LONG tail = InterlockedCompareExchange(&ring->tail, 0, 0);
+
+        LONG dropped = ring->dropped;
+        if (dropped) {
+            InterlockedExchangeAdd(&ring->dropped, -dropped);
+            used += snprintf(g_batch + used, LOG_BATCH_SIZE - used,
+                "[Log] %d messages dropped (ring full)\n", (int)dropped);
+        }
+
+        for (; head != tail; head++) {
+            const LogRecord* rec = &ring->records[head & (LOG_RING_RECORDS - 1)];
+            if (used + rec->len > LOG_BATCH_SIZE) {
+                fwrite(g_batch, 1, used, stdout);
+                used = 0;
+            }
+            memcpy(g_batch + used, rec->text, rec->len);
+            used += rec->len;
+            count++;
+        }
+
+        // Slots up to tail are free for the producer again
+        InterlockedExchange(&ring->head, tail);
+
+        if (used > LOG_BATCH_SIZE - LOG_RECORD_SIZE) {
+            fwrite(g_batch, 1, used, stdout);
+            used = 0;
+        }
+    }
+
+    if (used) fwrite(g_batch, 1, used, stdout);
+    if (count) fflush(stdout);
+    LeaveCriticalSection(&g_drainLock);
+    return count;
+}
+
+void LogFlush(void) {
+    DrainRings();
+}
+
+#ifdef _WIN32
+static unsigned __stdcall LogThread(void* param)
+#else
+static void* LogThread(void* param)
+#endif
+{
+    (void)param;
+    while (1) {
+        if (DrainRings() == 0) Sleep(LOG_DRAIN_INTERVAL_MS);
+    }
+    return 0;
+}
+
+int LogParseLevel(const char* name) {
+    for (int i = 0; i < LOG_LEVEL_OFF; i++) {
+        if (_stricmp(name, g_levelNames[i]) == 0) return i;
+    }
+    if (_stricmp(name, "off") == 0) return LOG_LEVEL_OFF;
+    return -1;
+}
+
+void LogSetLevel(int level) {
+    if (level < LOG_LEVEL_TRACE) level = LOG_LEVEL_TRACE;
+    if (level > LOG_LEVEL_OFF) level = LOG_LEVEL_OFF;
+    InterlockedExchange(&g_logLevel, level);
+}
+
+BOOL LogInit(void) {
+    InitializeCriticalSection(&g_drainLock);
+
+    const char* env = getenv("DOCS_LOG_LEVEL");
+    if (env) {
+        int level = LogParseLevel(env);
+        if (level >= 0) LogSetLevel(level);
+        else fprintf(stderr, "[Log] Unknown DOCS_LOG_LEVEL '%s', ignored\n", env);
+    }
+
+    // Whatever is still queued goes out when the process exits normally
+    atexit(LogFlush);
+
+#ifdef _WIN32
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, LogThread, NULL, 0, NULL);
+    if (thread == NULL) return FALSE;
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, LogThread, NULL) != 0) return FALSE;
+    pthread_detach(thread);
+#endif
+    return TRUE;
+}
@@ -0,0 +1,64 @@
+/// log.h
+// Asynchronous leveled logger.
+//
+// Worker threads format each message straight into a slot of their own
+// single-producer ring and return; nothing on the calling side takes a lock or
+// makes a syscall. A background thread drains every ring and writes the text
+// out in batches. A full ring drops the message (and counts it) rather than
+// blocking a worker.
+//
+// Levels are filtered twice: LOG_COMPILE_LEVEL removes calls below it at
+// compile time, and the runtime level (DOCS_LOG_LEVEL environment variable or
+// LogSetLevel) filters what is left.
+#ifndef LOG_H
+#define LOG_H
+
+#include "platform.h"
+
+#define LOG_LEVEL_TRACE 0
+#define LOG_LEVEL_DEBUG 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_WARN  3
+#define LOG_LEVEL_ERROR 4
+#define LOG_LEVEL_OFF   5
+
+#ifndef LOG_COMPILE_LEVEL
+#ifdef DEBUG
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#else
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+#endif
+
+// Runtime level until DOCS_LOG_LEVEL / LogSetLevel says otherwise
+#ifdef DEBUG
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_TRACE
+#else
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_INFO
+#endif
+
+#define LOG_RING_RECORDS 1024       // per thread, power of 2
+#define LOG_RECORD_SIZE 256         // longer messages are truncated
+#define LOG_DRAIN_INTERVAL_MS 5
+
+extern volatile LONG g_logLevel;
+
+#define LOG_ENABLED(level) ((level) >= LOG_COMPILE_LEVEL && (level) >= g_logLevel)
+
+#define LOG_AT(level, ...) \
+    do { if (LOG_ENABLED(level)) LogWrite((level), __VA_ARGS__); } while (0)
+
+#define LOG_TRACE(...) LOG_AT(LOG_LEVEL_TRACE, __VA_ARGS__)
+#define LOG_DEBUG(...) LOG_AT(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_INFO(...)  LOG_AT(LOG_LEVEL_INFO, __VA_ARGS__)
+#define LOG_WARN(...)  LOG_AT(LOG_LEVEL_WARN, __VA_ARGS__)
+#define LOG_ERROR(...) LOG_AT(LOG_LEVEL_ERROR, __VA_ARGS__)
+
+// Starts the drain thread; call first thing in main
+BOOL LogInit(void);
+void LogSetLevel(int level);
+int LogParseLevel(const char* name);    // "trace".."error", -1 if unknown
+void LogWrite(int level, const char* fmt, ...);
+void LogFlush(void);                    // drain everything queued so far
+
+#endif // LOG_H
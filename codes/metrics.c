@@ -0,0 +1,477 @@
+/// metrics.c
+#include "metrics.h"
+#include "log.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+#define METRICS_REQUEST_SIZE 1024
+#define METRICS_IO_TIMEOUT_MS 2000      // per recv/send on a scrape connection
+
+static const char* g_commandNames[METRIC_CMD_COUNT] = {
+    "create", "write", "read", "bye", "stats", "edit", "other"
+};
+static const char* g_lockNames[METRIC_LOCK_COUNT] = { "docs", "commit" };
+
+static MetricsRecord* volatile g_metricsRegistry = NULL;
+static volatile LONG g_metricsWorkers = 0;
+static THREAD_LOCAL MetricsRecord* t_metrics = NULL;
+static MetricsSectionFn g_sectionReporter = NULL;
+static SOCKET g_metricsSocket = INVALID_SOCKET;
+
+// Not worth failing a request over: a thread that cannot get a record
+// records into this one, shared and unregistered
+static MetricsRecord g_spareRecord;
+
+MetricsRecord* Metrics(void) {
+    if (t_metrics) return t_metrics;
+
+    MetricsRecord* rec = (MetricsRecord*)calloc(1, sizeof(MetricsRecord));
+    if (!rec) return &g_spareRecord;
+    rec->worker = (int)InterlockedIncrement(&g_metricsWorkers) - 1;
+
+    // Threads live for the life of the process, and so do their records
+    MetricsRecord* head;
+    do {
+        head = g_metricsRegistry;
+        rec->nextRecord = head;
+    } while (InterlockedCompareExchangePointer((PVOID*)&g_metricsRegistry, rec, head) != head);
+
+    t_metrics = rec;
+    return rec;
+}
+
+ULONGLONG MetricsNow(void) {
+#ifdef _WIN32
+    static LARGE_INTEGER freq;
+    LARGE_INTEGER now;
+    if (freq.QuadPart == 0) QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (ULONGLONG)(now.QuadPart / freq.QuadPart * 1000000 +
+        now.QuadPart % freq.QuadPart * 1000000 / freq.QuadPart);
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000000 + (ULONGLONG)ts.tv_nsec / 1000;
+#endif
+}
+
+void MetricsObserve(MetricHistogram* h, ULONGLONG micros) {
+    // Smallest i with micros <= 2^i
+    int i = 0;
+    while (i < METRIC_BUCKETS && ((ULONGLONG)1 << i) < micros) i++;
+    h->counts[i]++;
+    h->count++;
+    h->sumMicros += (LONG64)micros;
+}
+
+void MetricsSetSectionReporter(MetricsSectionFn fn) {
+    g_sectionReporter = fn;
+}
+
+// Rendering
+
+void MetricsAppend(MetricsText* out, const char* fmt, ...) {
+    if (out->failed) return;
+
+    for (;;) {
+        va_list args;
+        va_start(args, fmt);
+        int n = vsnprintf(out->data ? out->data + out->len : NULL, out->cap - out->len, fmt, args);
+        va_end(args);
+        if (n < 0) {
+            out->failed = TRUE;
+            return;
+        }
+        if (out->len + (size_t)n < out->cap) {
+            out->len += (size_t)n;
+            return;
+        }
+
+        size_t cap = out->cap ? out->cap * 2 : 4096;
+        while (cap <= out->len + (size_t)n) cap *= 2;
+        char* data = (char*)realloc(out->data, cap);
+        if (!data) {
+            out->failed = TRUE;
+            return;
+        }
+        out->data = data;
+        out->cap = cap;
+    }
+}
+
+void MetricsAppendLabel(MetricsText* out, const char* value) {
+    MetricsAppend(out, "\"");
+    for (const char* p = value; *p; p++) {
+        if (*p == '\\') MetricsAppend(out, "\\\\");
+        else if (*p == '"') MetricsAppend(out, "\\\"");
+        else if (*p == '\n') MetricsAppend(out, "\\n");
+        else MetricsAppend(out, "%c", *p);
+    }
+    MetricsAppend(out, "\"");
+}
+
+void MetricsTextFree(MetricsText* out) {
+    free(out->data);
+    ZeroMemory(out, sizeof(MetricsText));
+}
+
+static void MergeHistogram(MetricHistogram* into, const MetricHistogram* from) {
+    for (int i = 0; i <= METRIC_BUCKETS; i++) into->counts[i] += from->counts[i];
+    into->count += from->count;
+    into->sumMicros += from->sumMicros;
+}
+
+// Totals over every record
+static void SumRecords(MetricsRecord* total) {
+    ZeroMemory(total, sizeof(MetricsRecord));
+    for (MetricsRecord* rec = g_metricsRegistry; rec; rec = rec->nextRecord) {
+        total->accepts += rec->accepts;
+        total->closes += rec->closes;
+        total->recvCalls += rec->recvCalls;
+        total->recvBytes += rec->recvBytes;
+        total->sendCalls += rec->sendCalls;
+        total->sendBytes += rec->sendBytes;
+        total->commitBatches += rec->commitBatches;
+        total->commitWrites += rec->commitWrites;
+        total->readCacheHits += rec->readCacheHits;
+        total->readCacheBuilds += rec->readCacheBuilds;
+        total->readStreams += rec->readStreams;
+        total->readChunks += rec->readChunks;
+        total->outputQueued += rec->outputQueued;
+        total->pausedClients += rec->pausedClients;
+        total->inputPauses += rec->inputPauses;
+        total->stallDrops += rec->stallDrops;
+        total->idleDrops += rec->idleDrops;
+        total->writeTimeouts += rec->writeTimeouts;
+        total->commitTimeouts += rec->commitTimeouts;
+        for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+            total->commands[c] += rec->commands[c];
+            MergeHistogram(&total->commandTime[c], &rec->commandTime[c]);
+        }
+        MergeHistogram(&total->commitWait, &rec->commitWait);
+        for (int l = 0; l < METRIC_LOCK_COUNT; l++) MergeHistogram(&total->lockHold[l], &rec->lockHold[l]);
+        total->walSyncs += rec->walSyncs;
+        total->walRecords += rec->walRecords;
+        total->walBytes += rec->walBytes;
+        MergeHistogram(&total->walSync, &rec->walSync);
+        MergeHistogram(&total->walWait, &rec->walWait);
+    }
+}
+
+// Upper bound of the bucket holding the given percentile; 0 if empty
+static ULONGLONG Percentile(const MetricHistogram* h, double pct) {
+    LONG64 total = 0;
+    for (int i = 0; i <= METRIC_BUCKETS; i++) total += h->counts[i];
+    if (total == 0) return 0;
+
+    LONG64 rank = (LONG64)(pct / 100.0 * total + 0.5);
+    if (rank < 1) rank = 1;
+    LONG64 seen = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= rank) return (ULONGLONG)1 << i;
+    }
+    return (ULONGLONG)1 << METRIC_BUCKETS;
+}
+
+static void SummaryLine(MetricsText* out, const char* name, const MetricHistogram* h) {
+    MetricsAppend(out, "  %-8s %10lld  avg %8.1f  p50 <=%-8llu p99 <=%-8llu p99.9 <=%llu\n", name,
+        (long long)h->count, h->count ? (double)h->sumMicros / h->count : 0.0,
+        (unsigned long long)Percentile(h, 50.0), (unsigned long long)Percentile(h, 99.0),
+        (unsigned long long)Percentile(h, 99.9));
+}
+
+void MetricsRenderSummary(MetricsText* out) {
+    MetricsRecord total;
+    SumRecords(&total);
+
+    MetricsAppend(out, "connections: %lld active, %lld accepted\n",
+        (long long)(total.accepts - total.closes), (long long)total.accepts);
+    MetricsAppend(out, "recv: %lld bytes in %lld calls, send: %lld bytes in %lld calls\n",
+        (long long)total.recvBytes, (long long)total.recvCalls,
+        (long long)total.sendBytes, (long long)total.sendCalls);
+    MetricsAppend(out, "commits: %lld writes in %lld batches\n",
+        (long long)total.commitWrites, (long long)total.commitBatches);
+    MetricsAppend(out, "read cache: %lld hits, %lld builds; streamed: %lld replies in %lld chunks\n",
+        (long long)total.readCacheHits, (long long)total.readCacheBuilds,
+        (long long)total.readStreams, (long long)total.readChunks);
+    MetricsAppend(out, "flow control: %lld bytes queued, %lld clients paused, %lld pauses, %lld stalled clients dropped\n",
+        (long long)total.outputQueued, (long long)total.pausedClients,
+        (long long)total.inputPauses, (long long)total.stallDrops);
+    MetricsAppend(out, "timeouts: %lld idle, %lld write, %lld commit\n",
+        (long long)total.idleDrops, (long long)total.writeTimeouts, (long long)total.commitTimeouts);
+    if (total.walSyncs > 0) {
+        MetricsAppend(out, "wal: %lld records, %lld bytes in %lld syncs\n",
+            (long long)total.walRecords, (long long)total.walBytes, (long long)total.walSyncs);
+    }
+
+    MetricsAppend(out, "command time (us):\n");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++) SummaryLine(out, g_commandNames[c], &total.commandTime[c]);
+    MetricsAppend(out, "commit wait (us):\n");
+    SummaryLine(out, "write", &total.commitWait);
+    if (total.walSyncs > 0) {
+        SummaryLine(out, "durable", &total.walWait);
+        MetricsAppend(out, "wal sync (us):\n");
+        SummaryLine(out, "fsync", &total.walSync);
+    }
+    MetricsAppend(out, "lock hold (us):\n");
+    for (int l = 0; l < METRIC_LOCK_COUNT; l++) SummaryLine(out, g_lockNames[l], &total.lockHold[l]);
+
+    MetricsAppend(out, "workers:\n");
+    for (MetricsRecord* rec = g_metricsRegistry; rec; rec = rec->nextRecord) {
+        LONG64 commands = 0;
+        for (int c = 0; c < METRIC_CMD_COUNT; c++) commands += rec->commands[c];
+        MetricsAppend(out, "  %-3d accepts %lld, commands %lld, recv %lld B, send %lld B\n",
+            rec->worker, (long long)rec->accepts, (long long)commands,
+            (long long)rec->recvBytes, (long long)rec->sendBytes);
+    }
+
+    if (g_sectionReporter) g_sectionReporter(out, FALSE);
+}
+
+static void PromHeader(MetricsText* out, const char* name, const char* type, const char* help) {
+    MetricsAppend(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// One histogram series; label is "" or "name=\"value\","
+static void PromHistogram(MetricsText* out, const char* name, const char* label, const MetricHistogram* h) {
+    LONG64 cumulative = 0;
+    for (int i = 0; i < METRIC_BUCKETS; i++) {
+        cumulative += h->counts[i];
+        MetricsAppend(out, "%s_bucket{%sle=\"%.6f\"} %lld\n", name, label,
+            (double)((ULONGLONG)1 << i) / 1e6, (long long)cumulative);
+    }
+    cumulative += h->counts[METRIC_BUCKETS];
+    MetricsAppend(out, "%s_bucket{%sle=\"+Inf\"} %lld\n", name, label, (long long)cumulative);
+
+    // Without the trailing comma for _sum and _count
+    int len = (int)strlen(label);
+    if (len == 0) {
+        MetricsAppend(out, "%s_sum %.6f\n%s_count %lld\n", name, h->sumMicros / 1e6, name, (long long)cumulative);
+        return;
+    }
+    MetricsAppend(out, "%s_sum{%.*s} %.6f\n", name, len - 1, label, h->sumMicros / 1e6);
+    MetricsAppend(out, "%s_count{%.*s} %lld\n", name, len - 1, label, (long long)cumulative);
+}
+
+// A counter kept per record, one series per worker
+#define PROM_PER_WORKER(out, name, field) do { \
+        for (MetricsRecord* rec = g_metricsRegistry; rec; rec = rec->nextRecord) { \
+            MetricsAppend((out), "%s{worker=\"%d\"} %lld\n", (name), rec->worker, (long long)rec->field); \
+        } \
+    } while (0)
+
+void MetricsRenderPrometheus(MetricsText* out) {
+    MetricsRecord total;
+    SumRecords(&total);
+    char label[64];
+
+    PromHeader(out, "docs_connections_active", "gauge", "Open client connections.");
+    MetricsAppend(out, "docs_connections_active %lld\n", (long long)(total.accepts - total.closes));
+
+    PromHeader(out, "docs_connections_accepted_total", "counter", "Connections accepted, by worker.");
+    PROM_PER_WORKER(out, "docs_connections_accepted_total", accepts);
+    PromHeader(out, "docs_recv_bytes_total", "counter", "Bytes received, by worker.");
+    PROM_PER_WORKER(out, "docs_recv_bytes_total", recvBytes);
+    PromHeader(out, "docs_recv_calls_total", "counter", "Receive completions handled, by worker.");
+    PROM_PER_WORKER(out, "docs_recv_calls_total", recvCalls);
+    PromHeader(out, "docs_send_bytes_total", "counter", "Bytes handed to sends, by worker.");
+    PROM_PER_WORKER(out, "docs_send_bytes_total", sendBytes);
+    PromHeader(out, "docs_send_calls_total", "counter", "Vectored sends issued, by worker.");
+    PROM_PER_WORKER(out, "docs_send_calls_total", sendCalls);
+
+    PromHeader(out, "docs_commands_total", "counter", "Commands run, by worker and command.");
+    for (MetricsRecord* rec = g_metricsRegistry; rec; rec = rec->nextRecord) {
+        for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+            MetricsAppend(out, "docs_commands_total{worker=\"%d\",command=\"%s\"} %lld\n",
+                rec->worker, g_commandNames[c], (long long)rec->commands[c]);
+        }
+    }
+
+    PromHeader(out, "docs_command_duration_seconds", "histogram",
+        "Time to run a command, up to queueing its response or its commit.");
+    for (int c = 0; c < METRIC_CMD_COUNT; c++) {
+        snprintf(label, sizeof(label), "command=\"%s\",", g_commandNames[c]);
+        PromHistogram(out, "docs_command_duration_seconds", label, &total.commandTime[c]);
+    }
+
+    PromHeader(out, "docs_commit_wait_seconds", "histogram",
+        "Time from queueing a write to its publication.");
+    PromHistogram(out, "docs_commit_wait_seconds", "", &total.commitWait);
+
+    PromHeader(out, "docs_commit_batches_total", "counter", "Batches applied by section combiners.");
+    MetricsAppend(out, "docs_commit_batches_total %lld\n", (long long)total.commitBatches);
+    PromHeader(out, "docs_commit_writes_total", "counter", "Writes published.");
+    MetricsAppend(out, "docs_commit_writes_total %lld\n", (long long)total.commitWrites);
+    PromHeader(out, "docs_read_cache_hits_total", "counter", "Reads sent from a cached rendering.");
+    MetricsAppend(out, "docs_read_cache_hits_total %lld\n", (long long)total.readCacheHits);
+    PromHeader(out, "docs_read_cache_builds_total", "counter",
+        "Read renderings built, on a section's first read after a commit or the catalog's after a create.");
+    MetricsAppend(out, "docs_read_cache_builds_total %lld\n", (long long)total.readCacheBuilds);
+    PromHeader(out, "docs_read_streams_total", "counter", "Read replies too large to render, sent in chunks.");
+    MetricsAppend(out, "docs_read_streams_total %lld\n", (long long)total.readStreams);
+    PromHeader(out, "docs_read_stream_chunks_total", "counter", "Sends taken by streamed read replies.");
+    MetricsAppend(out, "docs_read_stream_chunks_total %lld\n", (long long)total.readChunks);
+    PromHeader(out, "docs_output_queued_bytes", "gauge", "Bytes of replies queued or being sent to clients.");
+    MetricsAppend(out, "docs_output_queued_bytes %lld\n", (long long)total.outputQueued);
+    PromHeader(out, "docs_clients_paused", "gauge", "Clients not read from until their queued output drains.");
+    MetricsAppend(out, "docs_clients_paused %lld\n", (long long)total.pausedClients);
+    PromHeader(out, "docs_input_pauses_total", "counter", "Times a client was paused for exceeding its flow-control limits.");
+    MetricsAppend(out, "docs_input_pauses_total %lld\n", (long long)total.inputPauses);
+    PromHeader(out, "docs_stalled_clients_dropped_total", "counter",
+        "Paused clients disconnected after no send completed within the stall timeout.");
+    MetricsAppend(out, "docs_stalled_clients_dropped_total %lld\n", (long long)total.stallDrops);
+    PromHeader(out, "docs_client_timeouts_total", "counter",
+        "Clients disconnected when a deadline ran out: idle, write mode, or an unanswered commit.");
+    MetricsAppend(out, "docs_client_timeouts_total{kind=\"idle\"} %lld\n", (long long)total.idleDrops);
+    MetricsAppend(out, "docs_client_timeouts_total{kind=\"write\"} %lld\n", (long long)total.writeTimeouts);
+    MetricsAppend(out, "docs_client_timeouts_total{kind=\"commit\"} %lld\n", (long long)total.commitTimeouts);
+
+    PromHeader(out, "docs_lock_hold_seconds", "histogram",
+        "Exclusive hold times: docsLock on create, a section combiner per batch.");
+    for (int l = 0; l < METRIC_LOCK_COUNT; l++) {
+        snprintf(label, sizeof(label), "lock=\"%s\",", g_lockNames[l]);
+        PromHistogram(out, "docs_lock_hold_seconds", label, &total.lockHold[l]);
+    }
+
+    PromHeader(out, "docs_wal_syncs_total", "counter", "Write-ahead log group commits (one write+fsync each).");
+    MetricsAppend(out, "docs_wal_syncs_total %lld\n", (long long)total.walSyncs);
+    PromHeader(out, "docs_wal_records_total", "counter", "Write-ahead log records made durable.");
+    MetricsAppend(out, "docs_wal_records_total %lld\n", (long long)total.walRecords);
+    PromHeader(out, "docs_wal_bytes_total", "counter", "Write-ahead log bytes made durable.");
+    MetricsAppend(out, "docs_wal_bytes_total %lld\n", (long long)total.walBytes);
+    PromHeader(out, "docs_wal_sync_seconds", "histogram", "Time for one write-ahead log write+fsync.");
+    PromHistogram(out, "docs_wal_sync_seconds", "", &total.walSync);
+    PromHeader(out, "docs_wal_commit_wait_seconds", "histogram",
+        "Time from queueing a write to its log record being durable.");
+    PromHistogram(out, "docs_wal_commit_wait_seconds", "", &total.walWait);
+
+    if (g_sectionReporter) g_sectionReporter(out, TRUE);
+}
+
+// HTTP endpoint: one request per connection, answered from this thread
+
+static BOOL SendAll(SOCKET sock, const char* data, size_t len) {
+    while (len > 0) {
+        int n = send(sock, data, (int)len, MSG_NOSIGNAL);
+        if (n <= 0) return FALSE;
+        data += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+// Connections are served one at a time, so one that stalls must not hold up
+// the scrapes queued behind it
+static void SetIoTimeouts(SOCKET sock) {
+#ifdef _WIN32
+    DWORD timeout = METRICS_IO_TIMEOUT_MS;
+#else
+    struct timeval timeout;
+    timeout.tv_sec = METRICS_IO_TIMEOUT_MS / 1000;
+    timeout.tv_usec = (METRICS_IO_TIMEOUT_MS % 1000) * 1000;
+#endif
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (char*)&timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (char*)&timeout, sizeof(timeout));
+}
+
+static void ServeRequest(SOCKET sock) {
+    char request[METRICS_REQUEST_SIZE];
+    int len = recv(sock, request, sizeof(request) - 1, 0);
+    if (len <= 0) return;
+    request[len] = '\0';
+
+    MetricsText body = { 0 };
+    const char* status = "200 OK";
+    if (strncmp(request, "GET /metrics", 12) == 0 || strncmp(request, "GET / ", 6) == 0) {
+        MetricsRenderPrometheus(&body);
+    }
+    else {
+        status = "404 Not Found";
+        MetricsAppend(&body, "Not found; metrics are at /metrics\n");
+    }
+    if (body.failed) {
+        LOG_ERROR("[Server] Out of memory rendering metrics\n");
+        MetricsTextFree(&body);
+        return;
+    }
+
+    char header[256];
+    int headerLen = snprintf(header, sizeof(header),
+        "HTTP/1.1 %s\r\nContent-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+        "Content-Length: %zu\r\nConnection: close\r\n\r\n", status, body.len);
+    if (SendAll(sock, header, (size_t)headerLen)) SendAll(sock, body.data, body.len);
+    MetricsTextFree(&body);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall MetricsThread(void* param)
+#else
+static void* MetricsThread(void* param)
+#endif
+{
+    (void)param;
+    while (1) {
+        SOCKET sock = accept(g_metricsSocket, NULL, NULL);
+        if (sock == INVALID_SOCKET) {
+            Sleep(100);
+            continue;
+        }
+        SetIoTimeouts(sock);
+        ServeRequest(sock);
+        closesocket(sock);
+    }
+    return 0;
+}
+
+void MetricsInit(void) {
+    const char* env = getenv("DOCS_METRICS_PORT");
+    if (!env) return;
+
+    int port = atoi(env);
+    if (port <= 0 || port > 65535) {
+        LOG_WARN("[Server] Invalid DOCS_METRICS_PORT '%s', metrics endpoint disabled\n", env);
+        return;
+    }
+
+    // Loopback only: the endpoint is for a scraper on the same host
+    SOCKET sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    inet_pton(AF_INET, "127.0.0.1", &addr.sin_addr);
+
+    int opt = 1;
+    if (sock != INVALID_SOCKET) setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (char*)&opt, sizeof(opt));
+    if (sock == INVALID_SOCKET ||
+        bind(sock, (struct sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR ||
+        listen(sock, SOMAXCONN) == SOCKET_ERROR) {
+        LOG_ERROR("[ERROR] Metrics endpoint on port %d failed: %d\n", port, WSAGetLastError());
+        if (sock != INVALID_SOCKET) closesocket(sock);
+        return;
+    }
+    g_metricsSocket = sock;
+
+#ifdef _WIN32
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, MetricsThread, NULL, 0, NULL);
+    if (thread == NULL) return;
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, MetricsThread, NULL) != 0) return;
+    pthread_detach(thread);
+#endif
+    LOG_INFO("[Server] Metrics endpoint: http://127.0.0.1:%d/metrics\n", port);
+}
@@ -0,0 +1,109 @@
+/// metrics.h
+// Live server metrics: counters and latency histograms kept per thread, read
+// by the "stats" command and by a plain-text HTTP endpoint in the Prometheus
+// exposition format.
+//
+// Every thread that records gets its own MetricsRecord on first use, linked
+// into a global list the readers walk. A record is only ever written by its
+// thread, with plain increments and no atomics, so recording costs a few
+// stores to a cache line no other thread writes. Readers sum the records
+// without locking; a scrape may see a counter one update behind.
+//
+// Per-section commit statistics live in the Section itself (docs_server.h);
+// docs_server.c reports the hottest ones through MetricsSetSectionReporter.
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "platform.h"
+
+// Histogram bucket i counts values up to 2^i microseconds; the last one is +Inf
+#define METRIC_BUCKETS 26
+#define METRICS_HOT_SECTIONS 16         // sections listed, by total commit wait
+
+typedef enum {
+    METRIC_CMD_CREATE,
+    METRIC_CMD_WRITE,
+    METRIC_CMD_READ,
+    METRIC_CMD_BYE,
+    METRIC_CMD_STATS,
+    METRIC_CMD_EDIT,        // append, insert, replace, delete
+    METRIC_CMD_OTHER,       // unknown or malformed
+    METRIC_CMD_COUNT
+} MetricCommand;
+
+typedef enum {
+    METRIC_LOCK_DOCS,       // docsLock held exclusively (create)
+    METRIC_LOCK_COMMIT,     // a section's combiner applying one batch
+    METRIC_LOCK_COUNT
+} MetricLock;
+
+typedef struct {
+    LONG64 counts[METRIC_BUCKETS + 1];
+    LONG64 count;
+    LONG64 sumMicros;
+} MetricHistogram;
+
+typedef struct MetricsRecord {
+    int worker;                 // registration order, the "worker" label
+    LONG64 accepts;
+    LONG64 closes;
+    LONG64 recvCalls;
+    LONG64 recvBytes;
+    LONG64 sendCalls;
+    LONG64 sendBytes;
+    LONG64 commands[METRIC_CMD_COUNT];
+    LONG64 commitBatches;
+    LONG64 commitWrites;
+    LONG64 readCacheHits;                       // reads sent from a cached rendering
+    LONG64 readCacheBuilds;                     // renderings built (first read, or stale)
+    LONG64 readStreams;                         // replies too large to render, streamed
+    LONG64 readChunks;                          // sends they took
+    LONG64 outputQueued;                        // gauge: bytes queued or in flight to clients
+    LONG64 pausedClients;                       // gauge: clients whose input is paused
+    LONG64 inputPauses;                         // times a client was paused (flow control)
+    LONG64 stallDrops;                          // clients disconnected for stalling while paused
+    LONG64 idleDrops;                           // clients disconnected after the idle timeout
+    LONG64 writeTimeouts;                       // ... left in write mode too long
+    LONG64 commitTimeouts;                      // ... whose commit went unanswered too long
+    MetricHistogram commandTime[METRIC_CMD_COUNT];
+    MetricHistogram commitWait;                 // submit to publish, per write
+    MetricHistogram lockHold[METRIC_LOCK_COUNT];
+    LONG64 walSyncs;                            // write-ahead log (wal.c)
+    LONG64 walRecords;
+    LONG64 walBytes;
+    MetricHistogram walSync;                    // one write+fsync
+    MetricHistogram walWait;                    // submit to durable, per write
+    struct MetricsRecord* volatile nextRecord;
+} MetricsRecord;
+
+// Growable text for rendering; on allocation failure it stops growing and
+// sets failed
+typedef struct {
+    char* data;
+    size_t len;
+    size_t cap;
+    BOOL failed;
+} MetricsText;
+
+// Appends the per-section part of a report: Prometheus series if prometheus
+// is set, otherwise lines for the stats command
+typedef void (*MetricsSectionFn)(MetricsText* out, BOOL prometheus);
+
+// This thread's record
+MetricsRecord* Metrics(void);
+// Monotonic microseconds
+ULONGLONG MetricsNow(void);
+void MetricsObserve(MetricHistogram* h, ULONGLONG micros);
+
+void MetricsSetSectionReporter(MetricsSectionFn fn);
+
+// Start the HTTP endpoint on 127.0.0.1 if DOCS_METRICS_PORT is set
+void MetricsInit(void);
+
+void MetricsAppend(MetricsText* out, const char* fmt, ...);
+void MetricsAppendLabel(MetricsText* out, const char* value);   // quoted, escaped
+void MetricsRenderSummary(MetricsText* out);        // stats command
+void MetricsRenderPrometheus(MetricsText* out);     // text exposition format 0.0.4
+void MetricsTextFree(MetricsText* out);
+
+#endif // METRICS_H
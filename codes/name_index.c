@@ -0,0 +1,97 @@
+/// name_index.c
+#include "name_index.h"
+#include "epoch.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// FNV-1a; titles are short, so this is cheaper than anything fancier
+DWORD HashName(const char* name) {
+    DWORD hash = 2166136261u;
+    for (const unsigned char* p = (const unsigned char*)name; *p; p++) {
+        hash ^= *p;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static NameTable* AllocTable(DWORD capacity) {
+    NameTable* table = (NameTable*)calloc(1, sizeof(NameTable) + sizeof(NameSlot) * capacity);
+    if (table) table->capacity = capacity;
+    return table;
+}
+
+BOOL NameIndexInit(NameIndex* index, DWORD expected) {
+    DWORD capacity = NAME_INDEX_MIN_CAPACITY;
+    while (capacity < expected * 2) capacity <<= 1;   // stay at most half full
+
+    index->count = 0;
+    index->table = AllocTable(capacity);
+    return index->table != NULL;
+}
+
+void NameIndexFree(NameIndex* index) {
+    free(index->table);
+    index->table = NULL;
+    index->count = 0;
+}
+
+// Fill a free slot; the key store is the publication point for readers
+static void PlaceSlot(NameTable* table, DWORD hash, int value, const char* key) {
+    DWORD mask = table->capacity - 1;
+    DWORD i = hash & mask;
+    while (table->slots[i].key) i = (i + 1) & mask;
+
+    table->slots[i].hash = hash;
+    table->slots[i].value = value;
+    WritePointerRelease((PVOID*)&table->slots[i].key, (PVOID)key);
+}
+
+static BOOL Grow(NameIndex* index) {
+    NameTable* old = index->table;
+    NameTable* table = AllocTable(old->capacity * 2);
+    if (!table) return FALSE;
+
+    for (DWORD i = 0; i < old->capacity; i++) {
+        const NameSlot* slot = &old->slots[i];
+        if (slot->key) PlaceSlot(table, slot->hash, slot->value, slot->key);
+    }
+
+    // Readers still probing the old table finish there; free it after them
+    WritePointerRelease((PVOID*)&index->table, table);
+    EpochRetire(old, free);
+    return TRUE;
+}
+
+BOOL NameIndexInsert(NameIndex* index, const char* key, int value) {
+    if (NameIndexFind(index, key) >= 0) return FALSE;
+
+    // Keep the load factor under 3/4 so probe chains stay short
+    if ((index->count + 1) * 4 > index->table->capacity * 3 && !Grow(index)) return FALSE;
+
+    PlaceSlot(index->table, HashName(key), value, key);
+    index->count++;
+    return TRUE;
+}
+
+BOOL NameIndexReserve(NameIndex* index, DWORD count) {
+    while ((index->count + count) * 4 > index->table->capacity * 3) {
+        if (!Grow(index)) return FALSE;
+    }
+    return TRUE;
+}
+
+int NameIndexFind(const NameIndex* index, const char* key) {
+    const NameTable* table = (const NameTable*)ReadPointerAcquire((PVOID*)&index->table);
+    if (!table) return -1;
+
+    DWORD hash = HashName(key);
+    DWORD mask = table->capacity - 1;
+
+    for (DWORD i = hash & mask; ; i = (i + 1) & mask) {
+        const NameSlot* slot = &table->slots[i];
+        const char* slotKey = (const char*)ReadPointerAcquire((PVOID*)&slot->key);
+        if (!slotKey) return -1;
+        if (slot->hash == hash && strcmp(slotKey, key) == 0) return slot->value;
+    }
+}
@@ -0,0 +1,48 @@
+/// name_index.h
+// Open-addressing hash index from a name (document or section title) to a
+// small integer. Used by FindDoc and FindSection instead of a strcmp scan.
+//
+// Entries are only ever added, never removed. Keys are not copied: the caller
+// passes a pointer to storage that outlives the entry (the title inside the
+// Document). There is a single writer at a time (inserts are serialised by the
+// caller), while lookups take no lock at all: a slot's key is published last,
+// and a grown table replaces the old one with one pointer store, the old table
+// being retired through the epoch collector. Lookups on an index that can grow
+// must therefore run inside EpochEnter/EpochExit.
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include "platform.h"
+
+#define NAME_INDEX_MIN_CAPACITY 16     // power of 2
+
+typedef struct {
+    DWORD hash;
+    int value;
+    const char* volatile key;           // NULL marks an empty slot
+} NameSlot;
+
+typedef struct {
+    DWORD capacity;                     // power of 2
+    NameSlot slots[];
+} NameTable;
+
+typedef struct {
+    NameTable* volatile table;
+    DWORD count;                        // writer only
+} NameIndex;
+
+DWORD HashName(const char* name);
+
+BOOL NameIndexInit(NameIndex* index, DWORD expected);
+void NameIndexFree(NameIndex* index);
+
+// FALSE if the key already exists or the table could not grow
+BOOL NameIndexInsert(NameIndex* index, const char* key, int value);
+// Grow ahead of time so the next count inserts of new keys cannot fail
+BOOL NameIndexReserve(NameIndex* index, DWORD count);
+
+// Value stored for key, or -1
+int NameIndexFind(const NameIndex* index, const char* key);
+
+#endif // NAME_INDEX_H
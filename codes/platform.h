@@ -0,0 +1,150 @@
+/// platform.h
+// Thin portability layer so the document/command logic can be shared between
+// the Windows IOCP server and the Linux servers. On Windows this only pulls in
+// the usual headers; on Linux it maps the handful of Win32 primitives the
+// shared code uses (SRW locks, critical sections, Interlocked*) onto pthreads
+// and GCC atomics.
+#ifndef PLATFORM_H
+#define PLATFORM_H
+
+// Thread-local storage for per-worker state
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#ifdef _WIN32
+
+#define _WINSOCK_DEPRECATED_NO_WARNINGS
+#define _CRT_SECURE_NO_WARNINGS
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <mswsock.h>
+#include <windows.h>
+#include <process.h>
+
+#else
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+typedef int BOOL;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef int64_t LONG64;
+typedef uint64_t ULONGLONG;
+typedef uintptr_t ULONG_PTR;
+typedef void* PVOID;
+typedef int SOCKET;
+
+#ifndef TRUE
+#define TRUE 1
+#endif
+#ifndef FALSE
+#define FALSE 0
+#endif
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+#define closesocket(s) close(s)
+#define ZeroMemory(p, n) memset((p), 0, (n))
+#define Sleep(ms) usleep((useconds_t)(ms) * 1000)
+#define GetCurrentThreadId() ((DWORD)syscall(SYS_gettid))
+#define GetLastError() errno
+#define WSAGetLastError() errno
+#define _stricmp(a, b) strcasecmp((a), (b))
+
+#define CONTAINING_RECORD(address, type, field) \
+    ((type*)((char*)(address) - offsetof(type, field)))
+
+// SRWLOCK -> pthread rwlock
+typedef pthread_rwlock_t SRWLOCK;
+#define InitializeSRWLock(l) pthread_rwlock_init((l), NULL)
+#define AcquireSRWLockShared(l) pthread_rwlock_rdlock(l)
+#define ReleaseSRWLockShared(l) pthread_rwlock_unlock(l)
+#define AcquireSRWLockExclusive(l) pthread_rwlock_wrlock(l)
+#define ReleaseSRWLockExclusive(l) pthread_rwlock_unlock(l)
+
+// CRITICAL_SECTION -> recursive pthread mutex (Win32 critical sections are re-entrant)
+typedef pthread_mutex_t CRITICAL_SECTION;
+
+static inline void InitializeCriticalSection(CRITICAL_SECTION* cs) {
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(cs, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+#define EnterCriticalSection(cs) pthread_mutex_lock(cs)
+#define LeaveCriticalSection(cs) pthread_mutex_unlock(cs)
+#define DeleteCriticalSection(cs) pthread_mutex_destroy(cs)
+
+// CONDITION_VARIABLE -> pthread condition; only INFINITE waits are supported
+typedef pthread_cond_t CONDITION_VARIABLE;
+#define INFINITE 0xFFFFFFFF
+#define InitializeConditionVariable(c) pthread_cond_init((c), NULL)
+static inline BOOL SleepConditionVariableCS(CONDITION_VARIABLE* c, CRITICAL_SECTION* cs, DWORD ms) {
+    (void)ms;
+    return pthread_cond_wait(c, cs) == 0;
+}
+#define WakeConditionVariable(c) pthread_cond_signal(c)
+#define WakeAllConditionVariable(c) pthread_cond_broadcast(c)
+
+// Interlocked* -> GCC atomics (full barriers, like the Win32 versions)
+#define InterlockedIncrement(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedIncrement64(p) __atomic_add_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedDecrement64(p) __atomic_sub_fetch((p), 1, __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchangeAdd64(p, v) __atomic_fetch_add((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedExchange64(p, v) __atomic_exchange_n((p), (v), __ATOMIC_SEQ_CST)
+#define InterlockedCompareExchange(p, xchg, cmp) \
+    __sync_val_compare_and_swap((p), (cmp), (xchg))
+#define InterlockedCompareExchange64(p, xchg, cmp) \
+    __sync_val_compare_and_swap((p), (cmp), (xchg))
+
+static inline PVOID InterlockedCompareExchangePointer(PVOID volatile* p, PVOID xchg, PVOID cmp) {
+    return __sync_val_compare_and_swap(p, cmp, xchg);
+}
+
+static inline PVOID InterlockedExchangePointer(PVOID volatile* p, PVOID v) {
+    return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+}
+
+// Acquire loads / release stores for publishing immutable data
+#define ReadAcquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WriteRelease(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define ReadAcquire64(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ReadPointerAcquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define WritePointerRelease(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+// Milliseconds from a monotonic clock
+static inline ULONGLONG GetTickCount64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ULONGLONG)ts.tv_sec * 1000 + (ULONGLONG)ts.tv_nsec / 1000000;
+}
+
+#endif // _WIN32
+
+#endif // PLATFORM_H
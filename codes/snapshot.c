@@ -0,0 +1,414 @@
+/// snapshot.c
+#include "snapshot.h"
+#include "log.h"
+#include "wal.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+struct SnapshotWriter {
+    FILE* file;
+    char* path;
+    char* tempPath;
+    uint64_t pos;
+    BOOL failed;
+    int error;                      // errno, or GetLastError() for the rename
+    SnapshotHeader header;
+    SnapshotDocument* docs;         // sectionsOffset holds an index into sections until commit
+    int docCount;
+    int docCap;
+    SnapshotSection* sections;
+    int sectionCount;
+    int sectionCap;
+};
+
+// The snapshot mapped at startup; never unmapped, bodies point into it
+static const unsigned char* g_map = NULL;
+static uint64_t g_mapSize = 0;
+static int g_mappedSlot = -1;
+static char* g_mappedPath = NULL;   // that slot's file
+static uint32_t g_sequence = 0;     // of the newest snapshot, loaded or written
+static SnapshotFn g_snapshotFn = NULL;
+static DWORD g_snapshotInterval = 0;
+
+// Loading
+
+static BOOL InMap(uint64_t offset, uint64_t len) {
+    return offset <= g_mapSize && len <= g_mapSize - offset;
+}
+
+// A NUL-terminated string at offset, entirely inside the mapping
+static BOOL StringOk(uint64_t offset) {
+    return offset > 0 && offset < g_mapSize && memchr(g_map + offset, 0, (size_t)(g_mapSize - offset)) != NULL;
+}
+
+// Header and catalog only; section contents are checked when first loaded
+static BOOL CheckCatalog(void) {
+    const SnapshotHeader* header = (const SnapshotHeader*)g_map;
+    if (g_mapSize < sizeof(SnapshotHeader) || memcmp(header->magic, SNAPSHOT_MAGIC, 8) != 0) return FALSE;
+    if (header->fileSize != g_mapSize || header->catalogOffset % 8 != 0) return FALSE;
+    if (!InMap(header->catalogOffset, (uint64_t)header->docCount * sizeof(SnapshotDocument))) return FALSE;
+
+    const SnapshotDocument* docs = (const SnapshotDocument*)(g_map + header->catalogOffset);
+    for (uint32_t i = 0; i < header->docCount; i++) {
+        const SnapshotDocument* doc = &docs[i];
+        if (!StringOk(doc->titleOffset) || doc->sectionCount == 0 || doc->sectionsOffset % 8 != 0 ||
+            !InMap(doc->sectionsOffset, (uint64_t)doc->sectionCount * sizeof(SnapshotSection))) {
+            return FALSE;
+        }
+        const SnapshotSection* sections = (const SnapshotSection*)(g_map + doc->sectionsOffset);
+        for (uint32_t j = 0; j < doc->sectionCount; j++) {
+            if (!StringOk(sections[j].titleOffset)) return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+// Slot 0 is path itself, slot 1 is path + ".1"
+static char* SlotPath(const char* path, int slot) {
+    size_t len = strlen(path) + 3;
+    char* slotPath = (char*)malloc(len);
+    if (!slotPath) return NULL;
+    if (slot == 0) snprintf(slotPath, len, "%s", path);
+    else snprintf(slotPath, len, "%s.%d", path, slot);
+    return slotPath;
+}
+
+static BOOL MapFile(const char* path, const unsigned char** view, uint64_t* viewSize) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) return FALSE;
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    CloseHandle(file);
+    if (!mapping) return FALSE;
+    // The view keeps the mapping alive
+    *view = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!*view) return FALSE;
+    *viewSize = (uint64_t)size.QuadPart;
+#else
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return FALSE;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+        map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) return FALSE;
+    *view = (const unsigned char*)map;
+    *viewSize = (uint64_t)st.st_size;
+#endif
+    return TRUE;
+}
+
+static void UnmapFile(const unsigned char* view, uint64_t viewSize) {
+#ifdef _WIN32
+    (void)viewSize;
+    UnmapViewOfFile(view);
+#else
+    munmap((void*)view, (size_t)viewSize);
+#endif
+}
+
+// Both slots are tried and the intact one with the higher sequence is kept
+// mapped; the other is left for SnapshotBegin to write over
+BOOL SnapshotOpen(const char* path) {
+    const unsigned char* best = NULL;
+    uint64_t bestSize = 0;
+    for (int slot = 0; slot < SNAPSHOT_SLOTS; slot++) {
+        char* slotPath = SlotPath(path, slot);
+        const unsigned char* view;
+        uint64_t viewSize;
+        if (!slotPath || !MapFile(slotPath, &view, &viewSize)) {
+            free(slotPath);
+            continue;
+        }
+
+        g_map = view;
+        g_mapSize = viewSize;
+        BOOL intact = CheckCatalog();
+        if (!intact) LOG_ERROR("[ERROR] Snapshot %s is damaged, ignoring it\n", slotPath);
+
+        uint32_t sequence = intact ? ((const SnapshotHeader*)view)->sequence : 0;
+        if (intact && (!best || sequence > g_sequence)) {
+            if (best) UnmapFile(best, bestSize);
+            free(g_mappedPath);
+            best = view;
+            bestSize = viewSize;
+            g_sequence = sequence;
+            g_mappedSlot = slot;
+            g_mappedPath = slotPath;
+        }
+        else {
+            UnmapFile(view, viewSize);
+            free(slotPath);
+        }
+    }
+
+    g_map = best;
+    g_mapSize = bestSize;
+    return best != NULL;
+}
+
+const char* SnapshotMappedPath(void) {
+    return g_mappedPath;
+}
+
+const SnapshotDocument* SnapshotDocuments(int* count) {
+    if (!g_map) {
+        *count = 0;
+        return NULL;
+    }
+    const SnapshotHeader* header = (const SnapshotHeader*)g_map;
+    *count = (int)header->docCount;
+    return (const SnapshotDocument*)(g_map + header->catalogOffset);
+}
+
+const SnapshotSection* SnapshotSections(const SnapshotDocument* doc) {
+    return (const SnapshotSection*)(g_map + doc->sectionsOffset);
+}
+
+const char* SnapshotString(uint64_t offset) {
+    return (const char*)(g_map + offset);
+}
+
+SectionBody* SnapshotLoadBody(const SnapshotSection* entry) {
+    if (entry->bodyOffset == 0) return NULL;
+
+    uint64_t lineCount = entry->lineCount;
+    if (entry->bodyOffset % 8 != 0 || !InMap(entry->bodyOffset, lineCount * 8) ||
+        !InMap(entry->bodyOffset + lineCount * 8, entry->textLen)) {
+        LOG_ERROR("[ERROR] Snapshot section %s is damaged\n", SnapshotString(entry->titleOffset));
+        return NULL;
+    }
+
+    // Only the offset table is read here; the text is faulted in as it is sent
+    const uint64_t* offsets = (const uint64_t*)(g_map + entry->bodyOffset);
+    for (uint64_t i = 0; i < lineCount; i++) {
+        // Line i ends with a NUL before line i + 1 (or the end of the text)
+        uint64_t end = i + 1 < lineCount ? offsets[i + 1] : entry->textLen;
+        if ((i == 0 && offsets[0] != 0) || offsets[i] >= end) {
+            LOG_ERROR("[ERROR] Snapshot section %s is damaged\n", SnapshotString(entry->titleOffset));
+            return NULL;
+        }
+    }
+
+    // Storage over the mapped text with no room left, so the first append
+    // copies the section out of the mapping
+    char* text = (char*)(offsets + lineCount);
+    SectionBody* body = AllocSectionBody((int)lineCount, (size_t)entry->textLen, text);
+    if (!body) return NULL;
+    BodyStorage* storage = body->storage;
+    for (uint64_t i = 0; i < lineCount; i++) storage->lines[i] = text + offsets[i];
+    storage->lineCount = (int)lineCount;
+    storage->textLen = (size_t)entry->textLen;
+    body->version = entry->version;
+    body->lineCount = storage->lineCount;
+    body->textLen = storage->textLen;
+    return body;
+}
+
+// Writing
+
+// The first failure is the one reported
+static void Fail(SnapshotWriter* w, int error) {
+    if (w->failed) return;
+    w->failed = TRUE;
+    w->error = error;
+}
+
+static void WriteBytes(SnapshotWriter* w, const void* data, size_t len) {
+    if (w->failed || len == 0) return;
+    if (fwrite(data, 1, len, w->file) != len) Fail(w, errno);
+    w->pos += len;
+}
+
+static void Align8(SnapshotWriter* w) {
+    static const char zeros[8] = { 0 };
+    WriteBytes(w, zeros, (size_t)((8 - w->pos % 8) % 8));
+}
+
+static uint64_t WriteString(SnapshotWriter* w, const char* s) {
+    uint64_t offset = w->pos;
+    WriteBytes(w, s, strlen(s) + 1);
+    return offset;
+}
+
+SnapshotWriter* SnapshotBegin(const char* path, ULONGLONG walPosition) {
+    SnapshotWriter* w = (SnapshotWriter*)calloc(1, sizeof(SnapshotWriter));
+    if (!w) return NULL;
+    // Never the mapped slot: Windows cannot replace a file that is mapped
+    w->path = SlotPath(path, g_mappedSlot == 0 ? 1 : 0);
+    size_t len = w->path ? strlen(w->path) : 0;
+    w->tempPath = (char*)malloc(len + 5);
+    if (w->path && w->tempPath) {
+        snprintf(w->tempPath, len + 5, "%s.tmp", w->path);
+        w->file = fopen(w->tempPath, "wb");
+    }
+    if (!w->file) {
+        LOG_ERROR("[ERROR] Cannot create snapshot %s.tmp: %d\n", w->path ? w->path : path, errno);
+        free(w->path);
+        free(w->tempPath);
+        free(w);
+        return NULL;
+    }
+
+    // Filled in by SnapshotCommit
+    memcpy(w->header.magic, SNAPSHOT_MAGIC, 8);
+    w->header.walPosition = walPosition;
+    w->header.sequence = g_sequence + 1;
+    WriteBytes(w, &w->header, sizeof(w->header));
+    return w;
+}
+
+void SnapshotAddDocument(SnapshotWriter* w, const char* title, int sectionCount) {
+    if (w->failed) return;
+    if (w->docCount == w->docCap) {
+        int cap = w->docCap ? w->docCap * 2 : 64;
+        SnapshotDocument* docs = (SnapshotDocument*)realloc(w->docs, sizeof(SnapshotDocument) * cap);
+        if (!docs) {
+            Fail(w, ENOMEM);
+            return;
+        }
+        w->docs = docs;
+        w->docCap = cap;
+    }
+    SnapshotDocument* doc = &w->docs[w->docCount++];
+    memset(doc, 0, sizeof(*doc));
+    doc->titleOffset = WriteString(w, title);
+    doc->sectionsOffset = (uint64_t)w->sectionCount;
+    doc->sectionCount = (uint32_t)sectionCount;
+}
+
+void SnapshotAddSection(SnapshotWriter* w, const char* title, const SectionBody* body) {
+    if (w->failed) return;
+    if (w->sectionCount == w->sectionCap) {
+        int cap = w->sectionCap ? w->sectionCap * 2 : 256;
+        SnapshotSection* sections = (SnapshotSection*)realloc(w->sections, sizeof(SnapshotSection) * cap);
+        if (!sections) {
+            Fail(w, ENOMEM);
+            return;
+        }
+        w->sections = sections;
+        w->sectionCap = cap;
+    }
+    SnapshotSection* entry = &w->sections[w->sectionCount++];
+    memset(entry, 0, sizeof(*entry));
+    entry->titleOffset = WriteString(w, title);
+    if (!body) return;
+
+    // A body's text is contiguous from its first line, whether it was
+    // built by a commit or mapped from the previous snapshot
+    Align8(w);
+    entry->bodyOffset = w->pos;
+    entry->version = body->version;
+    entry->lineCount = (uint32_t)body->lineCount;
+    entry->textLen = body->textLen;
+    for (int i = 0; i < body->lineCount; i++) {
+        uint64_t offset = (uint64_t)(body->lines[i] - body->lines[0]);
+        WriteBytes(w, &offset, sizeof(offset));
+    }
+    if (body->lineCount > 0) WriteBytes(w, body->lines[0], body->textLen);
+}
+
+static BOOL SyncFile(FILE* file) {
+    if (fflush(file) != 0) return FALSE;
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+}
+
+static void FreeWriter(SnapshotWriter* w) {
+    free(w->docs);
+    free(w->sections);
+    free(w->path);
+    free(w->tempPath);
+    free(w);
+}
+
+ULONGLONG SnapshotCommit(SnapshotWriter* w) {
+    // The section tables, then the document table pointing at them
+    Align8(w);
+    uint64_t sectionsBase = w->pos;
+    WriteBytes(w, w->sections, sizeof(SnapshotSection) * w->sectionCount);
+    for (int i = 0; i < w->docCount; i++) {
+        w->docs[i].sectionsOffset = sectionsBase + w->docs[i].sectionsOffset * sizeof(SnapshotSection);
+    }
+    w->header.catalogOffset = w->pos;
+    WriteBytes(w, w->docs, sizeof(SnapshotDocument) * w->docCount);
+    w->header.docCount = (uint32_t)w->docCount;
+    w->header.fileSize = w->pos;
+
+    if (!w->failed && (fseek(w->file, 0, SEEK_SET) != 0 ||
+        fwrite(&w->header, sizeof(w->header), 1, w->file) != 1 || !SyncFile(w->file))) {
+        Fail(w, errno);
+    }
+    if (fclose(w->file) != 0) Fail(w, errno);
+
+    // The newest snapshot, in the other slot, stays in place until this one
+    // is complete; the higher sequence makes this one win from then on
+    ULONGLONG size = w->pos;
+#ifdef _WIN32
+    if (!w->failed && !MoveFileExA(w->tempPath, w->path, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        Fail(w, (int)GetLastError());
+    }
+#else
+    if (!w->failed && rename(w->tempPath, w->path) != 0) Fail(w, errno);
+    if (!w->failed) SyncParentDirectory(w->path);
+#endif
+    if (w->failed) {
+        LOG_ERROR("[ERROR] Writing snapshot %s failed: %d\n", w->path, w->error);
+        remove(w->tempPath);
+        size = 0;
+    } else {
+        g_sequence = w->header.sequence;
+    }
+    FreeWriter(w);
+    return size;
+}
+
+#ifdef _WIN32
+static unsigned __stdcall SnapshotThread(void* param)
+#else
+static void* SnapshotThread(void* param)
+#endif
+{
+    (void)param;
+    while (1) {
+        Sleep(g_snapshotInterval * 1000);
+        g_snapshotFn();
+    }
+    return 0;
+}
+
+void SnapshotStartThread(DWORD intervalSeconds, SnapshotFn fn) {
+    g_snapshotFn = fn;
+    g_snapshotInterval = intervalSeconds;
+#ifdef _WIN32
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, SnapshotThread, NULL, 0, NULL);
+    if (thread == NULL) return;
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, SnapshotThread, NULL) != 0) return;
+    pthread_detach(thread);
+#endif
+}
@@ -0,0 +1,90 @@
+/// snapshot.h
+// On-disk snapshot of the whole document store, mapped at startup and served
+// from in place.
+//
+// The file is laid out so nothing has to be parsed: fixed-size entries in the
+// host's (little-endian) layout, reached by offsets from the start of the
+// file. Startup maps it, checks the header and the catalog (one entry per
+// document and section) and registers the documents; a section's contents
+// are not touched until it is first read or written, when its line table is
+// built over the mapped text (SnapshotLoadBody). Restart time therefore grows
+// with the number of sections and the pages actually used, not with the
+// amount of text stored.
+//
+//   SnapshotHeader
+//   titles and section bodies (u64 line offsets, then the lines' text,
+//   each NUL-terminated), 8-byte aligned
+//   SnapshotSection[] for every document, back to back
+//   SnapshotDocument[docCount]               <- header.catalogOffset
+//
+// Snapshots are written in the background (docs_server.c walks the published
+// bodies, which are immutable, so writers never wait) to a temporary file
+// that is renamed into place once it is synced. The mapping of the snapshot
+// loaded at startup lives as long as the process, and Windows will not
+// replace a mapped file, so there are two slots, path and path + ".1": new
+// snapshots always go to the one that is not mapped, and the header's
+// sequence number tells which of the two is newer.
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "platform.h"
+#include "docs_server.h"
+
+#define SNAPSHOT_MAGIC "DOCSNAP1"
+#define SNAPSHOT_DEFAULT_INTERVAL 60    // seconds between snapshots (DOCS_SNAPSHOT_INTERVAL)
+#define SNAPSHOT_SLOTS 2
+
+typedef struct {
+    char magic[8];
+    uint64_t fileSize;
+    uint64_t catalogOffset;     // SnapshotDocument[docCount]
+    uint64_t walPosition;       // log position the snapshot was started at
+    uint32_t docCount;
+    uint32_t sequence;          // one more than the snapshot it replaces
+} SnapshotHeader;
+
+typedef struct {
+    uint64_t titleOffset;
+    uint64_t sectionsOffset;    // SnapshotSection[sectionCount]
+    uint32_t sectionCount;
+    uint32_t reserved;
+} SnapshotDocument;
+
+typedef struct SnapshotSection {
+    uint64_t titleOffset;
+    uint64_t bodyOffset;        // 0 if the section was never written
+    int64_t version;
+    uint64_t textLen;
+    uint32_t lineCount;
+    uint32_t reserved;
+} SnapshotSection;
+
+typedef struct SnapshotWriter SnapshotWriter;
+
+// Called by the snapshot thread every interval; takes the snapshot if it is due
+typedef void (*SnapshotFn)(void);
+
+// Loading. SnapshotOpen maps the newer intact slot of path; FALSE if there
+// is no usable snapshot.
+BOOL SnapshotOpen(const char* path);
+const char* SnapshotMappedPath(void);   // the slot SnapshotOpen mapped, or NULL
+const SnapshotDocument* SnapshotDocuments(int* count);
+const SnapshotSection* SnapshotSections(const SnapshotDocument* doc);
+const char* SnapshotString(uint64_t offset);
+// A new body (refs 1) whose lines point into the mapping, or NULL if the
+// entry is corrupt or memory ran out
+SectionBody* SnapshotLoadBody(const SnapshotSection* entry);
+
+// Writing, to the unmapped slot of path + ".tmp" until SnapshotCommit renames
+// it over that slot
+SnapshotWriter* SnapshotBegin(const char* path, ULONGLONG walPosition);
+void SnapshotAddDocument(SnapshotWriter* w, const char* title, int sectionCount);
+void SnapshotAddSection(SnapshotWriter* w, const char* title, const SectionBody* body);
+// Sync and publish the snapshot; the writer is freed either way. Returns the
+// file size, or 0 on failure.
+ULONGLONG SnapshotCommit(SnapshotWriter* w);
+
+// Run fn every intervalSeconds on a background thread
+void SnapshotStartThread(DWORD intervalSeconds, SnapshotFn fn);
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,109 @@
+/// timer_wheel.c
+#include "timer_wheel.h"
+
+#include <string.h>
+
+#define TICK_MICROS ((ULONGLONG)TIMER_TICK_MS * 1000)
+#define SLOT_MASK (TIMER_SLOTS - 1)
+#define WHEEL_SPAN (1ULL << (TIMER_LEVELS * TIMER_SLOT_BITS))     // ticks
+
+void TimerWheelInit(TimerWheel* wheel, ULONGLONG now) {
+    ZeroMemory(wheel, sizeof(*wheel));
+    wheel->current = now / TICK_MICROS;
+}
+
+// Into the slot for node->due at the lowest level whose span reaches it
+static void Link(TimerWheel* wheel, TimerNode* node) {
+    ULONGLONG delta = node->due - wheel->current;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= 1ULL << ((level + 1) * TIMER_SLOT_BITS)) level++;
+
+    TimerNode** slot = &wheel->slots[level][(node->due >> (level * TIMER_SLOT_BITS)) & SLOT_MASK];
+    node->next = *slot;
+    if (node->next) node->next->link = &node->next;
+    *slot = node;
+    node->link = slot;
+}
+
+static void Unlink(TimerNode* node) {
+    *node->link = node->next;
+    if (node->next) node->next->link = node->link;
+    node->next = NULL;
+    node->link = NULL;
+}
+
+void TimerArm(TimerWheel* wheel, TimerNode* node, ULONGLONG due) {
+    if (node->link) Unlink(node);
+    else wheel->count++;
+
+    // First tick at or after due; a time already past fires on the next one
+    ULONGLONG tick = (due + TICK_MICROS - 1) / TICK_MICROS;
+    if (tick < wheel->current) tick = wheel->current;
+    if (tick - wheel->current >= WHEEL_SPAN) tick = wheel->current + WHEEL_SPAN - 1;
+    node->due = tick;
+    Link(wheel, node);
+}
+
+void TimerCancel(TimerWheel* wheel, TimerNode* node) {
+    if (!node->link) return;
+    Unlink(node);
+    wheel->count--;
+}
+
+// Spread one slot of an upper level over the levels below. Everything in it
+// is due within that level's slot span of the current tick.
+static void Cascade(TimerWheel* wheel, int level, int index) {
+    TimerNode* node = wheel->slots[level][index];
+    wheel->slots[level][index] = NULL;
+    while (node) {
+        TimerNode* next = node->next;
+        Link(wheel, node);
+        node = next;
+    }
+}
+
+void TimerWheelAdvance(TimerWheel* wheel, ULONGLONG now, TimerExpireFn expire, void* ctx) {
+    ULONGLONG target = now / TICK_MICROS;
+
+    while (wheel->current <= target) {
+        // Nothing armed: the ticks in between have nothing to run or move
+        if (wheel->count == 0) {
+            wheel->current = target + 1;
+            return;
+        }
+
+        int index = (int)(wheel->current & SLOT_MASK);
+        for (int level = 1; index == 0 && level < TIMER_LEVELS; level++) {
+            index = (int)((wheel->current >> (level * TIMER_SLOT_BITS)) & SLOT_MASK);
+            Cascade(wheel, level, index);
+        }
+        index = (int)(wheel->current & SLOT_MASK);
+
+        // Detached first, so a timer re-armed by expire lands on a later tick.
+        // Still a proper list: expire may cancel other timers in it.
+        TimerNode* expired = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        if (expired) expired->link = &expired;
+        wheel->current++;
+
+        while (expired) {
+            TimerNode* node = expired;
+            Unlink(node);
+            wheel->count--;
+            expire(node, ctx);
+        }
+    }
+}
+
+int TimerWheelTimeout(const TimerWheel* wheel, ULONGLONG now) {
+    if (wheel->count == 0) return -1;
+
+    // The next occupied level-0 slot, or the next cascade, whichever is first
+    ULONGLONG ticks = 0;
+    int first = (int)(wheel->current & SLOT_MASK);
+    while (first + ticks < TIMER_SLOTS && !wheel->slots[0][first + ticks]) ticks++;
+
+    ULONGLONG wake = (wheel->current + ticks) * TICK_MICROS;
+    if (wake <= now) return 0;
+    return (int)((wake - now + 999) / 1000);
+}
@@ -0,0 +1,55 @@
+/// timer_wheel.h
+// Hierarchical timing wheel for connection deadlines.
+//
+// Four levels of 64 slots each. Level 0 holds timers due within the next 64
+// ticks, one slot per tick; each level above covers 64 times the span of the
+// one below. A timer is linked into the slot for its due tick at the lowest
+// level that reaches it, so arming and cancelling are a list insert and
+// unlink whatever the number of timers. Whenever level 0 wraps, the next
+// slot of level 1 is emptied into the levels below (and so on upwards), so
+// every timer is touched at most once per level before it fires.
+//
+// Not synchronised: each wheel belongs to one thread, or is used under its
+// owner's lock (iocp_server.c). Times are MetricsNow() microseconds.
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include "platform.h"
+
+#define TIMER_TICK_MS 100
+#define TIMER_LEVELS 4
+#define TIMER_SLOT_BITS 6
+#define TIMER_SLOTS (1 << TIMER_SLOT_BITS)
+
+// Embedded in whatever it times; link is NULL while the timer is not armed
+typedef struct TimerNode {
+    struct TimerNode* next;
+    struct TimerNode** link;    // the pointer to this node: a slot or the previous node's next
+    ULONGLONG due;              // tick
+} TimerNode;
+
+// Called for each expired timer, already unlinked; it may arm it again
+typedef void (*TimerExpireFn)(TimerNode* node, void* ctx);
+
+typedef struct {
+    ULONGLONG current;          // next tick to run
+    int count;                  // armed timers
+    TimerNode* slots[TIMER_LEVELS][TIMER_SLOTS];
+} TimerWheel;
+
+void TimerWheelInit(TimerWheel* wheel, ULONGLONG now);
+
+// Arm node to fire at time due (at the first tick at or after it), moving it
+// if it is already armed. Beyond the wheel's span it fires early, at the
+// span, and the owner re-arms it for the rest.
+void TimerArm(TimerWheel* wheel, TimerNode* node, ULONGLONG due);
+void TimerCancel(TimerWheel* wheel, TimerNode* node);   // no-op if not armed
+
+// Run every tick up to now, calling expire for each timer that fires
+void TimerWheelAdvance(TimerWheel* wheel, ULONGLONG now, TimerExpireFn expire, void* ctx);
+
+// Milliseconds until the next tick that has something to do, or -1 when no
+// timer is armed. For the event loop's wait.
+int TimerWheelTimeout(const TimerWheel* wheel, ULONGLONG now);
+
+#endif // TIMER_WHEEL_H
@@ -0,0 +1,558 @@
+/// uring_backend.c
+// Linux io_uring backend for the document server.
+//
+// This mirrors the IOCP design in iocp_server.c: every operation is described
+// by a PER_IO_DATA whose address is carried through the kernel as the
+// completion's user_data, and WorkerThread dispatches on OP_ACCEPT / OP_RECV /
+// OP_SEND exactly like the IOCP worker. The differences are:
+//   - each worker owns its own ring (no shared completion queue);
+//   - one multishot accept on the worker's own listener replaces the
+//     pre-posted AcceptEx calls;
+//   - recv is multishot and draws from a per-worker provided buffer ring, so
+//     idle connections do not pin a receive buffer;
+//   - SQEs are batched and published with a single io_uring_enter per loop
+//     iteration, which also waits for the next completions.
+// Requires Linux 5.19+ (multishot recv, provided buffer rings).
+#include "linux_server.h"
+#include "io_pool.h"
+#include "log.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <linux/io_uring.h>
+
+#define URING_ENTRIES 1024
+#define RECV_BUF_COUNT 512          // provided receive buffers per worker (power of 2)
+#define RECV_BUF_GROUP 0
+
+// Minimal ring wrapper (no liburing dependency)
+typedef struct {
+    int fd;
+    unsigned* sqHead;
+    unsigned* sqTail;
+    unsigned sqMask;
+    unsigned* sqArray;
+    struct io_uring_sqe* sqes;
+    unsigned sqLocalTail;           // SQEs prepared but not yet published
+    unsigned* cqHead;
+    unsigned* cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe* cqes;
+    void* sqRingPtr;
+    size_t sqRingSize;
+    void* cqRingPtr;
+    size_t cqRingSize;
+    size_t sqesSize;
+} Uring;
+
+typedef struct {
+    Uring ring;
+    struct io_uring_buf_ring* bufRing;
+    size_t bufRingSize;
+    char* bufBase;
+    unsigned short bufTail;
+    PER_IO_DATA* acceptIo;
+    PER_IO_DATA* wakeIo;        // read on the worker's eventfd (OP_WRITE_WAIT)
+} UringWorker;
+
+#define URING(w) ((UringWorker*)(w)->state)
+
+static int SysUringSetup(unsigned entries, struct io_uring_params* p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int SysUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+    void* arg, size_t argSize) {
+    return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+static int SysUringRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs);
+}
+
+static BOOL UringInit(Uring* ring, unsigned entries) {
+    struct io_uring_params params;
+    ZeroMemory(ring, sizeof(*ring));
+    ZeroMemory(&params, sizeof(params));
+
+    // Each ring is driven by exactly one worker thread
+    params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    ring->fd = SysUringSetup(entries, &params);
+    if (ring->fd < 0 && errno == EINVAL) {
+        ZeroMemory(&params, sizeof(params));
+        ring->fd = SysUringSetup(entries, &params);
+    }
+    if (ring->fd < 0) {
+        LOG_ERROR("[ERROR] io_uring_setup failed: %d\n", errno);
+        return FALSE;
+    }
+
+    ring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cqRingSize > ring->sqRingSize) ring->sqRingSize = ring->cqRingSize;
+        ring->cqRingSize = ring->sqRingSize;
+    }
+
+    ring->sqRingPtr = mmap(NULL, ring->sqRingSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sqRingPtr == MAP_FAILED) {
+        LOG_ERROR("[ERROR] mmap of SQ ring failed: %d\n", errno);
+        close(ring->fd);
+        return FALSE;
+    }
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cqRingPtr = ring->sqRingPtr;
+    }
+    else {
+        ring->cqRingPtr = mmap(NULL, ring->cqRingSize, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cqRingPtr == MAP_FAILED) {
+            LOG_ERROR("[ERROR] mmap of CQ ring failed: %d\n", errno);
+            munmap(ring->sqRingPtr, ring->sqRingSize);
+            close(ring->fd);
+            return FALSE;
+        }
+    }
+
+    ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe*)mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        LOG_ERROR("[ERROR] mmap of SQEs failed: %d\n", errno);
+        if (ring->cqRingPtr != ring->sqRingPtr) munmap(ring->cqRingPtr, ring->cqRingSize);
+        munmap(ring->sqRingPtr, ring->sqRingSize);
+        close(ring->fd);
+        return FALSE;
+    }
+
+    char* sq = (char*)ring->sqRingPtr;
+    char* cq = (char*)ring->cqRingPtr;
+    ring->sqHead = (unsigned*)(sq + params.sq_off.head);
+    ring->sqTail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sqArray = (unsigned*)(sq + params.sq_off.array);
+    ring->sqLocalTail = *ring->sqTail;
+    ring->cqHead = (unsigned*)(cq + params.cq_off.head);
+    ring->cqTail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+    return TRUE;
+}
+
+// Publish queued SQEs and optionally wait for at least one completion, for
+// at most timeoutMs unless that is -1 (ETIME when it runs out).
+// This is the only place the worker enters the kernel.
+static int UringSubmit(Uring* ring, unsigned waitFor, int timeoutMs) {
+    unsigned toSubmit = ring->sqLocalTail - *ring->sqTail;
+    if (toSubmit) {
+        __atomic_store_n(ring->sqTail, ring->sqLocalTail, __ATOMIC_RELEASE);
+    }
+    if (!toSubmit && !waitFor) return 0;
+
+    unsigned flags = waitFor ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    void* argPtr = NULL;
+    size_t argSize = 0;
+    if (waitFor && timeoutMs >= 0) {
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+        ZeroMemory(&arg, sizeof(arg));
+        arg.ts = (unsigned long long)(uintptr_t)&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argPtr = &arg;
+        argSize = sizeof(arg);
+    }
+
+    int ret;
+    do {
+        ret = SysUringEnter(ring->fd, toSubmit, waitFor, flags, argPtr, argSize);
+    } while (ret < 0 && errno == EINTR);
+    return ret;
+}
+
+static struct io_uring_sqe* UringGetSqe(Uring* ring) {
+    unsigned head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+    if (ring->sqLocalTail - head > ring->sqMask) {
+        // Submission queue full: flush what we have and try again
+        UringSubmit(ring, 0, -1);
+        head = __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+        if (ring->sqLocalTail - head > ring->sqMask) return NULL;
+    }
+
+    unsigned idx = ring->sqLocalTail & ring->sqMask;
+    struct io_uring_sqe* sqe = &ring->sqes[idx];
+    ZeroMemory(sqe, sizeof(*sqe));
+    ring->sqArray[idx] = idx;
+    ring->sqLocalTail++;
+    return sqe;
+}
+
+static BOOL SetupRecvBuffers(UringWorker* w) {
+    w->bufRingSize = RECV_BUF_COUNT * sizeof(struct io_uring_buf);
+    w->bufRing = (struct io_uring_buf_ring*)mmap(NULL, w->bufRingSize,
+        PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (w->bufRing == MAP_FAILED) {
+        LOG_ERROR("[ERROR] mmap of buffer ring failed: %d\n", errno);
+        return FALSE;
+    }
+
+    w->bufBase = (char*)malloc((size_t)RECV_BUF_COUNT * BUF_SIZE);
+    if (!w->bufBase) {
+        munmap(w->bufRing, w->bufRingSize);
+        return FALSE;
+    }
+
+    struct io_uring_buf_reg reg;
+    ZeroMemory(&reg, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(uintptr_t)w->bufRing;
+    reg.ring_entries = RECV_BUF_COUNT;
+    reg.bgid = RECV_BUF_GROUP;
+    if (SysUringRegister(w->ring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        LOG_ERROR("[ERROR] Failed to register provided buffer ring: %d\n", errno);
+        free(w->bufBase);
+        munmap(w->bufRing, w->bufRingSize);
+        return FALSE;
+    }
+
+    w->bufTail = 0;
+    for (unsigned short bid = 0; bid < RECV_BUF_COUNT; bid++) {
+        struct io_uring_buf* buf = &w->bufRing->bufs[(w->bufTail + bid) & (RECV_BUF_COUNT - 1)];
+        buf->addr = (unsigned long long)(uintptr_t)(w->bufBase + (size_t)bid * BUF_SIZE);
+        buf->len = BUF_SIZE;
+        buf->bid = bid;
+    }
+    w->bufTail += RECV_BUF_COUNT;
+    __atomic_store_n(&w->bufRing->tail, w->bufTail, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+static void RecycleRecvBuffer(UringWorker* w, unsigned short bid) {
+    struct io_uring_buf* buf = &w->bufRing->bufs[w->bufTail & (RECV_BUF_COUNT - 1)];
+    buf->addr = (unsigned long long)(uintptr_t)(w->bufBase + (size_t)bid * BUF_SIZE);
+    buf->len = BUF_SIZE;
+    buf->bid = bid;
+    w->bufTail++;
+    __atomic_store_n(&w->bufRing->tail, w->bufTail, __ATOMIC_RELEASE);
+}
+
+static BOOL PostAccept(Worker* w) {
+    struct io_uring_sqe* sqe = UringGetSqe(&URING(w)->ring);
+    if (!sqe) return FALSE;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = w->listenSocket;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = (unsigned long long)(uintptr_t)URING(w)->acceptIo;
+    return TRUE;
+}
+
+// Wait for another thread to signal the mailbox
+static BOOL PostWakeRead(Worker* w) {
+    PER_IO_DATA* wakeIo = URING(w)->wakeIo;
+    struct io_uring_sqe* sqe = UringGetSqe(&URING(w)->ring);
+    if (!sqe) return FALSE;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = w->wakeFd;
+    sqe->addr = (unsigned long long)(uintptr_t)wakeIo->buffer;
+    sqe->len = sizeof(uint64_t);
+    sqe->user_data = (unsigned long long)(uintptr_t)wakeIo;
+    return TRUE;
+}
+
+static BOOL PostRecv(ClientContext* client, PER_IO_DATA* ioData) {
+    struct io_uring_sqe* sqe = UringGetSqe(&URING(client->worker)->ring);
+    if (!sqe) return FALSE;
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = client->socket;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = RECV_BUF_GROUP;
+    sqe->user_data = (unsigned long long)(uintptr_t)ioData;
+    return TRUE;
+}
+
+static BOOL PostSend(ClientContext* client, PER_IO_DATA* ioData) {
+    struct io_uring_sqe* sqe = UringGetSqe(&URING(client->worker)->ring);
+    if (!sqe) return FALSE;
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = client->socket;
+    sqe->addr = (unsigned long long)(uintptr_t)&ioData->msg;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = (unsigned long long)(uintptr_t)ioData;
+    return TRUE;
+}
+
+static void ReleaseClient(ClientContext* client) {
+    if (--client->ioRefs > 0) return;
+    DestroyClientContext(client);
+}
+
+// The multishot recv has ended without an error: arm it again, or keep it
+// parked while flow control has stopped reading
+static BOOL RearmRecv(ClientContext* client, PER_IO_DATA* ioData) {
+    if (client->readStopped) {
+        client->parkedRecv = ioData;
+        return TRUE;
+    }
+    return PostRecv(client, ioData);
+}
+
+static void UringPauseRecv(ClientContext* client) {
+    // The recv then ends with -ECANCELED and is parked. A cancel that works
+    // posts no completion of its own; one that finds the recv already ended
+    // completes with user_data 0, which the loop skips.
+    struct io_uring_sqe* sqe = UringGetSqe(&URING(client->worker)->ring);
+    if (!sqe) return;   // keeps reading; the held-input limit pauses it again
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->addr = (unsigned long long)(uintptr_t)client->recvData;
+    sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+    sqe->user_data = 0;
+}
+
+static void UringResumeRecv(ClientContext* client) {
+    // Not parked yet: the cancelled recv is re-armed when it ends
+    PER_IO_DATA* ioData = client->parkedRecv;
+    if (!ioData) return;
+    client->parkedRecv = NULL;
+
+    if (!PostRecv(client, ioData)) {
+        LOG_ERROR("[ERROR] Submission queue full, dropping client on socket %d\n", client->socket);
+        client->closing = TRUE;
+        shutdown(client->socket, SHUT_RDWR);
+        FreeIoData(ioData);
+        ReleaseClient(client);
+    }
+}
+
+static BOOL UringPostSend(ClientContext* client, PER_IO_DATA* ioData) {
+    if (!PostSend(client, ioData)) {
+        LOG_ERROR("[ERROR] Submission queue full, dropping send\n");
+        FreeSendData(ioData);
+        return FALSE;
+    }
+    client->ioRefs++;
+    return TRUE;
+}
+
+static void HandleAccept(Worker* w, struct io_uring_cqe* cqe) {
+    if (!(cqe->flags & IORING_CQE_F_MORE)) {
+        // Multishot accept was terminated; re-arm it
+        PostAccept(w);
+    }
+
+    if (cqe->res < 0) {
+        LOG_ERROR("[ERROR] Accept failed: %d\n", -cqe->res);
+        return;
+    }
+
+    SOCKET sock = cqe->res;
+    LOG_TRACE("[Worker-%d] Processing OP_ACCEPT, socket=%d\n", GetCurrentThreadId(), sock);
+
+    ClientContext* newClient = CreateClientContext(w, sock);
+
+    // Start receiving from client
+    PER_IO_DATA* recvData = AllocIoData();
+    recvData->operation = OP_RECV;
+    recvData->client = newClient;
+    recvData->socket = sock;
+    newClient->recvData = recvData;
+
+    if (!PostRecv(newClient, recvData)) {
+        LOG_ERROR("[ERROR] Initial recv could not be queued\n");
+        FreeIoData(recvData);
+        DestroyClientContext(newClient);
+        return;
+    }
+    newClient->ioRefs = 1;  // held by the armed recv
+}
+
+static void HandleRecv(UringWorker* w, PER_IO_DATA* ioData, struct io_uring_cqe* cqe) {
+    ClientContext* client = ioData->client;
+    BOOL more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+
+    if (cqe->res > 0) {
+        unsigned short bid = (unsigned short)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+        const char* data = w->bufBase + (size_t)bid * BUF_SIZE;
+
+        LOG_TRACE("[Worker-%d] Processing OP_RECV, bytes=%d, client=%p, isWriteMode=%d\n",
+            GetCurrentThreadId(), cqe->res, (void*)client, client->isWriteMode);
+
+        if (!client->closing) {
+            EnterCriticalSection(&client->cs);
+            ProcessRecvData(client, data, (DWORD)cqe->res);
+            FlushOutput(client);
+            LeaveCriticalSection(&client->cs);
+            UpdateClient(client);
+        }
+        RecycleRecvBuffer(w, bid);
+
+        if (more) return;
+        if (!client->closing && RearmRecv(client, ioData)) return;
+    }
+    else if ((cqe->res == -ENOBUFS || cqe->res == -ECANCELED) && !client->closing) {
+        // Out of provided buffers, or cancelled by flow control; the recv
+        // was terminated, so re-arm or park it
+        if (more || RearmRecv(client, ioData)) return;
+    }
+    else {
+        if (cqe->res == 0) {
+            LOG_DEBUG("[Worker-%d] Client disconnected (OP_RECV with 0 bytes)\n", GetCurrentThreadId());
+        }
+        else if (cqe->res != -ECANCELED) {
+            LOG_ERROR("[Worker-%d] Recv failed: %d\n", GetCurrentThreadId(), -cqe->res);
+        }
+        client->closing = TRUE;
+        if (more) return;
+    }
+
+    // Recv is no longer armed: drop its reference
+    FreeIoData(ioData);
+    ReleaseClient(client);
+}
+
+static void HandleSend(PER_IO_DATA* ioData, struct io_uring_cqe* cqe) {
+    ClientContext* client = ioData->client;
+
+    if (cqe->res < 0) {
+        LOG_ERROR("[Worker-%d] Send failed: %d\n", GetCurrentThreadId(), -cqe->res);
+        ShutdownClient(client);
+    }
+    else if (AdvanceSend(ioData, cqe->res)) {
+        // Short send (or more than IOV_MAX segments): queue the remainder
+        // with the same IO data
+        if (!client->closing && PostSend(client, ioData)) return;
+    }
+    else {
+        LOG_TRACE("[Worker-%d] Send completed: %d bytes\n", GetCurrentThreadId(), cqe->res);
+
+        if (SendCompleted(client)) {
+            LOG_DEBUG("[Worker-%d] Disconnection message sent, closing socket\n", GetCurrentThreadId());
+            // Shut down only; the recv completing with 0 bytes releases the client
+            ShutdownClient(client);
+        }
+        else {
+            // Whatever was queued while this send was in flight, and reading
+            // again if that drained a paused client
+            FlushOutput(client);
+            UpdateClient(client);
+        }
+    }
+
+    FreeSendData(ioData);
+    ReleaseClient(client);
+}
+
+static BOOL UringProbe(void) {
+    // Multishot recv and provided buffer rings need Linux 5.19+; io_uring may
+    // also be disabled outright (kernel.io_uring_disabled, seccomp).
+    UringWorker probe;
+    ZeroMemory(&probe, sizeof(probe));
+    if (!UringInit(&probe.ring, 8)) return FALSE;
+
+    BOOL ok = SetupRecvBuffers(&probe);
+    if (ok) {
+        free(probe.bufBase);
+        munmap(probe.bufRing, probe.bufRingSize);
+    }
+    munmap(probe.ring.sqes, probe.ring.sqesSize);
+    if (probe.ring.cqRingPtr != probe.ring.sqRingPtr) munmap(probe.ring.cqRingPtr, probe.ring.cqRingSize);
+    munmap(probe.ring.sqRingPtr, probe.ring.sqRingSize);
+    close(probe.ring.fd);
+    return ok;
+}
+
+static BOOL UringWorkerInit(Worker* w) {
+    UringWorker* u = (UringWorker*)malloc(sizeof(UringWorker));
+    ZeroMemory(u, sizeof(UringWorker));
+    w->state = u;
+
+    if (!UringInit(&u->ring, URING_ENTRIES) || !SetupRecvBuffers(u)) {
+        return FALSE;
+    }
+
+    u->acceptIo = AllocIoData();
+    ZeroMemory(u->acceptIo, sizeof(PER_IO_DATA));
+    u->acceptIo->operation = OP_ACCEPT;
+    u->acceptIo->socket = w->listenSocket;
+
+    u->wakeIo = AllocIoData();
+    ZeroMemory(u->wakeIo, sizeof(PER_IO_DATA));
+    u->wakeIo->operation = OP_WRITE_WAIT;
+    return PostAccept(w) && PostWakeRead(w);
+}
+
+static void UringWorkerRun(Worker* w) {
+    UringWorker* u = URING(w);
+
+    while (1) {
+        // Submit everything queued by the previous batch and wait for more work
+        if (UringSubmit(&u->ring, 1, TimerTimeout(w)) < 0 && errno != EBUSY && errno != ETIME) {
+            LOG_ERROR("[ERROR] io_uring_enter failed: %d\n", errno);
+            continue;
+        }
+
+        unsigned head = *u->ring.cqHead;
+        unsigned tail = __atomic_load_n(u->ring.cqTail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            struct io_uring_cqe* cqe = &u->ring.cqes[head & u->ring.cqMask];
+            PER_IO_DATA* ioData = (PER_IO_DATA*)(uintptr_t)cqe->user_data;
+            head++;
+
+            // user_data 0 is a flow-control cancel that found its recv already ended
+            if (ioData) {
+                switch (ioData->operation) {
+                case OP_ACCEPT:
+                    HandleAccept(w, cqe);
+                    break;
+
+                case OP_RECV:
+                    HandleRecv(u, ioData, cqe);
+                    break;
+
+                case OP_SEND:
+                    HandleSend(ioData, cqe);
+                    break;
+
+                case OP_WRITE_WAIT:
+                    // eventfd read completed: commits applied by other threads
+                    DrainMailbox(w);
+                    if (!PostWakeRead(w)) {
+                        LOG_ERROR("[ERROR] Worker %d could not re-arm its wakeup read\n", w->id);
+                    }
+                    break;
+
+                case OP_COMMIT_DRAIN:
+                    // Only ever posted to the mailbox
+                    break;
+                }
+            }
+
+            // Let the kernel reuse CQ slots as we go; new SQEs queued above are
+            // published together by the next UringSubmit.
+            __atomic_store_n(u->ring.cqHead, head, __ATOMIC_RELEASE);
+            if (head == tail) {
+                tail = __atomic_load_n(u->ring.cqTail, __ATOMIC_ACQUIRE);
+            }
+        }
+
+        RunTimers(w);
+    }
+}
+
+const LinuxBackend g_uringBackend = {
+    "uring",
+    UringProbe,
+    UringWorkerInit,
+    UringWorkerRun,
+    UringPostSend,
+    ReleaseClient,
+    UringPauseRecv,
+    UringResumeRecv
+};
@@ -0,0 +1,414 @@
+/// wal.c
+#include "wal.h"
+#include "log.h"
+#include "metrics.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#include <io.h>
+#define WalRead(fd, p, n) _read((fd), (p), (unsigned)(n))
+#define WalWriteSome(fd, p, n) _write((fd), (p), (unsigned)(n))
+#define WalSeek(fd, pos, whence) _lseeki64((fd), (pos), (whence))
+#define WalTruncate(fd, size) (_chsize_s((fd), (size)) == 0)
+#define WalSync(fd) (_commit(fd) == 0)
+#define WalClose(fd) _close(fd)
+#else
+#define WalRead(fd, p, n) read((fd), (p), (n))
+#define WalWriteSome(fd, p, n) write((fd), (p), (n))
+#define WalSeek(fd, pos, whence) lseek((fd), (pos), (whence))
+#define WalTruncate(fd, size) (ftruncate((fd), (size)) == 0)
+#define WalSync(fd) (fdatasync(fd) == 0)
+#define WalClose(fd) close(fd)
+#endif
+
+typedef struct {
+    WalDoneFn done;
+    void* arg;
+} WalCallback;
+
+// Records waiting for one write+fsync, and what to run once it is done
+typedef struct {
+    unsigned char* data;
+    size_t len;
+    size_t cap;
+    LONG64 records;
+    WalCallback* callbacks;
+    int callbackCount;
+    int callbackCap;
+} WalBuffer;
+
+static CRITICAL_SECTION g_walLock;
+static CONDITION_VARIABLE g_walWork;        // the active buffer is no longer empty
+static CONDITION_VARIABLE g_walDurable;     // g_durableLsn moved
+static WalBuffer g_buffers[2];
+static WalBuffer* g_active = &g_buffers[0]; // appended to under g_walLock
+static ULONGLONG g_appendLsn = 0;           // end of the last record appended
+static ULONGLONG g_durableLsn = 0;          // end of the last record synced
+static ULONGLONG g_compactLsn = 0;          // requested by WalCompact, 0 if none
+static ULONGLONG g_fileBase = 0;            // position of the file's first byte
+static int g_walFd = -1;
+static char* g_walPath = NULL;
+static volatile LONG g_walEnabled = 0;
+static uint32_t g_crcTable[256];
+
+static void PutU32(unsigned char* p, uint32_t v) {
+    p[0] = (unsigned char)v;
+    p[1] = (unsigned char)(v >> 8);
+    p[2] = (unsigned char)(v >> 16);
+    p[3] = (unsigned char)(v >> 24);
+}
+
+static uint32_t GetU32(const unsigned char* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// CRC-32 (IEEE, reflected), as used by zip and Ethernet
+static void InitCrcTable(void) {
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        g_crcTable[i] = c;
+    }
+}
+
+static uint32_t Crc32(const unsigned char* p, size_t len) {
+    uint32_t c = 0xFFFFFFFFu;
+    while (len--) c = g_crcTable[(c ^ *p++) & 0xFF] ^ (c >> 8);
+    return c ^ 0xFFFFFFFFu;
+}
+
+BOOL WalEnabled(void) {
+    return ReadAcquire(&g_walEnabled) != 0;
+}
+
+static BOOL ReserveBuffer(WalBuffer* buf, size_t need) {
+    if (buf->len + need <= buf->cap) return TRUE;
+    size_t cap = buf->cap ? buf->cap : WAL_BUFFER_MIN_SIZE;
+    while (cap < buf->len + need) cap *= 2;
+    unsigned char* data = (unsigned char*)realloc(buf->data, cap);
+    if (!data) return FALSE;
+    buf->data = data;
+    buf->cap = cap;
+    return TRUE;
+}
+
+static BOOL AddCallback(WalBuffer* buf, WalDoneFn done, void* arg) {
+    if (buf->callbackCount == buf->callbackCap) {
+        int cap = buf->callbackCap ? buf->callbackCap * 2 : 64;
+        WalCallback* callbacks = (WalCallback*)realloc(buf->callbacks, sizeof(WalCallback) * cap);
+        if (!callbacks) return FALSE;
+        buf->callbacks = callbacks;
+        buf->callbackCap = cap;
+    }
+    buf->callbacks[buf->callbackCount].done = done;
+    buf->callbacks[buf->callbackCount].arg = arg;
+    buf->callbackCount++;
+    return TRUE;
+}
+
+ULONGLONG WalAppend(size_t len, WalFillFn fill, const void* ctx, WalDoneFn done, void* arg) {
+    if (len > 0xFFFFFFFFu - WAL_RECORD_HEADER_SIZE) return 0;
+    size_t need = WAL_RECORD_HEADER_SIZE + len;
+
+    EnterCriticalSection(&g_walLock);
+    WalBuffer* buf = g_active;
+    if (!ReserveBuffer(buf, need) || (done && !AddCallback(buf, done, arg))) {
+        LeaveCriticalSection(&g_walLock);
+        return 0;
+    }
+
+    unsigned char* out = buf->data + buf->len;
+    fill(ctx, out + WAL_RECORD_HEADER_SIZE);
+    PutU32(out, (uint32_t)len);
+    PutU32(out + 4, Crc32(out + WAL_RECORD_HEADER_SIZE, len));
+    buf->len += need;
+    buf->records++;
+    g_appendLsn += need;
+    ULONGLONG lsn = g_appendLsn;
+
+    // The log thread only sleeps on an empty buffer
+    if (buf->len == need) WakeConditionVariable(&g_walWork);
+    LeaveCriticalSection(&g_walLock);
+    return lsn;
+}
+
+void WalWait(ULONGLONG lsn) {
+    EnterCriticalSection(&g_walLock);
+    while (g_durableLsn < lsn) SleepConditionVariableCS(&g_walDurable, &g_walLock, INFINITE);
+    LeaveCriticalSection(&g_walLock);
+}
+
+ULONGLONG WalPosition(void) {
+    EnterCriticalSection(&g_walLock);
+    ULONGLONG lsn = g_appendLsn;
+    LeaveCriticalSection(&g_walLock);
+    return lsn;
+}
+
+void WalCompact(ULONGLONG lsn) {
+    EnterCriticalSection(&g_walLock);
+    if (lsn > g_compactLsn) g_compactLsn = lsn;
+    WakeConditionVariable(&g_walWork);
+    LeaveCriticalSection(&g_walLock);
+}
+
+static BOOL WriteAll(int fd, const unsigned char* data, size_t len) {
+    while (len > 0) {
+        size_t chunk = len > 0x40000000 ? 0x40000000 : len;
+        long n = (long)WalWriteSome(fd, data, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return FALSE;
+        data += n;
+        len -= (size_t)n;
+    }
+    return TRUE;
+}
+
+// A record that was acknowledged can no longer be taken back, and after a
+// failed fsync the kernel may have dropped the dirty pages: stop rather than
+// acknowledge anything else
+static void WalFailed(const char* what) {
+    LOG_ERROR("[ERROR] Write-ahead log %s failed: %d; stopping\n", what, errno);
+    LogFlush();
+    exit(EXIT_FAILURE);
+}
+
+static int OpenLogFile(const char* path, BOOL truncate) {
+    int flags = truncate ? O_TRUNC : 0;
+#ifdef _WIN32
+    return _open(path, _O_RDWR | _O_CREAT | _O_BINARY | flags, _S_IREAD | _S_IWRITE);
+#else
+    return open(path, O_RDWR | O_CREAT | O_CLOEXEC | flags, 0644);
+#endif
+}
+
+// Copy the log from lsn on into path + ".tmp" and rename it over the log.
+// Runs on the log thread with no batch in flight. On failure the old log is
+// kept whole, which replay handles just as well.
+static void CompactLog(ULONGLONG lsn) {
+    ULONGLONG end = g_durableLsn;       // only this thread moves it
+    if (lsn <= g_fileBase || lsn > end) return;
+
+    size_t pathLen = strlen(g_walPath);
+    char* tempPath = (char*)malloc(pathLen + 5);
+    unsigned char* chunk = (unsigned char*)malloc(WAL_BUFFER_MIN_SIZE);
+    int fd = -1;
+    BOOL ok = tempPath && chunk;
+    if (ok) {
+        snprintf(tempPath, pathLen + 5, "%s.tmp", g_walPath);
+        fd = OpenLogFile(tempPath, TRUE);
+        ok = fd >= 0 && WalSeek(g_walFd, (long long)(lsn - g_fileBase), SEEK_SET) >= 0;
+    }
+    for (ULONGLONG pos = lsn; ok && pos < end;) {
+        size_t want = end - pos < WAL_BUFFER_MIN_SIZE ? (size_t)(end - pos) : WAL_BUFFER_MIN_SIZE;
+        long n = (long)WalRead(g_walFd, chunk, want);
+        if (n < 0 && errno == EINTR) continue;
+        ok = n > 0 && WriteAll(fd, chunk, (size_t)n);
+        pos += n > 0 ? (ULONGLONG)n : 0;
+    }
+    ok = ok && WalSync(fd);
+
+#ifdef _WIN32
+    // An open file cannot be replaced on Windows
+    if (ok) {
+        _close(fd);
+        _close(g_walFd);
+        ok = MoveFileExA(tempPath, g_walPath, MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH) != 0;
+        g_walFd = OpenLogFile(g_walPath, FALSE);
+        if (g_walFd < 0) WalFailed("reopen");
+        fd = -1;
+    }
+#else
+    if (ok) ok = rename(tempPath, g_walPath) == 0;
+    if (ok) {
+        SyncParentDirectory(g_walPath);
+        close(g_walFd);
+        g_walFd = fd;
+        fd = -1;
+    }
+#endif
+
+    if (ok) {
+        LOG_INFO("[Server] Write-ahead log compacted: dropped %llu bytes, %llu kept\n",
+            (unsigned long long)(lsn - g_fileBase), (unsigned long long)(end - lsn));
+        g_fileBase = lsn;
+    }
+    else {
+        LOG_WARN("[Server] Write-ahead log compaction failed: %d; keeping the whole log\n", errno);
+        if (fd >= 0) WalClose(fd);
+        if (tempPath) remove(tempPath);
+    }
+    // Appends continue at the end of whichever file is now the log
+    if (WalSeek(g_walFd, 0, SEEK_END) < 0) WalFailed("seek");
+    free(chunk);
+    free(tempPath);
+}
+
+#ifdef _WIN32
+static unsigned __stdcall WalThread(void* param)
+#else
+static void* WalThread(void* param)
+#endif
+{
+    (void)param;
+    EnterCriticalSection(&g_walLock);
+    while (1) {
+        while (g_active->len == 0 && g_compactLsn == 0) {
+            SleepConditionVariableCS(&g_walWork, &g_walLock, INFINITE);
+        }
+
+        // Between batches everything appended so far is in the file
+        if (g_compactLsn != 0) {
+            ULONGLONG lsn = g_compactLsn;
+            g_compactLsn = 0;
+            LeaveCriticalSection(&g_walLock);
+            CompactLog(lsn);
+            EnterCriticalSection(&g_walLock);
+            continue;
+        }
+
+        // Appenders move on to the other buffer while this one is written
+        WalBuffer* batch = g_active;
+        g_active = batch == &g_buffers[0] ? &g_buffers[1] : &g_buffers[0];
+        ULONGLONG end = g_appendLsn;
+        LeaveCriticalSection(&g_walLock);
+
+        ULONGLONG start = MetricsNow();
+        if (!WriteAll(g_walFd, batch->data, batch->len)) WalFailed("write");
+        if (!WalSync(g_walFd)) WalFailed("fsync");
+
+        MetricsRecord* metrics = Metrics();
+        MetricsObserve(&metrics->walSync, MetricsNow() - start);
+        metrics->walSyncs++;
+        metrics->walRecords += batch->records;
+        metrics->walBytes += (LONG64)batch->len;
+
+        EnterCriticalSection(&g_walLock);
+        g_durableLsn = end;
+        WakeAllConditionVariable(&g_walDurable);
+        LeaveCriticalSection(&g_walLock);
+
+        for (int i = 0; i < batch->callbackCount; i++) batch->callbacks[i].done(batch->callbacks[i].arg);
+        batch->len = 0;
+        batch->records = 0;
+        batch->callbackCount = 0;
+        if (batch->cap > WAL_BUFFER_MIN_SIZE * 64) {
+            // Do not keep a burst's buffer around
+            free(batch->data);
+            batch->data = NULL;
+            batch->cap = 0;
+        }
+
+        EnterCriticalSection(&g_walLock);
+    }
+    return 0;
+}
+
+// Read the whole log, hand each intact record to replay and return the
+// length of the intact prefix, or -1 if the file cannot be read
+static long long ReplayLog(WalReplayFn replay, LONG64* records) {
+    long long size = (long long)WalSeek(g_walFd, 0, SEEK_END);
+    if (size < 0 || WalSeek(g_walFd, 0, SEEK_SET) != 0) return -1;
+    if (size == 0) return 0;
+
+    unsigned char* data = (unsigned char*)malloc((size_t)size);
+    if (!data) return -1;
+    long long have = 0;
+    while (have < size) {
+        size_t chunk = size - have > 0x40000000 ? 0x40000000 : (size_t)(size - have);
+        long n = (long)WalRead(g_walFd, data + have, chunk);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        have += n;
+    }
+
+    long long pos = 0;
+    while (have - pos >= WAL_RECORD_HEADER_SIZE) {
+        uint32_t len = GetU32(data + pos);
+        if ((long long)len > have - pos - WAL_RECORD_HEADER_SIZE) break;
+        const unsigned char* payload = data + pos + WAL_RECORD_HEADER_SIZE;
+        if (Crc32(payload, len) != GetU32(data + pos + 4)) break;
+        replay(payload, len);
+        pos += WAL_RECORD_HEADER_SIZE + len;
+        (*records)++;
+    }
+    free(data);
+    return pos;
+}
+
+// A new log's directory entry must be durable too, or a crash can lose the
+// whole file along with records already acknowledged
+void SyncParentDirectory(const char* path) {
+#ifdef _WIN32
+    (void)path;     // NTFS journals the rename itself
+#else
+    char dir[4096];
+    const char* slash = strrchr(path, '/');
+    if (!slash) snprintf(dir, sizeof(dir), ".");
+    else snprintf(dir, sizeof(dir), "%.*s", slash == path ? 1 : (int)(slash - path), path);
+
+    int fd = open(dir, O_RDONLY);
+    if (fd < 0) return;
+    if (fsync(fd) != 0) LOG_WARN("[Server] fsync of directory %s failed: %d\n", dir, errno);
+    close(fd);
+#endif
+}
+
+BOOL WalOpen(const char* path, WalReplayFn replay) {
+    InitializeCriticalSection(&g_walLock);
+    InitializeConditionVariable(&g_walWork);
+    InitializeConditionVariable(&g_walDurable);
+    InitCrcTable();
+
+    g_walPath = (char*)malloc(strlen(path) + 1);
+    if (!g_walPath) return FALSE;
+    memcpy(g_walPath, path, strlen(path) + 1);
+
+    g_walFd = OpenLogFile(path, FALSE);
+    if (g_walFd < 0) {
+        LOG_ERROR("[ERROR] Cannot open write-ahead log %s: %d\n", path, errno);
+        return FALSE;
+    }
+
+    LONG64 records = 0;
+    ULONGLONG start = MetricsNow();
+    long long intact = ReplayLog(replay, &records);
+    if (intact < 0) {
+        LOG_ERROR("[ERROR] Cannot read write-ahead log %s: %d\n", path, errno);
+        return FALSE;
+    }
+
+    long long size = (long long)WalSeek(g_walFd, 0, SEEK_END);
+    if (size > intact) {
+        LOG_WARN("[Server] Write-ahead log %s: dropping %lld bytes of incomplete records at offset %lld\n",
+            path, size - intact, intact);
+        if (!WalTruncate(g_walFd, intact) || !WalSync(g_walFd)) {
+            LOG_ERROR("[ERROR] Cannot truncate write-ahead log %s: %d\n", path, errno);
+            return FALSE;
+        }
+    }
+    if (WalSeek(g_walFd, intact, SEEK_SET) != intact) return FALSE;
+    if (size == 0) SyncParentDirectory(path);
+
+    g_appendLsn = g_durableLsn = (ULONGLONG)intact;
+    LOG_INFO("[Server] Write-ahead log %s: replayed %lld records (%lld bytes) in %llu ms\n",
+        path, (long long)records, intact, (unsigned long long)(MetricsNow() - start) / 1000);
+
+#ifdef _WIN32
+    HANDLE thread = (HANDLE)_beginthreadex(NULL, 0, WalThread, NULL, 0, NULL);
+    if (thread == NULL) return FALSE;
+    CloseHandle(thread);
+#else
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, WalThread, NULL) != 0) return FALSE;
+    pthread_detach(thread);
+#endif
+    InterlockedExchange(&g_walEnabled, 1);
+    return TRUE;
+}
@@ -0,0 +1,60 @@
+/// wal.h
+// Append-only write-ahead log with group commit.
+//
+// Appenders copy their record into the log's in-memory buffer under a short
+// lock and return; nobody waits on the disk in the request path. One log
+// thread swaps the buffer out, writes it with a single write and makes it
+// durable with a single fsync, then runs the completion attached to each
+// record in it. Everything appended while one fsync is in flight goes out
+// together in the next, so the number of fsyncs follows the disk, not the
+// number of writes.
+//
+// On disk a record is its payload length and CRC-32 (both little-endian u32)
+// followed by the payload, whose layout belongs to the caller (docs_server.c).
+// Replay stops at the first record that is short or fails its checksum, the
+// tail left by a crash mid-write, and cuts the file there before appending.
+// Positions (lsn) count bytes appended since the process started, across
+// compactions.
+#ifndef WAL_H
+#define WAL_H
+
+#include "platform.h"
+
+#define WAL_RECORD_HEADER_SIZE 8
+#define WAL_BUFFER_MIN_SIZE 65536
+
+// Writes a record's payload; called with the log's lock held
+typedef void (*WalFillFn)(const void* ctx, unsigned char* out);
+// Runs on the log thread once the record it was attached to is durable
+typedef void (*WalDoneFn)(void* arg);
+// Called for each intact record, in log order, before WalOpen returns
+typedef void (*WalReplayFn)(const unsigned char* payload, size_t len);
+
+// Replay the log at path, then open it for appending and start the log
+// thread. FALSE if the file cannot be read or opened.
+BOOL WalOpen(const char* path, WalReplayFn replay);
+
+// TRUE once WalOpen has succeeded (so not during replay)
+BOOL WalEnabled(void);
+
+// Append one record of len payload bytes. done(arg), if given, runs once the
+// record is durable. Returns the log position just past the record, for
+// WalWait, or 0 if the record could not be buffered.
+ULONGLONG WalAppend(size_t len, WalFillFn fill, const void* ctx, WalDoneFn done, void* arg);
+
+// Block until everything up to position lsn is durable
+void WalWait(ULONGLONG lsn);
+
+// Position just past the last record appended (a record boundary)
+ULONGLONG WalPosition(void);
+
+// Drop every record before lsn, a position from WalPosition that is already
+// durable and whose effects a snapshot has saved. The log thread copies the
+// rest to a new file that replaces the log with one rename; appends carry on
+// into the buffer meanwhile.
+void WalCompact(ULONGLONG lsn);
+
+// Make a new or renamed file's directory entry durable (no-op on Windows)
+void SyncParentDirectory(const char* path);
+
+#endif // WAL_H